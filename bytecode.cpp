@@ -1,10 +1,34 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <algorithm>
 #include <map>
+#include <set>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dlfcn.h>
+#endif
+
+// the baseline jit (see jit_compile()) only targets x86-64 Linux; everywhere else modules are always interpreted
+#if defined(__x86_64__) && defined(__linux__)
+#define NOTGML_JIT
+#endif
 
 struct value {
     double real = 0;
@@ -26,1001 +50,6137 @@ struct value {
     }
 };
 
-struct progstate;
-struct globalstate
+// process-wide symbol interner. every distinct name gets a small integer id, and variables are keyed by that id
+// instead of by string. modules map their own symbol table indices to these ids when they're loaded.
+// it's shared by every context, so interning takes a lock; that only happens when a module is opened, never while
+// code runs.
+struct symboltable
 {
-    std::map<double, progstate *> instances;
-    double nextinstance = 1000000;
+    std::vector<std::string> names;
+    std::map<std::string, uint32_t, std::less<>> ids;
+    std::mutex lock;
     
-    double instance_spawn();
+    uint32_t intern(std::string_view name)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = ids.find(name);
+        if(found != ids.end())
+            return found->second;
+        uint32_t id = names.size();
+        names.emplace_back(name);
+        ids.emplace(name, id);
+        return id;
+    }
     
-    void reset()
+    // built-in instance variables get fixed ids
+    symboltable()
     {
-        instances.clear();
-        nextinstance = 1000000;
+        intern("x");
+        intern("y");
+        intern("object_id");
+        intern("id");
     }
 };
 
-globalstate global;
+enum {
+    SYM_X = 0,
+    SYM_Y = 1,
+    SYM_OBJECT_ID = 2,
+    SYM_ID = 3,
+    NO_SYMBOL = 0xFFFFFFFF,
+};
 
-struct progstate
+// x, y, object_id and id of an instance aren't kept in its scopes, see globalstate
+bool is_builtin_field(uint32_t symbol)
 {
-    uint64_t pc = 0;
-    bool truth_register = false;
+    return symbol <= SYM_ID;
+}
+
+// an instance's id and type are fixed when it's created
+bool is_readonly_field(uint32_t symbol)
+{
+    return symbol == SYM_ID or symbol == SYM_OBJECT_ID;
+}
+
+symboltable symtab;
+
+// the layout of a scope: which symbols it holds, and in which slots. scopes that declare the same names in the same
+// order share a shape, so the keys and lookup index are stored once instead of in every scope, and a slot found
+// through one scope's shape is valid in every other scope with that shape.
+// shapes form a tree rooted at the empty shape. declaring a variable moves a scope along the transition for that
+// symbol, which creates the child shape the first time it's taken. shapes live until the process exits.
+// most shapes only hold a handful of symbols, so lookups scan the key array linearly; past linear_limit entries, an
+// open addressing index (linear probing, power of two capacity) is built over it
+struct shape
+{
+    static constexpr uint64_t linear_limit = 8;
+    static constexpr int quick_transitions = 4;
     
-    bool lvalue_islocal = true; // if false, reference under lvalue_id
-    double lvalue_id = 0;
-    std::string lvalue_name = "";
+    uint32_t id = 1; // unique to the shape, so inline caches can name it in a single word
+    std::vector<uint32_t> keys; // symbol in each slot, in declaration order
+    std::vector<uint32_t> index; // slot plus one, 0 for an empty bucket; empty until past linear_limit
+    // instances running in parallel, and programs running in separate contexts, declare variables at the same time,
+    // and the transition tree is shared between all of them. the first few transitions out of a shape are published here and followed without taking any lock;
+    // adding a transition, or finding one past those, takes transition_lock.
+    std::atomic<shape *> quick[quick_transitions] = {};
+    std::map<uint32_t, std::unique_ptr<shape>> transitions;
+    static std::mutex transition_lock;
+    static uint32_t count; // shapes made so far, guarded by transition_lock
     
-    std::vector<uint8_t> bytecode; // main function of program
-    std::vector<std::map<std::string, value>> variables;
-    std::vector<std::vector<value>> stack;
-    std::vector<uint64_t> stackdepths;
+    static uint64_t bucket(uint32_t symbol, uint64_t mask)
+    {
+        return (uint32_t(symbol * 0x9E3779B1u) >> 7) & mask;
+    }
     
-    void reset()
+    // slot of the symbol, or -1
+    int64_t find(uint32_t symbol) const
     {
-        pc = 0;
-        truth_register = false;
-        variables.clear();
-        stack.clear();
-        stackdepths.clear();
+        if(index.size() == 0)
+        {
+            for(uint64_t i = 0; i < keys.size(); i++)
+            {
+                if(keys[i] == symbol)
+                    return i;
+            }
+            return -1;
+        }
+        uint64_t mask = index.size()-1;
+        for(uint64_t i = bucket(symbol, mask); index[i] != 0; i = (i+1) & mask)
+        {
+            if(keys[index[i]-1] == symbol)
+                return index[i]-1;
+        }
+        return -1;
     }
     
-    void exit()
+    // the shape with one more slot, holding the given symbol
+    shape * with(uint32_t symbol)
     {
-        while(variables.size() > 1)
-            variables.pop_back();
-        while(stack.size() > 1)
-            stack.pop_back();
-        stackdepths.clear();
-        truth_register = false;
-        pc = 0;
+        for(auto & entry : quick)
+        {
+            auto child = entry.load(std::memory_order_acquire);
+            if(child == nullptr)
+                break;
+            if(child->keys.back() == symbol)
+                return child;
+        }
+        
+        std::lock_guard<std::mutex> guard(transition_lock);
+        auto & child = transitions[symbol];
+        if(!child)
+        {
+            child.reset(new shape);
+            child->id = ++count;
+            child->keys = keys;
+            child->keys.push_back(symbol);
+            if(child->keys.size() > linear_limit)
+            {
+                uint64_t size = 32;
+                while(size < child->keys.size()*2)
+                    size *= 2;
+                child->index.assign(size, 0);
+                for(uint64_t i = 0; i < child->keys.size(); i++)
+                    child->place(i);
+            }
+            for(auto & entry : quick)
+            {
+                if(entry.load(std::memory_order_relaxed) == nullptr)
+                {
+                    entry.store(child.get(), std::memory_order_release);
+                    break;
+                }
+            }
+        }
+        return child.get();
+    }
+    
+    void place(uint64_t slot)
+    {
+        uint64_t mask = index.size()-1;
+        uint64_t i = bucket(keys[slot], mask);
+        while(index[i] != 0)
+            i = (i+1) & mask;
+        index[i] = slot+1;
     }
 };
 
-double globalstate::instance_spawn()
+std::mutex shape::transition_lock;
+uint32_t shape::count = 1;
+shape empty_shape;
+
+// a single variable declaration table: a shape saying where each symbol lives, and the values in those slots
+struct scope
 {
-    auto n = new progstate;
-    auto id = global.nextinstance;
-    global.nextinstance++;
+    shape * layout = &empty_shape;
+    std::vector<value> values; // one per slot of the shape
+    uint64_t stackbase = 0; // height of the value stack when the scope was opened
     
-    global.instances[id] = n;
-    n->variables.push_back({});
-    n->stack.push_back({});
+    value * find(uint32_t symbol)
+    {
+        auto slot = layout->find(symbol);
+        if(slot < 0)
+            return nullptr;
+        return &values[slot];
+    }
     
-    return id;
-}
+    // returns nullptr if the symbol is already declared in this scope
+    value * insert(uint32_t symbol, const value & initial)
+    {
+        if(layout->find(symbol) >= 0)
+            return nullptr;
+        layout = layout->with(symbol);
+        values.push_back(initial);
+        return &values.back();
+    }
+    
+    uint64_t size()
+    {
+        return values.size();
+    }
+    
+    void clear()
+    {
+        layout = &empty_shape;
+        values.clear();
+    }
+};
 
-enum {
-    NOP       = 0x00,
-    PUSHVAL   = 0x01,
-    PUSHTEXT  = 0x02,
-    PUSHVAR   = 0x03,
-    POP       = 0x04,
-    DECLARE   = 0x05,
-    DECLSET   = 0x06,
-    BINOP     = 0x07,
-    UNOP      = 0x08,
-    DIRECT    = 0x09, // direct variable reference (e.g. x)
-    INDIRECT  = 0x0A, // indirect variable reference (e.g. other.x)
-    INDEXP    = 0x0B,
-    BINAS     = 0x0C,
-    UNAS      = 0x0D,
-    TRUTH     = 0x0E,
-    OPENSCOPE = 0x10, // opens a new variable declaration table
-    EXITSCOPE = 0x11, // closes current var dec table
-    SAVESCOPE = 0x12, // saves the current depth we're on in the stack of var decl tables to a stack
-    LOADSCOPE = 0x13, // goes to saved stack depth
-    BREAK     = 0x14, // jumps to offset and goes to saved stack depth
-    JSIT      = 0x15,
-    JLIT      = 0x16,
-    JSIF      = 0x17,
-    JLIF      = 0x18,
-    JS        = 0x19,
-    JL        = 0x1A,
-    CALL      = 0x1B, // note: uses a unique progstate when calling a user-defined function
-    FUNCDEF   = 0x1C,
-    RETURN    = 0x1D,
+// program-level constant pool: string literals and names are stored once here and
+// the bytecode refers to them by 16-bit index instead of carrying inline text
+struct constpool
+{
+    std::vector<std::string> texts; // string literals (PUSHTEXT)
+    std::vector<std::string> symbols; // variable and function names
+    std::map<std::string, uint16_t> text_lookup; // only used while compiling
+    std::map<std::string, uint16_t> symbol_lookup;
+    
+    uint16_t add_text(const std::string & text)
+    {
+        if(text_lookup.count(text))
+            return text_lookup[text];
+        if(texts.size() >= 0x10000)
+        {
+            puts("Internal error: too many distinct string literals in program for the constant pool");
+            exit(0);
+        }
+        uint16_t index = texts.size();
+        texts.push_back(text);
+        text_lookup[text] = index;
+        return index;
+    }
+    uint16_t add_symbol(const std::string & name)
+    {
+        if(symbol_lookup.count(name))
+            return symbol_lookup[name];
+        if(symbols.size() >= 0x10000)
+        {
+            puts("Internal error: too many distinct names in program for the symbol table");
+            exit(0);
+        }
+        uint16_t index = symbols.size();
+        symbols.push_back(name);
+        symbol_lookup[name] = index;
+        return index;
+    }
 };
 
+// bytecode format versions
+// version 1: operands are big endian and packed directly after the opcode. this is what compile() emits,
+//  because it's position independent and lets the compiler splice blocks together freely.
+// version 2: operands are native endian and naturally aligned relative to the start of the code, with zero
+//  padding between the opcode and the operand, so the interpreter reads each one with a single load.
+//  no longer loaded.
+// version 3: version 2, plus an inline cache slot operand on INDIRECT and INDEXP, numbered by convert_bytecode()
+//  and counted in the header. convert_bytecode() turns version 1 into version 3. this is the only format the
+//  interpreter runs. the NUM instructions only exist in it, where the optimizer puts them.
 enum {
-    ADD = 0x80,
-    SUB = 0x81,
-    MUL = 0x82,
-    DIV = 0x83,
-    EQ  = 0x84,
-    NEQ = 0x85,
-    GTE = 0x86,
-    LTE = 0x87,
-    GT  = 0x88,
-    LT  = 0x89,
-    AND = 0x8A,
-    OR  = 0x8B
+    BYTECODE_V1 = 1,
+    BYTECODE_V2 = 2,
+    BYTECODE_V3 = 3,
+    BYTECODE_VERSION = BYTECODE_V3,
 };
 
-enum {
-    POSITIVE = 0x80,
-    NEGATIVE = 0x81,
-    NEGATION = 0x82,
+// a constant pool table entry in a program image: a NUL terminated string stored elsewhere in the image
+struct poolentry
+{
+    uint32_t offset; // from the start of the image
+    uint32_t length; // not counting the terminator
+};
+
+// program image layout:
+//  header
+//  string literal table: textcount poolentries
+//  symbol table: symbolcount poolentries
+//  string data
+//  zero padding up to codeoffset, which is a multiple of 8
+//  codesize bytes of code
+// the header and tables are written in native byte order, so byteorder reads back as 0x0201 on a machine of the
+// other endianness
+struct bytecode_header
+{
+    char magic[4] = {'N', 'G', 'M', 'L'};
+    uint16_t version = BYTECODE_VERSION;
+    uint16_t byteorder = 0x0102;
+    uint64_t sourcehash = 0; // hash of the source text the code was compiled from, 0 if unknown
+    uint32_t textcount = 0;
+    uint32_t symbolcount = 0;
+    uint32_t cachecount = 0; // number of inline cache slots the code uses
+    uint32_t reserved = 0;
+    uint64_t codeoffset = 0;
+    uint64_t codesize = 0;
+};
+
+struct progstate;
+
+// inline cache for a single INDIRECT or INDEXP instruction: the shape and slot the field was last found at in an
+// instance's root scope. the slot is only remembered while the instance has no inner scopes open, so nothing can
+// shadow the field; it then holds for any instance whose root scope has that shape.
+// the shape id and slot are packed into one word, so programs in separate contexts running the same module can fill
+// the cache at the same time without ever seeing one's shape with the other's slot.
+struct fieldcache
+{
+    std::atomic<uint64_t> entry{0}; // shape id << 32 | slot; no shape has id 0
+    
+    fieldcache() {}
+    fieldcache(const fieldcache & other) : entry(other.entry.load(std::memory_order_relaxed)) {}
+    fieldcache & operator=(const fieldcache & other)
+    {
+        entry.store(other.entry.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
 };
 
 enum {
-    ASSIGN = 0x80,
-    MUTADD = 0x81,
-    MUTSUB = 0x82,
-    MUTMUL = 0x83,
-    MUTDIV = 0x84,
+    NO_FUNCTION = 0xFFFFFFFF,
+};
+
+// a function defined in a module
+struct scriptfunction
+{
+    uint64_t entry; // start of the body, right after its FUNCDEF
+    uint8_t arity;
+};
+
+// a function implemented by the host, see builtintable. args points at the arguments where they sit on the caller's
+// value stack, first argument first. returns false to stop the program, after printing an error.
+typedef bool (*nativefunction)(progstate * program, const value * args, value * result);
+
+struct jitframe;
+struct aotruntime;
+
+// a module compiled ahead of time, see aot_emit(). runs the module from pc like interpret() does.
+typedef bool (*aotentry)(const aotruntime * runtime, jitframe * frame, bool * truth, uint64_t pc);
+
+// machine code for a verified module, see jit_compile(). it's compiled the first time the module runs in a context with
+// the jit on, and shared by everything running the module, like the module itself
+struct jitcode
+{
+    uint8_t * memory = nullptr;
+    uint64_t size = 0;
+    std::vector<const uint8_t *> addresses; // where each instruction's code starts, by bytecode position
+    bool (*enter)(jitframe * frame, const uint8_t * start) = nullptr; // nullptr if the module couldn't be compiled
+    
+    ~jitcode()
+    {
+#ifdef NOTGML_JIT
+        if(memory)
+            munmap(memory, size);
+#endif
+    }
+};
+
+// where the interpreter picks a loop back up when a looptrace leaves it, and the scopes that were open at that point
+// in the loop body, which the trace itself never opens
+struct traceexit
+{
+    uint64_t pc;
+    bool truth; // the truth register
+    uint32_t scopes; // how many scopes to open on top of the ones that were open at the loop head
+    std::vector<uint64_t> saved; // depths to push onto the saved scope depths, relative to the depth at the loop head
+};
+
+// machine code for one iteration of a hot loop, as it went when it was recorded, see record_trace(). it runs the loop
+// with its variables in registers for as long as every branch goes the same way it did then, and returns the exit it
+// left through as soon as one doesn't.
+struct looptrace
+{
+    uint8_t * memory = nullptr;
+    uint64_t size = 0;
+    uint32_t (*run)(double ** variables) = nullptr;
+    std::vector<uint32_t> symbols; // the variables the trace uses, in the order run() takes them
+    bool builtin_names = false; // some of them are named like built-in variables, so it can't run on an instance
+    std::vector<traceexit> exits;
+    
+    ~looptrace()
+    {
+#ifdef NOTGML_JIT
+        if(memory)
+            munmap(memory, size);
+#endif
+    }
+};
+
+enum : uint32_t {
+    LOOP_HOT = 64, // iterations before a loop gets recorded
+    LOOP_RECORDING = 0xFFFFFFFD,
+    LOOP_TRACED = 0xFFFFFFFE,
+    LOOP_UNTRACEABLE = 0xFFFFFFFF,
+};
+
+// the head of a loop in a module. count goes up every time the interpreter jumps back to it until it reaches LOOP_HOT,
+// and then says what became of it.
+struct loopstate
+{
+    std::atomic<uint32_t> count{0};
+    std::atomic<looptrace *> trace{nullptr};
+};
+
+// a program image that the interpreter runs in place. the image is either owned (freshly compiled, read from a
+// file, or converted from an older format) or a read-only mapping of a module file, in which case nothing is copied
+// and every process running the same file shares its pages.
+struct module
+{
+    std::vector<uint8_t> owned;
+    void * mapping = nullptr;
+    uint64_t mappingsize = 0;
+    
+    const uint8_t * image = nullptr;
+    uint64_t imagesize = 0;
+    const uint8_t * code = nullptr;
+    uint64_t codesize = 0;
+    const poolentry * texts = nullptr;
+    uint32_t textcount = 0;
+    const poolentry * symbols = nullptr;
+    uint32_t symbolcount = 0;
+    uint64_t sourcehash = 0;
+    bool verified = false; // set by verify_bytecode(); verified modules run without defensive checks
+    // also set by verify_bytecode(): the code calls no functions and only reaches other instances through their
+    // built-in variables, so instances can run it in parallel (see globalstate::dispatch())
+    bool isolated = false;
+    std::vector<uint32_t> symbolids; // interned id of each entry in the symbol table, filled in when the module is opened
+    // the module's functions, and which one each entry in the symbol table names (NO_FUNCTION if none), so CALL finds
+    // its callee without looking at the name; filled in by verify_bytecode()
+    std::vector<scriptfunction> functions;
+    std::vector<uint32_t> function_of;
+    // the native function each entry in the symbol table was linked to (nullptr if none), for every name the module
+    // calls that isn't one of its own functions; filled in by verify_bytecode()
+    std::vector<nativefunction> natives;
+    // inline caches, writable even when the image is mapped read-only and the module is otherwise immutable; they
+    // only depend on shapes, so sharing them between every instance running the module is fine
+    mutable std::vector<fieldcache> caches;
+    mutable std::atomic<jitcode *> jitted{nullptr};
+    // where each loop starts, in order, and how hot it is; filled in by verify_bytecode(), see run_hot_loop()
+    std::vector<uint64_t> loopheads;
+    mutable std::vector<loopstate> loops;
+    // the module compiled ahead of time, and the shared library it's in, once attach_aot() has found it there
+    mutable std::shared_ptr<void> aotlibrary;
+    mutable aotentry aot = nullptr;
+    
+    std::string_view text(uint64_t index) const
+    {
+        return std::string_view((const char *)image + texts[index].offset, texts[index].length);
+    }
+    std::string_view symbol(uint64_t index) const
+    {
+        return std::string_view((const char *)image + symbols[index].offset, symbols[index].length);
+    }
+    
+    void unload();
+    
+    module() {}
+    module(const module &) = delete;
+    module & operator=(const module &) = delete;
+    module(module && other)
+    {
+        *this = std::move(other);
+    }
+    module & operator=(module && other)
+    {
+        if(this == &other)
+            return *this;
+        unload();
+        // moving the vector keeps its buffer, so pointers into it stay valid
+        owned = std::move(other.owned);
+        mapping = other.mapping;
+        mappingsize = other.mappingsize;
+        image = other.image;
+        imagesize = other.imagesize;
+        code = other.code;
+        codesize = other.codesize;
+        texts = other.texts;
+        textcount = other.textcount;
+        symbols = other.symbols;
+        symbolcount = other.symbolcount;
+        sourcehash = other.sourcehash;
+        verified = other.verified;
+        isolated = other.isolated;
+        symbolids = std::move(other.symbolids);
+        functions = std::move(other.functions);
+        function_of = std::move(other.function_of);
+        natives = std::move(other.natives);
+        caches = std::move(other.caches);
+        jitted.store(other.jitted.exchange(nullptr));
+        loopheads = std::move(other.loopheads);
+        loops = std::move(other.loops);
+        aotlibrary = std::move(other.aotlibrary);
+        aot = other.aot;
+        other.mapping = nullptr;
+        other.unload();
+        return *this;
+    }
+    ~module()
+    {
+        unload();
+    }
 };
 
+// a module is immutable once it's been opened and verified, so a single copy is shared by every progstate running it,
+// however many instances run the same script
+typedef std::shared_ptr<const module> moduleref;
+
 enum {
-    INCREMENT = 0x80,
-    DECREMENT = 0x81,
+    EVENT_CREATE,
+    EVENT_STEP,
+    EVENT_DESTROY,
+    EVENT_COUNT,
+    NO_TYPE = 0xFFFFFFFF,
 };
 
-void interpret(progstate * program)
+// an object type: the compiled scripts its instances run for each event, registered once and shared by all of them.
+// an instance's object_id is the index of its type in globalstate::objects; instances whose object_id isn't a
+// registered type don't run any events.
+struct objecttype
 {
-    if(program == nullptr)
+    std::string name;
+    moduleref events[EVENT_COUNT]; // nullptr for events the type doesn't handle
+    std::vector<uint32_t> members; // slots of the type's live instances, in no particular order
+};
+
+// an entry in the instance table
+struct instanceslot
+{
+    progstate * instance = nullptr; // nullptr while the slot is free
+    uint32_t generation = 0; // bumped every time the slot is freed, so ids of destroyed instances go stale
+    uint32_t link = 0; // position in globalstate::live while in use, next free slot while free
+    uint32_t type = NO_TYPE;
+    uint32_t member = 0; // position in the type's members
+};
+
+// a fixed set of threads that runs a job over a range of indices. the range is cut into chunks and dealt out evenly;
+// each worker takes chunks off the front of its own share, and once that runs dry it steals the back half of another
+// worker's share, so a few slow chunks don't leave the rest of the workers idle. the thread calling run() is worker 0.
+struct workerpool
+{
+    typedef std::function<void(uint64_t begin, uint64_t end, uint32_t worker)> job;
+    
+    struct share
     {
-        puts("Program is nullptr");
-        return;
+        std::mutex lock;
+        uint64_t begin = 0;
+        uint64_t end = 0;
+    };
+    
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<share>> shares; // one per worker
+    uint64_t chunk = 1;
+    
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    const job * current = nullptr;
+    uint64_t round = 0; // bumped by every run(), so a sleeping thread can tell a new job from a spurious wakeup
+    uint32_t working = 0; // threads that haven't run out of chunks yet
+    bool stopping = false;
+    
+    explicit workerpool(uint32_t count)
+    {
+        count = std::max<uint32_t>(count, 1);
+        for(uint32_t i = 0; i < count; i++)
+            shares.emplace_back(new share);
+        for(uint32_t i = 1; i < count; i++)
+            threads.emplace_back([this, i]{ serve(i); });
     }
-    auto & pc = program->pc;
-    auto & bytecode = program->bytecode;
-    auto & variables = program->variables;
-    auto & stack = program->stack;
-    auto & truth_register = program->truth_register;
-    variables.push_back({});
-    stack.push_back({});
-    auto * valstack = &(stack[0]);
-    auto * varstack = &(variables[0]);
-    auto & stackdepths = program->stackdepths;
-    auto & lvalue_islocal = program->lvalue_islocal;
-    auto & lvalue_id = program->lvalue_id;
-    auto & lvalue_name = program->lvalue_name;
-    while(1)
+    ~workerpool()
     {
-        if(pc == bytecode.size())
-        {
-            puts("Exited program");
-            return;
-        }
-        //printf(">%08X\n", pc);
-        if(pc > bytecode.size())
         {
-            puts("Flew out of program");
-            return;
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
         }
-        auto loc = pc;
-        auto opcode = bytecode[pc++];
-        switch(opcode)
-        {
-        case NOP:
+        wake.notify_all();
+        for(auto & thread : threads)
+            thread.join();
+    }
+    workerpool(const workerpool &) = delete;
+    workerpool & operator=(const workerpool &) = delete;
+    
+    uint32_t size() const
+    {
+        return shares.size();
+    }
+    
+    // runs the job over [0, count) in chunks of up to chunksize indices, returning once all of them are done
+    void run(uint64_t count, uint64_t chunksize, const job & work)
+    {
+        chunk = std::max<uint64_t>(chunksize, 1);
+        uint64_t chunks = (count+chunk-1)/chunk;
+        for(uint64_t i = 0; i < shares.size(); i++)
         {
-            break;
+            shares[i]->begin = std::min(count, chunks*i/shares.size()*chunk);
+            shares[i]->end = std::min(count, chunks*(i+1)/shares.size()*chunk);
         }
-        case PUSHVAL:
         {
-            uint8_t b1 = bytecode[pc++];
-            uint8_t b2 = bytecode[pc++];
-            uint8_t b3 = bytecode[pc++];
-            uint8_t b4 = bytecode[pc++];
-            uint8_t b5 = bytecode[pc++];
-            uint8_t b6 = bytecode[pc++];
-            uint8_t b7 = bytecode[pc++];
-            uint8_t b8 = bytecode[pc++];
-            // big endian
-            uint64_t temp = 0;
-            temp |= uint64_t(b1)<<(8*7);
-            temp |= uint64_t(b2)<<(8*6);
-            temp |= uint64_t(b3)<<(8*5);
-            temp |= uint64_t(b4)<<(8*4);
-            temp |= uint64_t(b5)<<(8*3);
-            temp |= uint64_t(b6)<<(8*2);
-            temp |= uint64_t(b7)<<(8*1);
-            temp |= uint64_t(b8)<<(8*0);
-            double value;
-            memcpy(&value, &temp, sizeof(double));
-            valstack->push_back(value);
-            break;
+            std::lock_guard<std::mutex> guard(lock);
+            current = &work;
+            working = threads.size();
+            round++;
         }
-        case PUSHTEXT:
+        wake.notify_all();
+        drain(0, work);
+        std::unique_lock<std::mutex> guard(lock);
+        finished.wait(guard, [this]{ return working == 0; });
+        current = nullptr;
+    }
+    
+    void serve(uint32_t worker)
+    {
+        uint64_t seen = 0;
+        while(1)
         {
-            std::string text;
-            uint8_t c = bytecode[pc++];
-            while (c != 0)
+            const job * work;
             {
-                text += c;
-                c = bytecode[pc++];
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [&]{ return stopping or round != seen; });
+                if(stopping)
+                    return;
+                seen = round;
+                work = current;
             }
-            
-            valstack->push_back(text);
-            break;
+            drain(worker, *work);
+            std::lock_guard<std::mutex> guard(lock);
+            if(--working == 0)
+                finished.notify_one();
         }
-        case PUSHVAR:
+    }
+    
+    void drain(uint32_t worker, const job & work)
+    {
+        uint64_t begin, end;
+        while(take(worker, &begin, &end))
+            work(begin, end, worker);
+    }
+    
+    // the next chunk for a worker, from its own share or stolen from another; false once every share is empty
+    bool take(uint32_t worker, uint64_t * begin, uint64_t * end)
+    {
+        auto & own = *shares[worker];
         {
-            std::string name;
-            uint8_t c = bytecode[pc++];
-            while (c != 0)
-            {
-                name += c;
-                c = bytecode[pc++];
-            }
-            
-            if(variables.size() == 0)
+            std::lock_guard<std::mutex> guard(own.lock);
+            if(own.begin < own.end)
             {
-                puts("Internal error: no stack of variables");
-                exit(0);
+                *begin = own.begin;
+                *end = std::min(own.end, own.begin+chunk);
+                own.begin = *end;
+                return true;
             }
-            auto varstack_current = variables.size()-1;
-            while(variables[varstack_current].count(name) == 0 and varstack_current > 0)
-                varstack_current--;
-            auto & vstack = variables[varstack_current];
-            if(vstack.count(name))
+        }
+        for(uint64_t i = 1; i < shares.size(); i++)
+        {
+            auto & victim = *shares[(worker+i) % shares.size()];
+            uint64_t stolen, stolen_end;
             {
-                valstack->push_back(vstack[name]);
+                std::lock_guard<std::mutex> guard(victim.lock);
+                if(victim.begin >= victim.end)
+                    continue;
+                uint64_t remaining = victim.end-victim.begin;
+                stolen_end = victim.end;
+                stolen = victim.end - std::min(remaining, std::max(chunk, remaining/2));
+                victim.end = stolen;
             }
-            else
-            {
-                puts("Error: access of undeclared variable");
-                return;
-            }
-            
-            break;
+            // run the first stolen chunk right away, and leave the rest where other workers can steal it in turn
+            *begin = stolen;
+            *end = std::min(stolen_end, stolen+chunk);
+            std::lock_guard<std::mutex> guard(own.lock);
+            own.begin = *end;
+            own.end = stolen_end;
+            return true;
         }
-        case POP:
+        return false;
+    }
+};
+
+// a write to another instance's built-in variable made during a parallel pass, held back until the pass is over
+struct deferredwrite
+{
+    uint64_t order; // position of the writing instance in the pass
+    uint32_t sequence; // writes that instance had already made during the pass
+    uint32_t symbol;
+    double target;
+    double operand;
+    uint8_t operation; // a BINAS operation
+};
+
+// how an instance running as part of a parallel pass sees the others: their built-in variables as they were when
+// the pass started, with writes to them buffered. its own variables it reads and writes directly, and since nothing
+// it does can be seen by another instance until the pass is over, the result doesn't depend on how many threads run
+// the pass or which instance runs first.
+struct passview
+{
+    const double * xs;
+    const double * ys;
+    std::vector<deferredwrite> * writes; // the buffer of the thread running the instance
+    uint64_t order;
+    uint32_t sequence = 0;
+    
+    void defer(double target, uint32_t symbol, uint8_t operation, double operand)
+    {
+        writes->push_back({order, sequence++, symbol, target, operand, operation});
+    }
+};
+
+// a vm context: the instance table, object types and everything else the programs running in it share. every
+// progstate points at the context it runs in, and nothing in one context is reachable from another, so separate
+// threads can each run a context of their own without any locking.
+// the instance table is a generational slot map. an instance id is a number that encodes a slot and the generation
+// of that slot when the instance was spawned, as 1000000 + slot + generation*2^32, so looking an id up is a bounds
+// check and a generation compare, and an id stays valid for exactly as long as its instance lives.
+// ids stay below 2^53 so they're exact as doubles; a slot whose generation runs out is retired instead of reused.
+struct globalstate
+{
+    static constexpr double first_id = 1000000;
+    static constexpr uint32_t max_generation = 1<<21;
+    static constexpr uint32_t no_slot = 0xFFFFFFFF;
+    static constexpr uint32_t max_nesting = 256;
+    
+    std::vector<instanceslot> slots;
+    std::vector<progstate *> live; // every live instance, densely packed for iteration, in no particular order
+    std::vector<uint32_t> liveslots; // slot of each entry in live
+    uint32_t freeslot = no_slot; // head of the free list threaded through instanceslot::link
+    std::vector<progstate *> spare; // states of released instances, recycled by instance_spawn()
+    
+    // built-in instance variables, parallel to live, so that updating every instance's position walks contiguous
+    // arrays instead of each instance's scopes. id isn't stored, since it follows from the slot.
+    std::vector<double> xs;
+    std::vector<double> ys;
+    std::vector<double> object_ids;
+    
+    std::vector<objecttype> objects;
+    std::vector<double> dispatching; // ids being run by dispatch(), kept to reuse its allocation
+    
+    // parallel passes; the buffers are kept between passes to reuse their allocations
+    std::unique_ptr<workerpool> workers; // nullptr to run every pass on the calling thread
+    std::vector<double> snapshot_xs;
+    std::vector<double> snapshot_ys;
+    std::vector<std::vector<deferredwrite>> deferred; // one buffer per worker, or one for the calling thread
+    std::vector<deferredwrite> applying;
+    
+    uint32_t nesting = 0; // create and destroy events that are running inside one another, each on its own C++ frames
+    
+    bool jit = false; // run verified modules as machine code where that's supported, see jit_compile()
+    bool tracing = true; // compile the hot loops of verified modules the interpreter runs, see run_hot_loop()
+    
+    globalstate() : deferred(1) {}
+    globalstate(const globalstate &) = delete;
+    globalstate & operator=(const globalstate &) = delete;
+    ~globalstate();
+    
+    double instance_spawn();
+    bool instance_release(double id);
+    
+    uint32_t define_object(const std::string & name);
+    double instance_create(double x, double y, double object_id);
+    bool instance_destroy(double id);
+    void dispatch(int event);
+    void dispatch_parallel(const std::vector<double> & ids, const moduleref & code);
+    
+    // how many threads run isolated event scripts; 0 runs them on the calling thread, as the same kind of pass
+    void set_threads(uint32_t count)
+    {
+        workers.reset(count > 0 ? new workerpool(count) : nullptr);
+        deferred.resize(std::max<uint32_t>(count, 1));
+    }
+    
+    // index of the object type an object_id refers to, or NO_TYPE
+    uint32_t type_of(double object_id) const
+    {
+        if(!(object_id >= 0 and object_id < objects.size()) or double(uint32_t(object_id)) != object_id)
+            return NO_TYPE;
+        return object_id;
+    }
+    
+    // returns no_slot if the id doesn't refer to a live instance
+    uint32_t find_slot(double id) const
+    {
+        if(!(id >= first_id and id < 9007199254740992.0))
+            return no_slot;
+        uint64_t handle = uint64_t(id);
+        if(double(handle) != id)
+            return no_slot;
+        handle -= uint64_t(first_id);
+        uint64_t slot = handle & 0xFFFFFFFF;
+        if(slot >= slots.size() or slots[slot].generation != (handle >> 32) or slots[slot].instance == nullptr)
+            return no_slot;
+        return slot;
+    }
+    
+    // returns nullptr if the id doesn't refer to a live instance
+    progstate * find_instance(double id) const
+    {
+        auto slot = find_slot(id);
+        return (slot == no_slot) ? nullptr : slots[slot].instance;
+    }
+    
+    // position of a live instance in live and the built-in variable arrays, or no_slot
+    uint32_t find_position(double id) const
+    {
+        auto slot = find_slot(id);
+        return (slot == no_slot) ? no_slot : slots[slot].link;
+    }
+    
+    // storage of a built-in variable of the instance at a position, nullptr for id
+    double * builtin(uint32_t position, uint32_t symbol)
+    {
+        switch(symbol)
         {
-            if(variables.size() == 0)
-            {
-                puts("Internal error: no stack of variables");
-                exit(0);
-            }
-            if(valstack->size() < 1)
-            {
-                puts("Error: no value on the stack to pop");
-                return;
-            }
-            valstack->pop_back();
-            
-            break;
+        case SYM_X: return &xs[position];
+        case SYM_Y: return &ys[position];
+        case SYM_OBJECT_ID: return &object_ids[position];
+        default: return nullptr;
         }
-        case DECLARE:
+    }
+    
+    double id_of(uint32_t slot) const
+    {
+        return first_id + slot + double(slots[slot].generation) * 4294967296.0;
+    }
+    
+    // destroys every instance; their ids stay stale rather than being handed out again
+    void reset()
+    {
+        while(live.size() > 0)
+            instance_release(id_of(liveslots.back()));
+    }
+};
+
+// a call to a script function in progress. the callee's scopes are stacked on top of the caller's and its values on
+// the same value stack, so a call doesn't allocate anything once the stacks have grown to fit.
+struct callframe
+{
+    uint64_t returnpc;
+    uint32_t scopes; // how many scopes the caller had open
+    uint32_t depths; // how many scope depths the caller had saved
+    uint32_t framescope; // the caller's framescope
+};
+
+struct progstate
+{
+    static constexpr uint64_t max_frames = 1<<20;
+    
+    uint64_t pc = 0;
+    bool truth_register = false;
+    
+    bool lvalue_islocal = true; // if false, reference under lvalue_id
+    double lvalue_id = 0;
+    uint32_t lvalue_symbol = NO_SYMBOL;
+    fieldcache * lvalue_cache = nullptr; // inline cache of the INDIRECT that set the lvalue registers
+    
+    moduleref mod; // code and constant pool of the main function of the program
+    std::vector<scope> variables;
+    std::vector<value> stack; // shared by every scope; each scope's values start at its stackbase
+    std::vector<uint64_t> stackdepths;
+    std::vector<callframe> frames;
+    uint32_t framescope = 0; // first scope of the running function, 0 outside of functions
+    std::vector<std::vector<value>> unused_values; // value arrays of closed scopes, kept to reuse their allocations
+    
+    globalstate * global = nullptr; // the context the program runs in
+    double self = 0; // id of the instance this is the state of, 0 if it isn't an instance
+    passview * view = nullptr; // set while the instance runs as part of a parallel pass
+    uint32_t running = 0; // how many events are running on this state right now
+    bool released = false; // released from the instance table while running, and recycled once it stops
+    
+    void reset()
+    {
+        pc = 0;
+        truth_register = false;
+        variables.clear();
+        stack.clear();
+        stackdepths.clear();
+        frames.clear();
+        framescope = 0;
+    }
+    
+    // puts the state back the way instance_spawn() hands it out, keeping the allocations of the root scope and
+    // value stack so that a recycled instance can be set up again without touching the allocator
+    void recycle()
+    {
+        pc = 0;
+        truth_register = false;
+        lvalue_islocal = true;
+        lvalue_id = 0;
+        lvalue_symbol = NO_SYMBOL;
+        lvalue_cache = nullptr;
+        mod.reset();
+        close_scopes(1);
+        variables[0].clear();
+        stack.clear();
+        stackdepths.clear();
+        frames.clear();
+        framescope = 0;
+        self = 0;
+        released = false;
+    }
+    
+    // opens a scope on top of the value stack as it is
+    void open_scope()
+    {
+        variables.emplace_back();
+        variables.back().stackbase = stack.size();
+        if(unused_values.size() > 0)
         {
-            std::string name;
-            uint8_t c = bytecode[pc++];
-            while (c != 0)
-            {
-                name += c;
-                c = bytecode[pc++];
-            }
-            if(varstack->count(name))
-            {
-                puts("Error: redeclaration");
-                return;
-            }
-            else
-            {
-                (*varstack)[name] = 0;
-            }
-            
-            break;
+            variables.back().values = std::move(unused_values.back());
+            unused_values.pop_back();
         }
-        case DECLSET:
+    }
+    
+    // closes scopes until the given number are left, dropping the values they had on the value stack
+    void close_scopes(uint64_t depth)
+    {
+        if(variables.size() <= depth)
+            return;
+        stack.resize(variables[depth].stackbase);
+        while(variables.size() > depth)
         {
-            if(valstack->size() < 1)
-            {
-                puts("Error: not enough arguments to compound declaration");
-                return;
-            }
-            std::string name;
-            uint8_t c = bytecode[pc++];
-            while (c != 0)
-            {
-                name += c;
-                c = bytecode[pc++];
-            }
-            if(varstack->count(name))
-            {
-                puts("Error: redeclaration");
-                return;
-            }
-            else if(valstack->size() < 1)
-            {
-                puts("Error: not enough arguments to declaration-assignment");
-                return;
-            }
-            else
-            {
-                value right = valstack->back();
-                valstack->pop_back();
-                (*varstack)[name] = right;
-            }
-            
-            break;
+            variables.back().values.clear();
+            unused_values.push_back(std::move(variables.back().values));
+            variables.pop_back();
         }
-        case BINOP:
+    }
+    
+    // for a tail call: closes every scope of the running function and opens the callee's first scope in place of its
+    // first one, holding just the arguments on top of the value stack
+    void replace_frame(uint64_t args)
+    {
+        auto base = variables[framescope].stackbase;
+        std::move(stack.end()-args, stack.end(), stack.begin()+base);
+        stack.resize(base+args);
+        while(variables.size() > framescope+1)
         {
-            if(valstack->size() < 2)
-            {
-                puts("Error: not enough arguments to binary operation");
-                return;
-            }
-            value right = valstack->back();
-            valstack->pop_back();
-            value left = valstack->back();
-            valstack->pop_back();
-            
-            if(right.is_number and left.is_number)
-            {
-                switch(bytecode[pc++])
-                {
-                case ADD:
-                {
-                    valstack->push_back(left.real+right.real);
-                    break;
-                }
-                case SUB:
-                {
-                    valstack->push_back(left.real-right.real);
-                    break;
-                }
-                case MUL:
-                {
-                    valstack->push_back(left.real*right.real);
-                    break;
-                }
-                case DIV:
-                {
-                    valstack->push_back(left.real/right.real);
-                    break;
-                }
-                case EQ:
-                {
-                    valstack->push_back(left.real==right.real);
-                    break;
-                }
-                case NEQ:
-                {
-                    valstack->push_back(left.real!=right.real);
-                    break;
-                }
-                case GTE:
-                {
-                    valstack->push_back(left.real>=right.real);
-                    break;
-                }
-                case LTE:
-                {
-                    valstack->push_back(left.real<=right.real);
-                    break;
-                }
-                case GT:
-                {
-                    valstack->push_back(left.real>right.real);
-                    break;
-                }
-                case LT:
-                {
-                    valstack->push_back(left.real<right.real);
-                    break;
-                }
-                case AND:
-                {
-                    valstack->push_back(left.real&&right.real);
-                    break;
-                }
-                case OR:
-                {
-                    valstack->push_back(left.real||right.real);
-                    break;
-                }
-                default:
-                printf("Unknown binary numeric operation 0x%02X at 0x%08X\n", bytecode[pc-1], pc-1);
-                return;
-                }
-            }
-            else if(!right.is_number and !left.is_number)
-            {
-                switch(bytecode[pc++])
-                {
-                case ADD:
-                {
-                    valstack->push_back(left.text+right.text);
-                    break;
-                }
-                case EQ:
-                {
-                    valstack->push_back(left.text==right.text);
-                    break;
-                }
-                case NEQ:
-                {
-                    valstack->push_back(left.text!=right.text);
-                    break;
-                }
-                default:
-                printf("Unknown binary string operation 0x%02X at 0x%08X\n", bytecode[pc-1], pc-1);
-                return;
-                }
-            }
-            else
-            {
-                printf("Error: tried to apply a binary operation to a string and a number at 0x%08X\n", pc-1);
-                return;
-            }
-            break;
+            variables.back().values.clear();
+            unused_values.push_back(std::move(variables.back().values));
+            variables.pop_back();
         }
-        case UNOP:
+        variables.back().clear();
+    }
+    
+    // walks the scopes from innermost to outermost. code in a function only sees its own scopes and then the root
+    // scope (the instance's variables), not the scopes of whatever called it.
+    value * find_variable(uint32_t symbol)
+    {
+        for(uint64_t i = variables.size(); i > framescope; i--)
         {
-            if(valstack->size() < 1)
-            {
-                puts("Error: not enough arguments to unary operation");
-                return;
-            }
-            value right = valstack->back();
-            valstack->pop_back();
-            
-            // TODO: Make negative operator reverse strings, maybe?
-            if(right.is_number)
-            {
-                switch(bytecode[pc++])
-                {
-                case POSITIVE:
-                {
-                    valstack->push_back(right);
-                    break;
-                }
-                case NEGATIVE:
+            if(auto found = variables[i-1].find(symbol))
+                return found;
+        }
+        if(framescope > 0)
+            return variables[0].find(symbol);
+        return nullptr;
+    }
+    
+    void exit()
+    {
+        close_scopes(1);
+        stackdepths.clear();
+        frames.clear();
+        framescope = 0;
+        truth_register = false;
+        pc = 0;
+    }
+};
+
+// looks up a field of another instance through an inline cache, filling the cache in on a miss
+// *instance is set to the instance, or nullptr if it doesn't exist; returns nullptr if it has no such field
+value * find_field(globalstate & global, fieldcache * cache, double id, uint32_t symbol, progstate ** instance)
+{
+    auto other = global.find_instance(id);
+    *instance = other;
+    if(other == nullptr)
+        return nullptr;
+    
+    auto & variables = other->variables;
+    auto entry = cache->entry.load(std::memory_order_relaxed);
+    if(variables.size() == 1 and variables[0].layout->id == uint32_t(entry >> 32))
+        return &variables[0].values[uint32_t(entry)];
+    auto field = other->find_variable(symbol);
+    if(field != nullptr and variables.size() == 1)
+        cache->entry.store(uint64_t(variables[0].layout->id) << 32 | (field - variables[0].values.data()), std::memory_order_relaxed);
+    return field;
+}
+
+double globalstate::instance_spawn()
+{
+    uint32_t slot = freeslot;
+    if(slot != no_slot)
+        freeslot = slots[slot].link;
+    else
+    {
+        if(slots.size() >= no_slot)
+        {
+            puts("Error: ran out of instance ids");
+            exit(0);
+        }
+        slot = slots.size();
+        slots.push_back({});
+    }
+    slots[slot].type = NO_TYPE;
+    
+    progstate * n;
+    if(spare.size() > 0)
+    {
+        n = spare.back();
+        spare.pop_back();
+    }
+    else
+    {
+        n = new progstate;
+        n->variables.push_back({});
+    }
+    n->global = this;
+    
+    slots[slot].instance = n;
+    slots[slot].link = live.size();
+    live.push_back(n);
+    liveslots.push_back(slot);
+    xs.push_back(0);
+    ys.push_back(0);
+    object_ids.push_back(0);
+    
+    n->self = id_of(slot);
+    return n->self;
+}
+
+// frees every instance along with the context
+globalstate::~globalstate()
+{
+    reset();
+    for(auto n : spare)
+        delete n;
+}
+
+// removes an instance from the table and keeps its state around for reuse; returns false if the id is stale or was
+// never valid. doesn't run the destroy event, see instance_destroy().
+bool globalstate::instance_release(double id)
+{
+    auto slot = find_slot(id);
+    if(slot == no_slot)
+        return false;
+    auto n = slots[slot].instance;
+    
+    auto type = slots[slot].type;
+    if(type != NO_TYPE)
+    {
+        auto & members = objects[type].members;
+        auto member = slots[slot].member;
+        members[member] = members.back();
+        slots[members[member]].member = member;
+        members.pop_back();
+    }
+    
+    // swap the last live instance into the hole
+    uint32_t position = slots[slot].link;
+    live[position] = live.back();
+    liveslots[position] = liveslots.back();
+    xs[position] = xs.back();
+    ys[position] = ys.back();
+    object_ids[position] = object_ids.back();
+    slots[liveslots[position]].link = position;
+    live.pop_back();
+    liveslots.pop_back();
+    xs.pop_back();
+    ys.pop_back();
+    object_ids.pop_back();
+    
+    if(n->running > 0)
+        n->released = true;
+    else
+    {
+        n->recycle();
+        spare.push_back(n);
+    }
+    slots[slot].instance = nullptr;
+    slots[slot].generation++;
+    if(slots[slot].generation < max_generation)
+    {
+        slots[slot].link = freeslot;
+        freeslot = slot;
+    }
+    return true;
+}
+
+struct builtin
+{
+    nativefunction function = nullptr;
+    uint8_t arity = 0;
+};
+
+// process-wide registry of native functions, keyed by interned name. modules link their calls against it when they're
+// verified and keep the function pointers, so running code never touches the registry, and registering or replacing a
+// function only affects modules loaded after that.
+struct builtintable
+{
+    std::map<uint32_t, builtin> functions;
+    std::mutex lock;
+    
+    void add(std::string_view name, uint8_t arity, nativefunction function)
+    {
+        auto symbol = symtab.intern(name);
+        std::lock_guard<std::mutex> guard(lock);
+        functions[symbol] = {function, arity};
+    }
+    // returns a builtin with a null function if there's none by that name
+    builtin find(uint32_t symbol)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = functions.find(symbol);
+        if(found == functions.end())
+            return {};
+        return found->second;
+    }
+    
+    builtintable();
+};
+
+bool native_print(progstate * /*program*/, const value * args, value * /*result*/)
+{
+    if(args[0].is_number)
+        printf("%f\n", args[0].real);
+    else
+        printf("%s\n", args[0].text.data());
+    return true;
+}
+
+// an event that creates or destroys an instance runs that instance's event inside itself, so this is where the
+// nesting is limited, before it runs out of C++ stack
+bool check_nesting(progstate * program)
+{
+    if(program->global->nesting >= globalstate::max_nesting)
+    {
+        puts("Error: events nested too deeply");
+        return false;
+    }
+    return true;
+}
+
+// running the create event can grow the caller's value stack, so the arguments are read before it runs
+bool native_instance_create(progstate * program, const value * args, value * result)
+{
+    if(!args[0].is_number or !args[1].is_number or !args[2].is_number)
+    {
+        puts("Error: non-numeric argument to function \"instance_create\"");
+        return false;
+    }
+    if(!check_nesting(program))
+        return false;
+    *result = program->global->instance_create(args[0].real, args[1].real, args[2].real);
+    return true;
+}
+
+bool native_instance_destroy(progstate * program, const value * args, value * /*result*/)
+{
+    if(!check_nesting(program))
+        return false;
+    if(!args[0].is_number or !program->global->instance_destroy(args[0].real))
+    {
+        puts("Error: attempt to destroy non-existent object");
+        return false;
+    }
+    return true;
+}
+
+builtintable::builtintable()
+{
+    add("print", 1, native_print);
+    add("instance_create", 3, native_instance_create);
+    add("instance_destroy", 1, native_instance_destroy);
+}
+
+builtintable builtins;
+
+enum {
+    NOP       = 0x00,
+    PUSHVAL   = 0x01,
+    PUSHTEXT  = 0x02,
+    PUSHVAR   = 0x03,
+    POP       = 0x04,
+    DECLARE   = 0x05,
+    DECLSET   = 0x06,
+    BINOP     = 0x07,
+    UNOP      = 0x08,
+    DIRECT    = 0x09, // direct variable reference (e.g. x)
+    INDIRECT  = 0x0A, // indirect variable reference (e.g. other.x)
+    INDEXP    = 0x0B,
+    BINAS     = 0x0C,
+    UNAS      = 0x0D,
+    TRUTH     = 0x0E,
+    OPENSCOPE = 0x10, // opens a new variable declaration table
+    EXITSCOPE = 0x11, // closes current var dec table
+    SAVESCOPE = 0x12, // saves the current depth we're on in the stack of var decl tables to a stack
+    LOADSCOPE = 0x13, // goes to saved stack depth
+    BREAK     = 0x14, // jumps to offset and goes to saved stack depth
+    JSIT      = 0x15,
+    JLIT      = 0x16,
+    JSIF      = 0x17,
+    JLIF      = 0x18,
+    JS        = 0x19,
+    JL        = 0x1A,
+    CALL      = 0x1B, // calls a function of the module, or a builtin
+    FUNCDEF   = 0x1C, // defines a function whose body follows, and jumps over it
+    RETURN    = 0x1D, // returns the value on top of the stack to the caller; at the top level, ends the run
+    TAILCALL  = 0x1E, // CALL in front of a RETURN; a call to a function of the module replaces the running function
+    // BINOP, UNOP and TRUTH on values the optimizer proved are numbers, which skip checking. the verifier can't check
+    // the proof, but a string given to one is only read as the number 0, not as memory it doesn't own
+    NUMBINOP  = 0x1F,
+    NUMUNOP   = 0x20,
+    NUMTRUTH  = 0x21,
+};
+
+enum {
+    ADD = 0x80,
+    SUB = 0x81,
+    MUL = 0x82,
+    DIV = 0x83,
+    EQ  = 0x84,
+    NEQ = 0x85,
+    GTE = 0x86,
+    LTE = 0x87,
+    GT  = 0x88,
+    LT  = 0x89,
+    AND = 0x8A,
+    OR  = 0x8B
+};
+
+enum {
+    POSITIVE = 0x80,
+    NEGATIVE = 0x81,
+    NEGATION = 0x82,
+};
+
+enum {
+    ASSIGN = 0x80,
+    MUTADD = 0x81,
+    MUTSUB = 0x82,
+    MUTMUL = 0x83,
+    MUTDIV = 0x84,
+};
+
+enum {
+    INCREMENT = 0x80,
+    DECREMENT = 0x81,
+};
+
+// operand kinds, so that code that only needs to walk instructions doesn't need to know what they do
+enum {
+    OPND_NONE = 0,
+    OPND_U8   = 1, // subop or argument count
+    OPND_U16  = 2, // constant pool or symbol table index
+    OPND_I16  = 3, // short jump offset
+    OPND_I64  = 4, // long jump offset
+    OPND_F64  = 5, // literal number
+    OPND_CACHE = 6, // inline cache slot; not present in version 1, numbered by convert_bytecode()
+};
+
+struct opinfo
+{
+    const char * name = nullptr; // nullptr for unknown opcodes
+    uint8_t operands[3] = {OPND_NONE, OPND_NONE, OPND_NONE};
+};
+
+opinfo get_opinfo(uint8_t opcode)
+{
+    switch(opcode)
+    {
+    case NOP:       return {"NOP"};
+    case PUSHVAL:   return {"PUSHVAL", {OPND_F64}};
+    case PUSHTEXT:  return {"PUSHTEXT", {OPND_U16}};
+    case PUSHVAR:   return {"PUSHVAR", {OPND_U16}};
+    case POP:       return {"POP"};
+    case DECLARE:   return {"DECLARE", {OPND_U16}};
+    case DECLSET:   return {"DECLSET", {OPND_U16}};
+    case BINOP:     return {"BINOP", {OPND_U8}};
+    case UNOP:      return {"UNOP", {OPND_U8}};
+    case DIRECT:    return {"DIRECT", {OPND_U16}};
+    case INDIRECT:  return {"INDIRECT", {OPND_U16, OPND_CACHE}};
+    case INDEXP:    return {"INDEXP", {OPND_U16, OPND_CACHE}};
+    case BINAS:     return {"BINAS", {OPND_U8}};
+    case UNAS:      return {"UNAS", {OPND_U8}};
+    case TRUTH:     return {"TRUTH"};
+    case OPENSCOPE: return {"OPENSCOPE"};
+    case EXITSCOPE: return {"EXITSCOPE"};
+    case SAVESCOPE: return {"SAVESCOPE"};
+    case LOADSCOPE: return {"LOADSCOPE"};
+    case BREAK:     return {"BREAK", {OPND_I64}};
+    case JSIT:      return {"JSIT", {OPND_I16}};
+    case JLIT:      return {"JLIT", {OPND_I64}};
+    case JSIF:      return {"JSIF", {OPND_I16}};
+    case JLIF:      return {"JLIF", {OPND_I64}};
+    case JS:        return {"JS", {OPND_I16}};
+    case JL:        return {"JL", {OPND_I64}};
+    case CALL:      return {"CALL", {OPND_U16, OPND_U8}};
+    case FUNCDEF:   return {"FUNCDEF", {OPND_I64, OPND_U16, OPND_U8}}; // body length, name, parameter count
+    case RETURN:    return {"RETURN"};
+    case TAILCALL:  return {"TAILCALL", {OPND_U16, OPND_U8}};
+    case NUMBINOP:  return {"NUMBINOP", {OPND_U8}};
+    case NUMUNOP:   return {"NUMUNOP", {OPND_U8}};
+    case NUMTRUTH:  return {"NUMTRUTH"};
+    default:        return {};
+    }
+}
+
+uint64_t operand_size(uint8_t kind)
+{
+    switch(kind)
+    {
+    case OPND_U8: return 1;
+    case OPND_U16: case OPND_I16: case OPND_CACHE: return 2;
+    case OPND_I64: case OPND_F64: return 8;
+    default: return 0;
+    }
+}
+
+// version 3 operand access: aligned, native endian, one load
+template<typename T>
+T decode_aligned(const uint8_t * bytecode, uint64_t & pc)
+{
+    pc = (pc + sizeof(T)-1) & ~uint64_t(sizeof(T)-1);
+    T temp;
+    memcpy(&temp, &bytecode[pc], sizeof(T));
+    pc += sizeof(T);
+    return temp;
+}
+uint16_t decode_u16(const uint8_t * bytecode, uint64_t & pc)
+{
+    return decode_aligned<uint16_t>(bytecode, pc);
+}
+int16_t decode_i16(const uint8_t * bytecode, uint64_t & pc)
+{
+    return decode_aligned<int16_t>(bytecode, pc);
+}
+int64_t decode_i64(const uint8_t * bytecode, uint64_t & pc)
+{
+    return decode_aligned<int64_t>(bytecode, pc);
+}
+double decode_double(const uint8_t * bytecode, uint64_t & pc)
+{
+    return decode_aligned<double>(bytecode, pc);
+}
+
+template<typename T>
+void emit_aligned(std::vector<uint8_t> * bytecode, T value)
+{
+    while(bytecode->size() % sizeof(T) != 0)
+        bytecode->push_back(0);
+    auto at = bytecode->size();
+    bytecode->resize(at + sizeof(T));
+    memcpy(&(*bytecode)[at], &value, sizeof(T));
+}
+
+// version 1 operand access: big endian, packed
+uint64_t decode_v1(const std::vector<uint8_t> & bytecode, uint64_t & pc, uint64_t size)
+{
+    uint64_t temp = 0;
+    for(uint64_t i = 0; i < size; i++)
+        temp = (temp<<8) | bytecode[pc++];
+    return temp;
+}
+
+// position independent form of a single instruction, used while converting between layouts
+struct looseop
+{
+    uint64_t oldpos = 0;
+    uint64_t newpos = 0;
+    uint8_t opcode = NOP;
+    uint64_t operands[3] = {0, 0, 0};
+    uint64_t target = 0; // index of the instruction a jump lands on
+};
+
+// FUNCDEF counts, since it jumps over the function body
+bool is_jump(uint8_t opcode)
+{
+    return opcode == BREAK or opcode == JSIT or opcode == JSIF or opcode == JS
+        or opcode == JLIT or opcode == JLIF or opcode == JL or opcode == FUNCDEF;
+}
+
+uint8_t long_jump_of(uint8_t opcode)
+{
+    if(opcode == JSIT) return JLIT;
+    if(opcode == JSIF) return JLIF;
+    if(opcode == JS) return JL;
+    return opcode;
+}
+
+uint64_t aligned_layout_size(uint8_t opcode, uint64_t pos)
+{
+    auto info = get_opinfo(opcode);
+    uint64_t end = pos+1;
+    for(auto kind : info.operands)
+    {
+        auto size = operand_size(kind);
+        if(size == 0) continue;
+        end = (end + size-1) & ~(size-1);
+        end += size;
+    }
+    return end-pos;
+}
+
+// same as the interpreter's BINOP and UNOP on numbers, for folding constants, and what NUMBINOP and NUMUNOP run
+double fold_binop(uint8_t op, double left, double right)
+{
+    switch(op)
+    {
+    case ADD: return left+right;
+    case SUB: return left-right;
+    case MUL: return left*right;
+    case DIV: return left/right;
+    case EQ: return left==right;
+    case NEQ: return left!=right;
+    case GTE: return left>=right;
+    case LTE: return left<=right;
+    case GT: return left>right;
+    case LT: return left<right;
+    case AND: return left&&right;
+    default: return left||right;
+    }
+}
+double fold_unop(uint8_t op, double value)
+{
+    return (op == NEGATIVE) ? -value : (op == NEGATION) ? !value : value;
+}
+
+// compile()'s output is optimized before it's laid out, as a mid-level IR: the instructions are split into basic
+// blocks, and inside a block the value stack is replaced by SSA values. each instruction that pushes a value is that
+// value, and lists the values it pops. variables stay what they are in the bytecode, memory read and written by name,
+// and the scope instructions that decide what a name refers to stay between them as ordinary instructions.
+// written back out, the blocks keep their order and each keeps its instructions in order, so the result is still
+// exactly what a stack machine runs.
+enum {
+    IR_NONE = 0xFFFFFFFF,
+};
+
+struct irnode
+{
+    looseop op;
+    std::vector<uint32_t> args; // values popped, in the order they were pushed; IR_NONE if pushed before the block
+    uint32_t user = IR_NONE; // the instruction that pops this one's value
+    uint32_t depth = 0; // scopes open before the instruction, counting the function's (or program's) own as 1
+    uint32_t after = 0; // scopes open after it
+    bool value = false; // pushes a value
+    bool removed = false;
+};
+
+struct irblock
+{
+    uint64_t start = 0; // its first instruction in compile()'s output
+    std::vector<uint32_t> nodes; // in execution order
+    std::vector<uint32_t> successors;
+    std::vector<uint32_t> predecessors;
+    uint32_t region = IR_NONE; // 0 for the main program, n for the nth function body; IR_NONE if unreachable
+    bool opaque = false; // passes values or the lvalue to or from another block, so it's left as it is
+};
+
+struct irprogram
+{
+    std::vector<irnode> nodes;
+    std::vector<irblock> blocks;
+    std::vector<uint32_t> roots; // entry block of each region
+    std::vector<std::map<uint64_t, uint32_t>> declared; // per region, the deepest scope each name is declared in
+    uint64_t end = 0; // number of instructions compile() emitted
+    constpool * pool = nullptr; // for the names of temporaries
+    uint32_t temps = 0;
+
+    uint64_t count() const
+    {
+        uint64_t live = 0;
+        for(auto & block : blocks)
+        {
+            for(auto n : block.nodes)
+                live += !nodes[n].removed;
+        }
+        return live;
+    }
+    // a new variable name nothing in the source can refer to, since the lexer never produces $
+    uint64_t temporary(const char * kind)
+    {
+        return pool->add_symbol(std::string("$") + kind + std::to_string(temps++));
+    }
+    uint32_t add(uint8_t opcode, uint64_t operand, uint32_t depth)
+    {
+        irnode node;
+        node.op.opcode = opcode;
+        node.op.operands[0] = operand;
+        node.depth = depth;
+        node.after = depth;
+        node.value = (opcode == PUSHVAL or opcode == PUSHTEXT or opcode == PUSHVAR);
+        nodes.push_back(node);
+        return nodes.size()-1;
+    }
+};
+
+void ir_stack_effect(const looseop & op, uint32_t * pops, bool * pushes)
+{
+    *pops = 0;
+    *pushes = false;
+    switch(op.opcode)
+    {
+    case PUSHVAL: case PUSHTEXT: case PUSHVAR: *pushes = true; break;
+    case POP: case DECLSET: case INDIRECT: case BINAS: case TRUTH: case RETURN: *pops = 1; break;
+    case BINOP: *pops = 2; *pushes = true; break;
+    case UNOP: case INDEXP: *pops = 1; *pushes = true; break;
+    case CALL: case TAILCALL: *pops = op.operands[1]; *pushes = true; break;
+    default: break;
+    }
+}
+
+// splits the instructions into blocks and works out what each instruction pops and how deep in scopes it is.
+// returns false for code whose scopes don't nest the same way on every path, which is left unoptimized
+bool ir_build(const std::vector<looseop> & ops, irprogram * ir)
+{
+    auto count = ops.size();
+    ir->end = count;
+    std::vector<bool> leader(count+1, false);
+    leader[0] = true;
+    for(uint64_t i = 0; i < count; i++)
+    {
+        if(is_jump(ops[i].opcode))
+            leader[ops[i].target] = leader[i+1] = true;
+        if(ops[i].opcode == RETURN)
+            leader[i+1] = true;
+    }
+    std::vector<uint32_t> block_at(count+1, IR_NONE);
+    for(uint64_t i = 0; i < count; i++)
+    {
+        if(leader[i])
+        {
+            block_at[i] = ir->blocks.size();
+            ir->blocks.emplace_back();
+            ir->blocks.back().start = i;
+        }
+        irnode node;
+        node.op = ops[i];
+        ir->nodes.push_back(node);
+        ir->blocks.back().nodes.push_back(i);
+    }
+    for(uint32_t b = 0; b < ir->blocks.size(); b++)
+    {
+        auto & block = ir->blocks[b];
+        auto last = block.start + block.nodes.size() - 1;
+        auto & op = ops[last];
+        auto link = [&](uint64_t index)
+        {
+            if(index < count)
+                block.successors.push_back(block_at[index]);
+        };
+        if(op.opcode == JS or op.opcode == JL or op.opcode == BREAK or op.opcode == FUNCDEF)
+            link(op.target);
+        else if(is_jump(op.opcode))
+        {
+            link(op.target);
+            if(block_at[last+1] != block_at[op.target])
+                link(last+1);
+        }
+        else if(op.opcode != RETURN)
+            link(last+1);
+        for(auto s : block.successors)
+            ir->blocks[s].predecessors.push_back(b);
+    }
+
+    // regions, and the scope depth at every instruction
+    struct scopestate { uint32_t depth; std::vector<uint32_t> saved; };
+    std::vector<scopestate> entry(ir->blocks.size());
+    std::vector<uint32_t> work;
+    std::vector<uint32_t> arity(ir->blocks.size(), 0); // values a function's caller leaves on the stack
+    if(count > 0)
+        ir->roots.push_back(0);
+    for(uint64_t i = 0; i+1 < count; i++)
+    {
+        if(ops[i].opcode == FUNCDEF)
+        {
+            ir->roots.push_back(block_at[i+1]);
+            arity[block_at[i+1]] = ops[i].operands[2];
+        }
+    }
+    ir->declared.resize(ir->roots.size());
+    for(uint32_t r = 0; r < ir->roots.size(); r++)
+    {
+        auto root = ir->roots[r];
+        if(ir->blocks[root].region != IR_NONE)
+            return false;
+        ir->blocks[root].region = r;
+        entry[root] = {1, {}};
+        work.push_back(root);
+        while(work.size() > 0)
+        {
+            auto b = work.back();
+            work.pop_back();
+            auto state = entry[b];
+            for(auto n : ir->blocks[b].nodes)
+            {
+                auto & node = ir->nodes[n];
+                node.depth = state.depth;
+                switch(node.op.opcode)
                 {
-                    valstack->push_back(-right.real);
+                case OPENSCOPE: state.depth++; break;
+                case EXITSCOPE:
+                    if(state.depth < 2)
+                        return false;
+                    state.depth--;
                     break;
-                }
-                case NEGATION:
+                case SAVESCOPE: state.saved.push_back(state.depth); break;
+                case LOADSCOPE: case BREAK:
+                    if(state.saved.size() == 0)
+                        return false;
+                    state.depth = state.saved.back();
+                    state.saved.pop_back();
+                    break;
+                case DECLARE: case DECLSET:
                 {
-                    valstack->push_back(!right.real);
+                    auto & deepest = ir->declared[r][node.op.operands[0]];
+                    deepest = std::max(deepest, state.depth);
                     break;
                 }
-                default:
-                printf("Unknown unary numeric operation 0x%02X at 0x%08X\n", bytecode[pc-1], pc-1);
-                return;
+                default: break;
                 }
+                node.after = state.depth;
             }
-            else
+            for(auto s : ir->blocks[b].successors)
             {
-                printf("Error: tried to apply a unary operation to a string at 0x%08X\n", pc-1);
-                return;
+                auto & next = ir->blocks[s];
+                if(next.region == IR_NONE)
+                {
+                    next.region = r;
+                    entry[s] = state;
+                    work.push_back(s);
+                }
+                else if(next.region != r or entry[s].depth != state.depth or entry[s].saved != state.saved)
+                    return false;
             }
-            
-            break;
         }
-        case BINAS:
+    }
+
+    // the value stack as SSA values
+    for(uint32_t b = 0; b < ir->blocks.size(); b++)
+    {
+        auto & block = ir->blocks[b];
+        std::vector<uint32_t> stack(arity[b], IR_NONE);
+        uint64_t incoming = arity[b];
+        bool lvalue = false;
+        for(auto n : block.nodes)
         {
-            if(valstack->size() < 1)
-            {
-                puts("Error: not enough arguments to binary assignment");
-                return;
-            }
-            auto right = valstack->back();
-            valstack->pop_back();
-            
-            
-            
-            if(lvalue_name == "")
-            {
-                puts("Internal error: no lvalue in binary assignment");
-                exit(0);
-            }
-            
-            value * lvalue = nullptr;
-            if(lvalue_islocal)
+            auto & node = ir->nodes[n];
+            uint32_t pops;
+            ir_stack_effect(node.op, &pops, &node.value);
+            node.args.resize(pops);
+            for(uint32_t i = pops; i > 0; i--)
             {
-                if(variables.size() == 0)
+                if(stack.size() == 0)
                 {
-                    puts("Internal error: tried operating on a zero-size stack of variable heaps");
-                    exit(0);
+                    block.opaque = true;
+                    node.args[i-1] = IR_NONE;
+                    continue;
                 }
-                auto varstack_current = variables.size()-1;
-                while(variables[varstack_current].count(lvalue_name) == 0 and varstack_current > 0)
-                    varstack_current--;
-                auto & vstack = variables[varstack_current];
-                if(vstack.count(lvalue_name))
-                    lvalue = &(vstack[lvalue_name]);
+                node.args[i-1] = stack.back();
+                if(stack.back() != IR_NONE)
+                    ir->nodes[stack.back()].user = n;
+                else
+                    incoming--;
+                stack.pop_back();
             }
+            if(node.value)
+                stack.push_back(n);
+            if(node.op.opcode == DIRECT or node.op.opcode == INDIRECT)
+                lvalue = true;
+            if((node.op.opcode == BINAS or node.op.opcode == UNAS) and !lvalue)
+                block.opaque = true;
+        }
+        if(stack.size() > 0 or incoming > 0)
+            block.opaque = true;
+    }
+    return true;
+}
+
+// writes the blocks back out as instructions, in their original order
+void ir_lower(irprogram & ir, std::vector<looseop> * ops)
+{
+    std::vector<looseop> out;
+    std::vector<uint64_t> moved(ir.end+1, 0); // new index of each block's first instruction, by its old index
+    for(auto & block : ir.blocks)
+    {
+        moved[block.start] = out.size();
+        for(auto n : block.nodes)
+        {
+            if(!ir.nodes[n].removed)
+                out.push_back(ir.nodes[n].op);
+        }
+    }
+    moved[ir.end] = out.size();
+    for(auto & op : out)
+    {
+        if(is_jump(op.opcode))
+            op.target = moved[op.target];
+    }
+    *ops = std::move(out);
+}
+
+void ir_remove_tree(irprogram & ir, uint32_t n)
+{
+    if(n == IR_NONE)
+        return;
+    ir.nodes[n].removed = true;
+    for(auto arg : ir.nodes[n].args)
+        ir_remove_tree(ir, arg);
+}
+
+uint32_t ir_tree_size(const irprogram & ir, uint32_t n)
+{
+    uint32_t size = 1;
+    for(auto arg : ir.nodes[n].args)
+        size += (arg == IR_NONE) ? 0 : ir_tree_size(ir, arg);
+    return size;
+}
+
+// what's known about a variable, or a value: it's a number, and maybe which one
+struct irfact
+{
+    bool constant = false;
+    double number = 0;
+    bool operator==(const irfact & other) const
+    {
+        return constant == other.constant and (!constant or !memcmp(&number, &other.number, sizeof(double)));
+    }
+};
+typedef std::map<uint64_t, irfact> irfacts; // names known to refer to numbers
+
+double ir_constant(const irnode & node)
+{
+    double number;
+    memcpy(&number, &node.op.operands[0], sizeof(double));
+    return number;
+}
+
+// walks a block's instructions, keeping track of which names are known to hold numbers and which values are known to
+// be numbers. a numeric value can be recomputed, moved or dropped freely: every instruction that produces one from
+// known numbers can't fail and has no effects.
+struct irwalker
+{
+    irprogram & ir;
+    uint32_t region;
+    irfacts facts;
+    std::map<uint32_t, irfact> known; // numeric values
+    int64_t lvalue = -1; // name the lvalue registers point to, if they point to a variable by name
+
+    irwalker(irprogram & ir, uint32_t region, const irfacts & facts) : ir(ir), region(region), facts(facts) { }
+
+    bool numeric(uint32_t n) const
+    {
+        return n != IR_NONE and known.count(n);
+    }
+    // whether running the instruction could fail, with what's known before it
+    bool can_fail(uint32_t n) const
+    {
+        auto & node = ir.nodes[n];
+        switch(node.op.opcode)
+        {
+        case NOP: case PUSHVAL: case PUSHTEXT: case DIRECT: case POP:
+            return false;
+        case PUSHVAR:
+            return !facts.count(node.op.operands[0]);
+        case BINOP:
+            return !numeric(node.args[0]) or !numeric(node.args[1]);
+        case UNOP:
+            return !numeric(node.args[0]);
+        case BINAS:
+            return lvalue < 0 or !facts.count(lvalue) or !numeric(node.args[0]);
+        case UNAS:
+            return lvalue < 0 or !facts.count(lvalue);
+        default:
+            return true;
+        }
+    }
+    void kill(uint32_t depth)
+    {
+        for(auto it = facts.begin(); it != facts.end(); )
+        {
+            auto declared = ir.declared[region].find(it->first);
+            if(declared != ir.declared[region].end() and declared->second > depth)
+                it = facts.erase(it);
+            else
+                ++it;
+        }
+    }
+    void store(uint64_t symbol, uint8_t op, uint32_t value)
+    {
+        auto old = facts.find(symbol);
+        if(op == ASSIGN and numeric(value))
+            facts[symbol] = known[value];
+        else if(op != ASSIGN and old != facts.end() and numeric(value))
+        {
+            auto & right = known[value];
+            if(old->second.constant and right.constant)
+                old->second.number = fold_binop(op == MUTADD ? ADD : op == MUTSUB ? SUB : op == MUTMUL ? MUL : DIV, old->second.number, right.number);
+            else
+                old->second.constant = false;
+        }
+        else
+            facts.erase(symbol);
+    }
+    // what's known after the instruction, assuming it succeeded
+    void step(uint32_t n)
+    {
+        auto & node = ir.nodes[n];
+        auto & op = node.op;
+        switch(op.opcode)
+        {
+        case PUSHVAL:
+            known[n] = {true, ir_constant(node)};
+            break;
+        case PUSHVAR:
+            if(facts.count(op.operands[0]))
+                known[n] = facts[op.operands[0]];
+            break;
+        case BINOP:
+        case UNOP:
+        {
+            auto left = node.args[0];
+            auto right = node.args.back();
+            if(!numeric(left) or !numeric(right))
+                break;
+            auto & a = known[left];
+            auto & b = known[right];
+            irfact result;
+            result.constant = a.constant and b.constant;
+            if(result.constant)
+                result.number = (op.opcode == BINOP) ? fold_binop(op.operands[0], a.number, b.number) : fold_unop(op.operands[0], a.number);
+            known[n] = result;
+            break;
+        }
+        case DIRECT:
+            lvalue = op.operands[0];
+            break;
+        case INDIRECT:
+            lvalue = -1;
+            break;
+        case BINAS:
+            // another instance's variable could be this one's, if it's this instance
+            if(lvalue < 0)
+                facts.clear();
             else
+                store(lvalue, op.operands[0], node.args[0]);
+            break;
+        case UNAS:
+            if(lvalue < 0)
+                facts.clear();
+            else if(facts.count(lvalue))
             {
-                if(!global.instances.count(lvalue_id))
-                {
-                    puts("Error: instance being dereferenced does not exist");
-                    break;
-                }
-                auto other = global.instances[lvalue_id];
-                if(other->variables.size() == 0)
-                {
-                    puts("Internal error: tried operating on a zero-size stack of variable heaps");
-                    exit(0);
-                }
-                auto varstack_current = other->variables.size()-1;
-                while(other->variables[varstack_current].count(lvalue_name) == 0 and varstack_current > 0)
-                    varstack_current--;
-                auto & vstack = other->variables[varstack_current];
-                if(vstack.count(lvalue_name))
-                    lvalue = &(vstack[lvalue_name]);
+                auto & fact = facts[lvalue];
+                fact.number += (op.operands[0] == INCREMENT) ? 1 : -1;
             }
-            if(lvalue == nullptr)
+            break;
+        case DECLARE:
+            facts[op.operands[0]] = {true, 0};
+            break;
+        case DECLSET:
+            store(op.operands[0], ASSIGN, node.args[0]);
+            break;
+        case CALL:
+        case TAILCALL:
+            facts.clear();
+            break;
+        case EXITSCOPE:
+        case LOADSCOPE:
+        case BREAK:
+            kill(node.after);
+            break;
+        default:
+            break;
+        }
+    }
+};
+
+// forward dataflow over each region's blocks: the facts that hold on every path into each block
+void ir_dataflow(irprogram & ir, std::vector<irfacts> * entry, std::vector<bool> * reached)
+{
+    entry->assign(ir.blocks.size(), irfacts());
+    reached->assign(ir.blocks.size(), false);
+    std::vector<uint32_t> work;
+    for(auto root : ir.roots)
+    {
+        (*reached)[root] = true;
+        work.push_back(root);
+    }
+    while(work.size() > 0)
+    {
+        auto b = work.back();
+        work.pop_back();
+        irwalker walker(ir, ir.blocks[b].region, (*entry)[b]);
+        for(auto n : ir.blocks[b].nodes)
+        {
+            if(!ir.nodes[n].removed)
+                walker.step(n);
+        }
+        for(auto s : ir.blocks[b].successors)
+        {
+            auto & next = (*entry)[s];
+            if(!(*reached)[s])
             {
-                puts("Error: assigning to undeclared variable");
-                break;
+                (*reached)[s] = true;
+                next = walker.facts;
+                work.push_back(s);
+                continue;
             }
-            
-            
-            
-            if(lvalue->is_number and right.is_number)
+            bool changed = false;
+            for(auto it = next.begin(); it != next.end(); )
             {
-                switch(bytecode[pc++])
-                {
-                case ASSIGN:
+                auto other = walker.facts.find(it->first);
+                if(other == walker.facts.end())
                 {
-                    *lvalue = right;
-                    break;
+                    it = next.erase(it);
+                    changed = true;
+                    continue;
                 }
-                case MUTADD:
+                if(it->second.constant and !(other->second == it->second))
                 {
-                    lvalue->real += right.real;
-                    break;
+                    it->second.constant = false;
+                    changed = true;
                 }
-                case MUTSUB:
+                ++it;
+            }
+            if(changed)
+                work.push_back(s);
+        }
+    }
+}
+
+// names with a known constant value are replaced by the value, and names copied from another name that hasn't changed
+// since are read from that name instead
+void ir_propagate(irprogram & ir)
+{
+    std::vector<irfacts> entry;
+    std::vector<bool> reached;
+    ir_dataflow(ir, &entry, &reached);
+    for(uint32_t b = 0; b < ir.blocks.size(); b++)
+    {
+        auto & block = ir.blocks[b];
+        if(!reached[b] or block.opaque)
+            continue;
+        irwalker walker(ir, block.region, entry[b]);
+        std::map<uint64_t, uint64_t> versions; // bumped whenever a name might start meaning something else
+        std::map<uint64_t, std::pair<uint64_t, uint64_t>> copies; // name -> name it was copied from, and its version
+        for(auto n : block.nodes)
+        {
+            auto & node = ir.nodes[n];
+            if(node.removed)
+                continue;
+            auto & op = node.op;
+            if(op.opcode == PUSHVAR)
+            {
+                auto fact = walker.facts.find(op.operands[0]);
+                auto copy = copies.find(op.operands[0]);
+                if(fact != walker.facts.end() and fact->second.constant)
                 {
-                    lvalue->real -= right.real;
-                    break;
+                    op.opcode = PUSHVAL;
+                    memcpy(&op.operands[0], &fact->second.number, sizeof(double));
                 }
-                case MUTMUL:
+                else if(copy != copies.end() and versions[copy->second.first] == copy->second.second)
+                    op.operands[0] = copy->second.first;
+            }
+            walker.step(n);
+            switch(op.opcode)
+            {
+            case BINAS:
+            {
+                if(walker.lvalue < 0)
                 {
-                    lvalue->real *= right.real;
+                    copies.clear();
                     break;
                 }
-                case MUTDIV:
+                uint64_t symbol = walker.lvalue;
+                versions[symbol]++;
+                copies.erase(symbol);
+                auto source = node.args[0];
+                if(op.operands[0] == ASSIGN and source != IR_NONE and ir.nodes[source].op.opcode == PUSHVAR
+                   and ir.nodes[source].op.operands[0] != symbol)
                 {
-                    lvalue->real /= right.real;
-                    break;
+                    auto from = ir.nodes[source].op.operands[0];
+                    copies[symbol] = {from, versions[from]};
                 }
-                default:
-                printf("Unknown binary numeric assignment 0x%02X at 0x%08X\n", bytecode[pc-1], pc-1);
-                return;
+                break;
+            }
+            case UNAS:
+                if(walker.lvalue < 0)
+                    copies.clear();
+                else
+                {
+                    versions[walker.lvalue]++;
+                    copies.erase(walker.lvalue);
                 }
+                break;
+            case DECLARE:
+            case DECLSET:
+                versions[op.operands[0]]++;
+                copies.erase(op.operands[0]);
+                break;
+            case CALL:
+            case TAILCALL:
+            case EXITSCOPE:
+            case LOADSCOPE:
+            case BREAK:
+                copies.clear();
+                break;
+            default:
+                break;
             }
-            else if(!lvalue->is_number and !right.is_number)
+        }
+    }
+}
+
+// operations on constants are replaced by their results
+void ir_fold(irprogram & ir)
+{
+    for(auto & block : ir.blocks)
+    {
+        if(block.opaque or block.region == IR_NONE)
+            continue;
+        for(auto n : block.nodes)
+        {
+            auto & node = ir.nodes[n];
+            if(node.removed or (node.op.opcode != BINOP and node.op.opcode != UNOP))
+                continue;
+            bool constant = true;
+            for(auto arg : node.args)
+                constant = constant and arg != IR_NONE and ir.nodes[arg].op.opcode == PUSHVAL;
+            if(!constant)
+                continue;
+            double result = (node.op.opcode == BINOP)
+                ? fold_binop(node.op.operands[0], ir_constant(ir.nodes[node.args[0]]), ir_constant(ir.nodes[node.args[1]]))
+                : fold_unop(node.op.operands[0], ir_constant(ir.nodes[node.args[0]]));
+            for(auto arg : node.args)
+                ir_remove_tree(ir, arg);
+            node.args.clear();
+            node.op.opcode = PUSHVAL;
+            memcpy(&node.op.operands[0], &result, sizeof(double));
+        }
+    }
+}
+
+// natural loops: a header, and the blocks that can get back to it without leaving through it
+struct irloop
+{
+    uint32_t header;
+    std::vector<bool> body;
+    uint32_t preheader = IR_NONE; // the one block that enters the loop, if it's one that temporaries can go in
+};
+
+std::vector<irloop> ir_find_loops(irprogram & ir)
+{
+    std::vector<irloop> loops;
+    auto count = ir.blocks.size();
+    if(count > 4000) // dominator sets are quadratic
+        return loops;
+    // dominators, by iterating to a fixed point
+    std::vector<std::vector<bool>> dominators(count, std::vector<bool>(count, true));
+    for(auto root : ir.roots)
+    {
+        dominators[root].assign(count, false);
+        dominators[root][root] = true;
+    }
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(uint32_t b = 0; b < count; b++)
+        {
+            auto & block = ir.blocks[b];
+            if(block.region == IR_NONE or ir.roots[block.region] == b)
+                continue;
+            std::vector<bool> next(count, true);
+            for(auto p : block.predecessors)
             {
-                switch(bytecode[pc++])
-                {
-                case ASSIGN:
+                if(ir.blocks[p].region == IR_NONE)
+                    continue;
+                for(uint32_t i = 0; i < count; i++)
+                    next[i] = next[i] and dominators[p][i];
+            }
+            next[b] = true;
+            if(next != dominators[b])
+            {
+                dominators[b] = next;
+                changed = true;
+            }
+        }
+    }
+    for(uint32_t h = 0; h < count; h++)
+    {
+        if(ir.blocks[h].region == IR_NONE)
+            continue;
+        irloop loop;
+        loop.header = h;
+        loop.body.assign(count, false);
+        std::vector<uint32_t> work;
+        for(auto p : ir.blocks[h].predecessors)
+        {
+            if(ir.blocks[p].region != IR_NONE and dominators[p][h])
+                work.push_back(p);
+        }
+        if(work.size() == 0)
+            continue;
+        loop.body[h] = true;
+        while(work.size() > 0)
+        {
+            auto b = work.back();
+            work.pop_back();
+            if(loop.body[b])
+                continue;
+            loop.body[b] = true;
+            for(auto p : ir.blocks[b].predecessors)
+            {
+                if(ir.blocks[p].region != IR_NONE)
+                    work.push_back(p);
+            }
+        }
+
+        // temporaries are declared at the end of the preheader, in a scope it opened, which outlives the loop
+        uint32_t outside = IR_NONE;
+        uint32_t entries = 0;
+        for(auto p : ir.blocks[h].predecessors)
+        {
+            if(!loop.body[p])
+            {
+                outside = p;
+                entries++;
+            }
+        }
+        if(entries == 1 and !ir.blocks[outside].opaque and ir.blocks[outside].successors.size() == 1)
+        {
+            auto & pre = ir.blocks[outside];
+            uint32_t opened = 0;
+            uint32_t depth = 0;
+            for(auto n : pre.nodes)
+            {
+                auto & node = ir.nodes[n];
+                if(node.removed)
+                    continue;
+                if(node.op.opcode == OPENSCOPE)
+                    opened = node.after;
+                if(node.after < opened)
+                    opened = 0;
+                depth = node.after;
+            }
+            bool nested = opened != 0 and opened == depth;
+            for(uint32_t b = 0; b < count and nested; b++)
+            {
+                if(!loop.body[b])
+                    continue;
+                for(auto n : ir.blocks[b].nodes)
+                    nested = nested and ir.nodes[n].depth >= depth;
+            }
+            if(nested)
+                loop.preheader = outside;
+        }
+        loops.push_back(std::move(loop));
+    }
+    return loops;
+}
+
+// where new instructions go at the end of a preheader: before its jump into the loop, if it has one
+uint64_t ir_preheader_end(irprogram & ir, uint32_t preheader)
+{
+    auto & nodes = ir.blocks[preheader].nodes;
+    uint64_t at = nodes.size();
+    while(at > 0 and ir.nodes[nodes[at-1]].removed)
+        at--;
+    if(at > 0 and is_jump(ir.nodes[nodes[at-1]].op.opcode))
+        at--;
+    return at;
+}
+
+uint32_t ir_end_depth(const irprogram & ir, uint32_t b)
+{
+    auto depth = ir.nodes[ir.blocks[b].nodes[0]].depth;
+    for(auto n : ir.blocks[b].nodes)
+        depth = ir.nodes[n].removed ? depth : ir.nodes[n].after;
+    return depth;
+}
+
+// copies a value's instructions to the end of a block, in order
+uint32_t ir_clone_tree(irprogram & ir, uint32_t n, std::vector<uint32_t> & into, uint32_t depth)
+{
+    std::vector<uint32_t> args;
+    for(auto arg : ir.nodes[n].args)
+        args.push_back(ir_clone_tree(ir, arg, into, depth));
+    auto copy = ir.add(ir.nodes[n].op.opcode, 0, depth);
+    ir.nodes[copy].op = ir.nodes[n].op;
+    ir.nodes[copy].value = true;
+    ir.nodes[copy].args = args;
+    for(auto arg : args)
+        ir.nodes[arg].user = copy;
+    into.push_back(copy);
+    return copy;
+}
+
+// a value's shape, for finding the same computation twice. names are included with how many times they've possibly
+// changed meaning or value, which callers supply
+std::string ir_value_key(irprogram & ir, uint32_t n, const std::map<uint32_t, std::string> & names)
+{
+    auto & node = ir.nodes[n];
+    switch(node.op.opcode)
+    {
+    case PUSHVAL: return "c" + std::to_string(node.op.operands[0]);
+    case PUSHVAR: return "v" + names.at(n);
+    case BINOP: return "b" + std::to_string(node.op.operands[0]) + "(" + ir_value_key(ir, node.args[0], names) + "," + ir_value_key(ir, node.args[1], names) + ")";
+    default: return "u" + std::to_string(node.op.operands[0]) + "(" + ir_value_key(ir, node.args[0], names) + ")";
+    }
+}
+
+// arithmetic on names that don't change in a loop, and that are known to be numbers before it, is computed once in
+// the preheader into a temporary. the loop can't contain calls or writes to other instances, either of which could
+// change any variable
+void ir_hoist(irprogram & ir)
+{
+    auto loops = ir_find_loops(ir);
+    if(loops.size() == 0)
+        return;
+    std::vector<irfacts> entry;
+    std::vector<bool> reached;
+    ir_dataflow(ir, &entry, &reached);
+    for(auto & loop : loops)
+    {
+        if(loop.preheader == IR_NONE or !reached[loop.preheader])
+            continue;
+        std::set<uint64_t> written;
+        bool clobbers = false;
+        for(uint32_t b = 0; b < ir.blocks.size(); b++)
+        {
+            if(!loop.body[b])
+                continue;
+            for(auto n : ir.blocks[b].nodes)
+            {
+                auto & op = ir.nodes[n].op;
+                if(ir.nodes[n].removed)
+                    continue;
+                if(op.opcode == DIRECT or op.opcode == DECLARE or op.opcode == DECLSET)
+                    written.insert(op.operands[0]);
+                if(op.opcode == CALL or op.opcode == TAILCALL or op.opcode == INDIRECT)
+                    clobbers = true;
+            }
+        }
+        if(clobbers)
+            continue;
+
+        irwalker walker(ir, ir.blocks[loop.preheader].region, entry[loop.preheader]);
+        for(auto n : ir.blocks[loop.preheader].nodes)
+        {
+            if(!ir.nodes[n].removed)
+                walker.step(n);
+        }
+        auto & facts = walker.facts;
+
+        // invariant values, and the biggest invariant values that contain them
+        std::vector<uint32_t> found;
+        std::map<uint32_t, std::string> names;
+        std::set<uint32_t> invariant;
+        for(uint32_t b = 0; b < ir.blocks.size(); b++)
+        {
+            if(!loop.body[b] or ir.blocks[b].opaque)
+                continue;
+            for(auto n : ir.blocks[b].nodes)
+            {
+                auto & node = ir.nodes[n];
+                if(node.removed)
+                    continue;
+                bool is = false;
+                if(node.op.opcode == PUSHVAL)
+                    is = true;
+                else if(node.op.opcode == PUSHVAR)
                 {
-                    *lvalue = right;
-                    break;
+                    is = !written.count(node.op.operands[0]) and facts.count(node.op.operands[0]);
+                    names[n] = std::to_string(node.op.operands[0]);
                 }
-                case MUTADD:
+                else if(node.op.opcode == BINOP or node.op.opcode == UNOP)
                 {
-                    lvalue->text += right.text;
-                    break;
-                }
-                default:
-                printf("Unknown binary assignment 0x%02X at 0x%08X\n", bytecode[pc-1], pc-1);
-                return;
+                    is = true;
+                    for(auto arg : node.args)
+                        is = is and arg != IR_NONE and invariant.count(arg);
                 }
+                if(is)
+                    invariant.insert(n);
             }
-            
+        }
+        for(auto n : invariant)
+        {
+            auto & node = ir.nodes[n];
+            if((node.op.opcode == BINOP or node.op.opcode == UNOP) and !invariant.count(node.user))
+                found.push_back(n);
+        }
+        if(found.size() == 0)
+            continue;
+
+        auto & pre = ir.blocks[loop.preheader];
+        auto at = ir_preheader_end(ir, loop.preheader);
+        auto depth = ir_end_depth(ir, loop.preheader);
+        std::vector<uint32_t> inserted;
+        std::map<std::string, uint64_t> temporaries;
+        for(auto n : found)
+        {
+            auto key = ir_value_key(ir, n, names);
+            if(!temporaries.count(key))
+            {
+                auto symbol = ir.temporary("licm");
+                auto root = ir_clone_tree(ir, n, inserted, depth);
+                auto declare = ir.add(DECLSET, symbol, depth);
+                ir.nodes[declare].args.push_back(root);
+                ir.nodes[root].user = declare;
+                inserted.push_back(declare);
+                temporaries[key] = symbol;
+            }
+            auto & node = ir.nodes[n];
+            for(auto arg : node.args)
+                ir_remove_tree(ir, arg);
+            node.args.clear();
+            node.op = looseop();
+            node.op.opcode = PUSHVAR;
+            node.op.operands[0] = temporaries[key];
+        }
+        pre.nodes.insert(pre.nodes.begin() + at, inserted.begin(), inserted.end());
+    }
+}
+
+// bit-level tests on constants for ir_reduce_strength, with the exponent field unbiased
+int32_t ir_exponent(double number)
+{
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(double));
+    return int32_t((bits >> 52) & 0x7FF) - 1023;
+}
+uint64_t ir_mantissa(double number)
+{
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(double));
+    return bits & 0xFFFFFFFFFFFFF;
+}
+bool ir_small_integer(double number, double limit)
+{
+    return number > -limit and number < limit and double(int64_t(number)) == number;
+}
+
+// cheaper arithmetic that gives the same results. dividing by a power of two becomes multiplying by its reciprocal,
+// which is exact too. and in a loop, a product of a positive constant and an induction variable (a name the loop only
+// ever steps by small integers, that's an integer going in) is kept in a temporary that's stepped alongside the
+// variable, if the product is used more often than the variable is stepped. the constant's significand is at most 11
+// bits, so both the product and the temporary are exact, and equal, until the variable passes 2^42.
+void ir_reduce_strength(irprogram & ir)
+{
+    for(auto & block : ir.blocks)
+    {
+        if(block.region == IR_NONE or block.opaque)
+            continue;
+        for(auto n : block.nodes)
+        {
+            auto & node = ir.nodes[n];
+            if(node.removed or node.op.opcode != BINOP or node.op.operands[0] != DIV or node.args[1] == IR_NONE)
+                continue;
+            auto & divisor = ir.nodes[node.args[1]];
+            if(divisor.op.opcode != PUSHVAL)
+                continue;
+            auto value = ir_constant(divisor);
+            auto exponent = ir_exponent(value);
+            if(ir_mantissa(value) != 0 or exponent < -1022 or exponent > 1022)
+                continue;
+            auto reciprocal = 1/value;
+            node.op.operands[0] = MUL;
+            memcpy(&divisor.op.operands[0], &reciprocal, sizeof(double));
+        }
+    }
+
+    auto loops = ir_find_loops(ir);
+    if(loops.size() == 0)
+        return;
+    std::vector<irfacts> entry;
+    std::vector<bool> reached;
+    ir_dataflow(ir, &entry, &reached);
+    for(auto & loop : loops)
+    {
+        if(loop.preheader == IR_NONE or !reached[loop.preheader])
+            continue;
+        // every write to each name in the loop: the instruction that stores, and by how much it steps the name, or
+        // zero if it's anything else
+        std::map<uint64_t, std::vector<std::pair<uint32_t, double>>> writes;
+        std::map<std::pair<uint64_t, uint64_t>, std::vector<uint32_t>> products; // name and constant -> products
+        bool clobbers = false;
+        for(uint32_t b = 0; b < ir.blocks.size(); b++)
+        {
+            if(!loop.body[b])
+                continue;
+            auto & block = ir.blocks[b];
+            uint32_t direct = IR_NONE;
+            for(auto n : block.nodes)
+            {
+                auto & node = ir.nodes[n];
+                auto & op = node.op;
+                if(node.removed)
+                    continue;
+                if(op.opcode == CALL or op.opcode == TAILCALL or op.opcode == INDIRECT)
+                    clobbers = true;
+                if(op.opcode == DECLARE or op.opcode == DECLSET or (op.opcode == DIRECT and block.opaque))
+                    writes[op.operands[0]].push_back({n, 0});
+                if(block.opaque)
+                    continue;
+                if(op.opcode == DIRECT)
+                    direct = n;
+                if((op.opcode == BINAS or op.opcode == UNAS) and direct != IR_NONE)
+                {
+                    double step = 0;
+                    auto by = (op.opcode == BINAS) ? node.args[0] : IR_NONE;
+                    if(op.opcode == UNAS)
+                        step = (op.operands[0] == INCREMENT) ? 1 : -1;
+                    else if((op.operands[0] == MUTADD or op.operands[0] == MUTSUB) and by != IR_NONE and ir.nodes[by].op.opcode == PUSHVAL
+                            and ir_small_integer(ir_constant(ir.nodes[by]), 1025))
+                        step = (op.operands[0] == MUTADD) ? ir_constant(ir.nodes[by]) : -ir_constant(ir.nodes[by]);
+                    writes[ir.nodes[direct].op.operands[0]].push_back({n, step});
+                    direct = IR_NONE;
+                }
+                if(op.opcode == BINOP and op.operands[0] == MUL and node.args[0] != IR_NONE and node.args[1] != IR_NONE)
+                {
+                    for(int side = 0; side < 2; side++)
+                    {
+                        auto & name = ir.nodes[node.args[side]];
+                        auto & factor = ir.nodes[node.args[1-side]];
+                        if(name.op.opcode != PUSHVAR or factor.op.opcode != PUSHVAL)
+                            continue;
+                        auto value = ir_constant(factor);
+                        auto exponent = ir_exponent(value);
+                        // positive, so a product of zero is +0 whichever way the temporary got back to it
+                        if(!(value > 0) or (ir_mantissa(value) & ((uint64_t(1) << 41) - 1)) != 0 or exponent < -100 or exponent > 100)
+                            continue;
+                        products[{name.op.operands[0], factor.op.operands[0]}].push_back(n);
+                        break;
+                    }
+                }
+            }
+        }
+        if(clobbers or products.size() == 0)
+            continue;
+
+        irwalker walker(ir, ir.blocks[loop.preheader].region, entry[loop.preheader]);
+        for(auto n : ir.blocks[loop.preheader].nodes)
+        {
+            if(!ir.nodes[n].removed)
+                walker.step(n);
+        }
+        std::vector<uint32_t> inserted;
+        auto depth = ir_end_depth(ir, loop.preheader);
+        for(auto & [key, uses] : products)
+        {
+            auto symbol = key.first;
+            auto fact = walker.facts.find(symbol);
+            if(fact == walker.facts.end() or !fact->second.constant or !ir_small_integer(fact->second.number, 2147483648.0))
+                continue;
+            auto & steps = writes[symbol];
+            bool induction = steps.size() > 0;
+            for(auto & write : steps)
+                induction = induction and write.second != 0;
+            // a use saves two instructions, a step costs three
+            if(!induction or uses.size()*2 <= steps.size()*3)
+                continue;
+
+            double factor;
+            memcpy(&factor, &key.second, sizeof(double));
+            auto temporary = ir.temporary("sr");
+            auto initial = ir.add(PUSHVAL, 0, depth);
+            double start = fact->second.number * factor;
+            memcpy(&ir.nodes[initial].op.operands[0], &start, sizeof(double));
+            auto declare = ir.add(DECLSET, temporary, depth);
+            ir.nodes[declare].args.push_back(initial);
+            ir.nodes[initial].user = declare;
+            inserted.push_back(initial);
+            inserted.push_back(declare);
+
+            for(auto & write : steps)
+            {
+                auto after = ir.nodes[write.first].after;
+                double by = write.second * factor;
+                auto direct = ir.add(DIRECT, temporary, after);
+                auto value = ir.add(PUSHVAL, 0, after);
+                memcpy(&ir.nodes[value].op.operands[0], &by, sizeof(double));
+                auto assign = ir.add(BINAS, MUTADD, after);
+                ir.nodes[assign].args.push_back(value);
+                ir.nodes[value].user = assign;
+                for(auto & block : ir.blocks)
+                {
+                    auto at = std::find(block.nodes.begin(), block.nodes.end(), write.first);
+                    if(at != block.nodes.end())
+                    {
+                        block.nodes.insert(at + 1, {direct, value, assign});
+                        break;
+                    }
+                }
+            }
+            for(auto n : uses)
+            {
+                auto & node = ir.nodes[n];
+                for(auto arg : node.args)
+                    ir_remove_tree(ir, arg);
+                node.args.clear();
+                node.op = looseop();
+                node.op.opcode = PUSHVAR;
+                node.op.operands[0] = temporary;
+            }
+        }
+        auto & pre = ir.blocks[loop.preheader];
+        pre.nodes.insert(pre.nodes.begin() + ir_preheader_end(ir, loop.preheader), inserted.begin(), inserted.end());
+    }
+}
+
+// a value computed twice in a block, from names that haven't changed in between, is kept in a temporary the first
+// time and read back the second. outside loops the temporary is declared in a scope the block itself opened; inside
+// one it's declared in the loop's preheader and assigned in the block, which keeps the loop traceable
+void ir_eliminate_common(irprogram & ir)
+{
+    auto loops = ir_find_loops(ir);
+    std::vector<uint32_t> innermost(ir.blocks.size(), IR_NONE); // the smallest loop each block is in
+    std::vector<uint64_t> sizes(loops.size(), 0);
+    for(uint32_t l = 0; l < loops.size(); l++)
+    {
+        for(uint32_t b = 0; b < ir.blocks.size(); b++)
+            sizes[l] += loops[l].body[b];
+    }
+    for(uint32_t b = 0; b < ir.blocks.size(); b++)
+    {
+        for(uint32_t l = 0; l < loops.size(); l++)
+        {
+            if(loops[l].body[b] and (innermost[b] == IR_NONE or sizes[l] < sizes[innermost[b]]))
+                innermost[b] = l;
+        }
+    }
+
+    std::vector<irfacts> entry;
+    std::vector<bool> reached;
+    ir_dataflow(ir, &entry, &reached);
+    for(uint32_t b = 0; b < ir.blocks.size(); b++)
+    {
+        auto & block = ir.blocks[b];
+        if(block.opaque or !reached[b])
+            continue;
+        uint32_t preheader = IR_NONE;
+        if(innermost[b] != IR_NONE)
+        {
+            preheader = loops[innermost[b]].preheader;
+            if(preheader == IR_NONE)
+                continue;
+        }
+        for(int rounds = 0; rounds < 16; rounds++)
+        {
+            // number the values in the block, and note which scopes the block opened are still open at each one
+            irwalker walker(ir, block.region, entry[b]);
+            std::map<uint64_t, uint64_t> versions;
+            uint64_t epoch = 0;
+            std::map<uint32_t, std::string> names;
+            std::map<std::string, std::vector<uint64_t>> seen; // value key -> positions in the block
+            std::vector<uint32_t> scopes; // scopes the block opened that are still open, innermost last
+            std::vector<uint32_t> scope_at(block.nodes.size(), 0); // 1+ the innermost of them, 0 if none
+            std::vector<uint32_t> closed_at; // per scope the block opened, where it was closed
+            std::vector<uint32_t> pending(block.nodes.size(), IR_NONE); // lvalue set and not yet used
+            uint32_t lvalue = IR_NONE;
+            for(uint64_t i = 0; i < block.nodes.size(); i++)
+            {
+                auto n = block.nodes[i];
+                auto & node = ir.nodes[n];
+                if(node.removed)
+                    continue;
+                auto & op = node.op;
+                scope_at[i] = scopes.size() ? scopes.back()+1 : 0;
+                pending[i] = lvalue;
+                walker.step(n);
+                if(op.opcode == PUSHVAR)
+                    names[n] = std::to_string(op.operands[0]) + "." + std::to_string(versions[op.operands[0]]) + "." + std::to_string(epoch);
+                if(op.opcode == BINOP or op.opcode == UNOP)
+                {
+                    bool known = true;
+                    for(auto arg : node.args)
+                        known = known and arg != IR_NONE and (names.count(arg) or ir.nodes[arg].op.opcode == PUSHVAL);
+                    // a temporary assigned in a loop has to keep one type, since it's assigned over its old value
+                    if(known and (preheader == IR_NONE or walker.numeric(n)))
+                    {
+                        names[n] = "";
+                        seen[ir_value_key(ir, n, names)].push_back(i);
+                    }
+                }
+                switch(op.opcode)
+                {
+                case OPENSCOPE:
+                    scopes.push_back(closed_at.size());
+                    closed_at.push_back(IR_NONE);
+                    break;
+                case EXITSCOPE: case LOADSCOPE: case BREAK:
+                    for(auto closing = node.depth - node.after; closing > 0 and scopes.size() > 0; closing--)
+                    {
+                        closed_at[scopes.back()] = i;
+                        scopes.pop_back();
+                    }
+                    epoch++;
+                    break;
+                case DIRECT: lvalue = n; versions[op.operands[0]]++; break;
+                case INDIRECT: lvalue = n; epoch++; break;
+                case BINAS: case UNAS: lvalue = IR_NONE; break;
+                case DECLARE: case DECLSET: versions[op.operands[0]]++; break;
+                case CALL: case TAILCALL: epoch++; break;
+                default: break;
+                }
+            }
+
+            // the candidate that saves the most
+            int64_t best = 0;
+            std::vector<uint64_t> * chosen = nullptr;
+            for(auto & entry : seen)
+            {
+                auto & positions = entry.second;
+                if(positions.size() < 2)
+                    continue;
+                auto first = positions[0];
+                auto firstnode = block.nodes[first];
+                int64_t size = ir_tree_size(ir, firstnode);
+                int64_t cost = 2; // DECLSET and PUSHVAR
+                if(preheader != IR_NONE)
+                {
+                    // DIRECT, BINAS and PUSHVAR, and pointing the lvalue back where it was
+                    if(pending[first] != IR_NONE and ir.nodes[pending[first]].op.opcode == INDIRECT)
+                        continue;
+                    cost = 3 + (pending[first] != IR_NONE) + 1; // and DECLARE in the preheader, once
+                }
+                else
+                {
+                    auto scope = scope_at[first];
+                    if(scope == 0)
+                        continue;
+                    if(closed_at[scope-1] != IR_NONE and closed_at[scope-1] < positions.back())
+                        continue;
+                }
+                int64_t saving = (size-1) * int64_t(positions.size()-1) - cost;
+                if(saving > best)
+                {
+                    best = saving;
+                    chosen = &positions;
+                }
+            }
+            if(chosen == nullptr)
+                break;
+
+            auto positions = *chosen;
+            auto first = block.nodes[positions[0]];
+            auto after = ir.nodes[first].after;
+            uint64_t symbol = ir.temporary("cse");
+            std::vector<uint32_t> inserted;
+            if(preheader == IR_NONE)
+                inserted.push_back(ir.add(DECLSET, symbol, after));
+            else
+            {
+                auto declare = ir.add(DECLARE, symbol, ir_end_depth(ir, preheader));
+                auto & pre = ir.blocks[preheader];
+                pre.nodes.insert(pre.nodes.begin() + ir_preheader_end(ir, preheader), declare);
+                inserted.push_back(ir.add(DIRECT, symbol, after));
+                inserted.push_back(ir.add(BINAS, ASSIGN, after));
+            }
+            ir.nodes[inserted.back()].args.push_back(first);
+            auto reread = ir.add(PUSHVAR, symbol, after);
+            inserted.push_back(reread);
+            auto user = ir.nodes[first].user;
+            ir.nodes[first].user = inserted[inserted.size()-2];
+            ir.nodes[reread].user = user;
+            if(user != IR_NONE)
+                std::replace(ir.nodes[user].args.begin(), ir.nodes[user].args.end(), first, reread);
+            auto pending_lvalue = pending[positions[0]];
+            if(preheader != IR_NONE and pending_lvalue != IR_NONE)
+            {
+                auto again = ir.add(DIRECT, ir.nodes[pending_lvalue].op.operands[0], after);
+                inserted.push_back(again);
+            }
+            for(uint64_t k = 1; k < positions.size(); k++)
+            {
+                auto & node = ir.nodes[block.nodes[positions[k]]];
+                for(auto arg : node.args)
+                    ir_remove_tree(ir, arg);
+                node.args.clear();
+                node.op = looseop();
+                node.op.opcode = PUSHVAR;
+                node.op.operands[0] = symbol;
+            }
+            block.nodes.insert(block.nodes.begin() + positions[0] + 1, inserted.begin(), inserted.end());
+        }
+    }
+}
+
+// a store to a name that's overwritten before anything could see it is removed, as is a value that's computed and
+// thrown away. both only when nothing in between could fail and leave the first store visible, and when the value
+// stored is a number that's stored over a number, so that the store can't be what changed the name's type
+void ir_eliminate_stores(irprogram & ir)
+{
+    std::vector<irfacts> entry;
+    std::vector<bool> reached;
+    ir_dataflow(ir, &entry, &reached);
+    for(uint32_t b = 0; b < ir.blocks.size(); b++)
+    {
+        auto & block = ir.blocks[b];
+        if(!reached[b] or block.opaque)
+            continue;
+        irwalker walker(ir, block.region, entry[b]);
+        std::map<uint64_t, std::pair<uint32_t, uint32_t>> stores; // name -> DIRECT and BINAS of a store nothing has seen
+        uint32_t direct = IR_NONE;
+        for(auto n : block.nodes)
+        {
+            auto & node = ir.nodes[n];
+            if(node.removed)
+                continue;
+            auto & op = node.op;
+            if(walker.can_fail(n))
+                stores.clear();
+            switch(op.opcode)
+            {
+            case PUSHVAR:
+                stores.erase(op.operands[0]);
+                break;
+            case DIRECT:
+                direct = n;
+                break;
+            case POP:
+                if(walker.numeric(node.args[0]))
+                {
+                    ir_remove_tree(ir, node.args[0]);
+                    node.removed = true;
+                    continue;
+                }
+                break;
+            case BINAS:
+            {
+                if(walker.lvalue < 0 or direct == IR_NONE or op.operands[0] != ASSIGN)
+                {
+                    stores.clear();
+                    break;
+                }
+                uint64_t symbol = walker.lvalue;
+                auto earlier = stores.find(symbol);
+                if(earlier != stores.end())
+                {
+                    auto & dead = ir.nodes[earlier->second.second];
+                    ir.nodes[earlier->second.first].removed = true;
+                    ir_remove_tree(ir, dead.args[0]);
+                    dead.removed = true;
+                    stores.erase(earlier);
+                }
+                if(walker.facts.count(symbol) and walker.numeric(node.args[0]))
+                    stores[symbol] = {direct, n};
+                break;
+            }
+            case PUSHVAL: case PUSHTEXT: case BINOP: case UNOP: case NOP:
+                break;
+            default:
+                stores.clear();
+                break;
+            }
+            walker.step(n);
+        }
+    }
+}
+
+// operations on values the dataflow proves are numbers become their NUM forms, which don't check types. it runs last,
+// since the other passes only look for the generic instructions
+void ir_specialize(irprogram & ir)
+{
+    std::vector<irfacts> entry;
+    std::vector<bool> reached;
+    ir_dataflow(ir, &entry, &reached);
+    for(uint32_t b = 0; b < ir.blocks.size(); b++)
+    {
+        auto & block = ir.blocks[b];
+        if(!reached[b] or block.opaque)
+            continue;
+        irwalker walker(ir, block.region, entry[b]);
+        for(auto n : block.nodes)
+        {
+            auto & node = ir.nodes[n];
+            if(node.removed)
+                continue;
+            auto opcode = node.op.opcode;
+            bool numeric = (opcode == BINOP or opcode == UNOP or opcode == TRUTH);
+            for(auto arg : node.args)
+                numeric = numeric and walker.numeric(arg);
+            walker.step(n);
+            if(numeric)
+                node.op.opcode = (opcode == BINOP) ? NUMBINOP : (opcode == UNOP) ? NUMUNOP : NUMTRUTH;
+        }
+    }
+}
+
+enum {
+    IRPASS_BUILD,
+    IRPASS_PROPAGATE,
+    IRPASS_FOLD,
+    IRPASS_HOIST,
+    IRPASS_REDUCE,
+    IRPASS_COMMON,
+    IRPASS_STORES,
+    IRPASS_SPECIALIZE,
+    IRPASS_LOWER,
+    IRPASS_COUNT,
+};
+
+const char * irpass_names[IRPASS_COUNT] = {
+    "build", "copy propagation", "constant folding", "loop-invariant code motion",
+    "strength reduction", "common subexpressions", "dead stores", "type specialization", "lower",
+};
+
+// what each pass has done on this thread, summed over every program it's optimized
+struct irpassstats
+{
+    double seconds = 0;
+    uint64_t before = 0; // instructions going in
+    uint64_t after = 0; // and coming out
+};
+thread_local irpassstats ir_stats[IRPASS_COUNT];
+thread_local uint64_t ir_programs = 0;
+
+void optimize_ops(std::vector<looseop> * ops, constpool * pool)
+{
+    auto timed = [&](int pass, uint64_t before, auto && run)
+    {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t after = run();
+        ir_stats[pass].seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ir_stats[pass].before += before;
+        ir_stats[pass].after += after;
+    };
+    irprogram ir;
+    ir.pool = pool;
+    bool built = false;
+    timed(IRPASS_BUILD, ops->size(), [&]{ built = ir_build(*ops, &ir); return ir.count(); });
+    if(!built)
+        return;
+    ir_programs++;
+    void (*passes[])(irprogram &) = {ir_propagate, ir_fold, ir_hoist, ir_reduce_strength, ir_eliminate_common, ir_eliminate_stores,
+        ir_specialize};
+    for(int pass = IRPASS_PROPAGATE; pass < IRPASS_LOWER; pass++)
+        timed(pass, ir.count(), [&]{ passes[pass-IRPASS_PROPAGATE](ir); return ir.count(); });
+    auto count = ir.count();
+    timed(IRPASS_LOWER, count, [&]{ ir_lower(ir, ops); return ops->size(); });
+}
+
+// converts version 1 bytecode (as emitted by compile()) to version 3
+// jump offsets are recalculated for the new layout; short jumps that no longer reach are promoted to long jumps
+// each instruction with an inline cache gets its own slot, and the number of slots is stored in *cachecount
+// given the constant pool the bytecode was compiled against, it's optimized first, which can add names to the pool
+// returns false on malformed input
+bool convert_bytecode(const std::vector<uint8_t> & v1, std::vector<uint8_t> * out, uint32_t * cachecount, constpool * pool = nullptr)
+{
+    std::vector<looseop> ops;
+    uint64_t caches = 0;
+    std::map<uint64_t, uint64_t> op_at; // old position -> index
+    uint64_t pc = 0;
+    while(pc < v1.size())
+    {
+        looseop op;
+        op.oldpos = pc;
+        op.opcode = v1[pc++];
+        auto info = get_opinfo(op.opcode);
+        if(info.name == nullptr)
+        {
+            printf("Error: unknown instruction 0x%02X at 0x%08X while converting bytecode\n", op.opcode, unsigned(op.oldpos));
+            return false;
+        }
+        for(int i = 0; i < 3; i++)
+        {
+            if(info.operands[i] == OPND_CACHE)
+            {
+                if(caches >= 0x10000)
+                {
+                    puts("Error: too many inline cache slots while converting bytecode");
+                    return false;
+                }
+                op.operands[i] = caches++;
+                continue;
+            }
+            auto size = operand_size(info.operands[i]);
+            if(pc + size > v1.size())
+            {
+                printf("Error: truncated instruction at 0x%08X while converting bytecode\n", unsigned(op.oldpos));
+                return false;
+            }
+            op.operands[i] = decode_v1(v1, pc, size);
+        }
+        op_at[op.oldpos] = ops.size();
+        ops.push_back(op);
+    }
+    op_at[pc] = ops.size(); // jumping to the very end exits the program
+    
+    for(auto & op : ops)
+    {
+        if(!is_jump(op.opcode)) continue;
+        int64_t offset = (get_opinfo(op.opcode).operands[0] == OPND_I16) ? int16_t(op.operands[0]) : int64_t(op.operands[0]);
+        uint64_t dest = op.oldpos + offset;
+        if(!op_at.count(dest))
+        {
+            printf("Error: jump at 0x%08X does not land on an instruction\n", unsigned(op.oldpos));
+            return false;
+        }
+        op.target = op_at[dest];
+    }
+    if(pool != nullptr)
+        optimize_ops(&ops, pool);
+    
+    // lay out until no short jump needs promoting; jumps only ever grow, so this terminates
+    uint64_t end;
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        uint64_t pos = 0;
+        for(auto & op : ops)
+        {
+            op.newpos = pos;
+            pos += aligned_layout_size(op.opcode, pos);
+        }
+        end = pos;
+        for(auto & op : ops)
+        {
+            if(get_opinfo(op.opcode).operands[0] != OPND_I16) continue;
+            uint64_t dest = (op.target == ops.size()) ? end : ops[op.target].newpos;
+            int64_t offset = int64_t(dest) - int64_t(op.newpos);
+            if(offset < -0x8000 or offset >= 0x8000)
+            {
+                op.opcode = long_jump_of(op.opcode);
+                changed = true;
+            }
+        }
+    }
+    
+    out->clear();
+    out->reserve(end);
+    for(auto & op : ops)
+    {
+        auto info = get_opinfo(op.opcode);
+        if(is_jump(op.opcode))
+        {
+            uint64_t dest = (op.target == ops.size()) ? end : ops[op.target].newpos;
+            op.operands[0] = uint64_t(int64_t(dest) - int64_t(op.newpos));
+        }
+        out->push_back(op.opcode);
+        for(int i = 0; i < 3; i++)
+        {
+            switch(info.operands[i])
+            {
+            case OPND_U8: out->push_back(uint8_t(op.operands[i])); break;
+            case OPND_U16: case OPND_CACHE: emit_aligned<uint16_t>(out, op.operands[i]); break;
+            case OPND_I16: emit_aligned<int16_t>(out, int16_t(op.operands[i])); break;
+            case OPND_I64: emit_aligned<int64_t>(out, int64_t(op.operands[i])); break;
+            case OPND_F64:
+            {
+                double value;
+                memcpy(&value, &op.operands[i], sizeof(double));
+                emit_aligned<double>(out, value);
+                break;
+            }
+            default: break;
+            }
+        }
+    }
+    *cachecount = caches;
+    return true;
+}
+
+// abstract machine state at the start of an instruction, as far as the verifier tracks it
+struct verifystate
+{
+    std::vector<uint64_t> heights; // value stack height in each open scope, innermost last
+    std::vector<uint64_t> saved; // scope depths saved by SAVESCOPE
+    bool lvalue = false; // whether DIRECT or INDIRECT has set the lvalue registers on every path here
+};
+
+// checks that bytecode is well formed: every opcode and operand is valid, jumps land on instructions, scopes are
+// opened and closed in balance, and the value stack never underflows. stack heights are computed for every
+// instruction by walking the control flow graph, and must agree wherever paths join.
+// marks the module as verified on success, so interpret() can run it without per-instruction defensive checks.
+bool verify_bytecode(module * mod)
+{
+    auto bytecode = mod->code;
+    auto codesize = mod->codesize;
+    mod->verified = false;
+    mod->isolated = false;
+    mod->functions.clear();
+    mod->function_of.assign(mod->symbolcount, NO_FUNCTION);
+    mod->natives.assign(mod->symbolcount, nullptr);
+    mod->loopheads.clear();
+    bool isolated = true;
+    
+    std::vector<bool> boundary(codesize+1, false);
+    std::vector<uint64_t> bodyends; // end of each function's body
+    uint64_t pc = 0;
+    while(pc < codesize)
+    {
+        boundary[pc] = true;
+        auto loc = pc;
+        auto opcode = bytecode[pc];
+        if(get_opinfo(opcode).name == nullptr)
+        {
+            printf("Verifier error: unknown or unsupported instruction 0x%02X at 0x%08X\n", opcode, unsigned(pc));
+            return false;
+        }
+        auto size = aligned_layout_size(opcode, pc);
+        if(pc+size > codesize)
+        {
+            printf("Verifier error: truncated instruction at 0x%08X\n", unsigned(pc));
+            return false;
+        }
+        pc += size;
+        if(opcode == JS or opcode == JL or opcode == BREAK)
+        {
+            // loops are the only way back, so every backward jump lands on the head of one
+            uint64_t operands = loc+1;
+            int64_t offset = (opcode == JS) ? decode_i16(bytecode, operands) : decode_i64(bytecode, operands);
+            if(offset < 0)
+                mod->loopheads.push_back(loc+offset);
+        }
+        if(opcode == FUNCDEF)
+        {
+            uint64_t operands = loc+1;
+            int64_t length = decode_i64(bytecode, operands);
+            auto name = decode_u16(bytecode, operands);
+            uint8_t arity = bytecode[operands];
+            if(name >= mod->symbolcount or mod->function_of[name] != NO_FUNCTION)
+            {
+                printf("Verifier error: bad or duplicate function name at 0x%08X\n", unsigned(loc));
+                return false;
+            }
+            if(length <= int64_t(size) or uint64_t(length) > codesize-loc)
+            {
+                printf("Verifier error: function body out of range at 0x%08X\n", unsigned(loc));
+                return false;
+            }
+            mod->function_of[name] = mod->functions.size();
+            mod->functions.push_back({pc, arity});
+            bodyends.push_back(loc+length);
+        }
+    }
+    boundary[codesize] = true; // running off the end exits the program
+    
+    // which function body each position is in (0 for the main program), so control can't cross into or out of one
+    // except through CALL and RETURN. nested functions come later in the list, so they overwrite their parents.
+    std::vector<uint32_t> region(codesize+1, 0);
+    for(uint64_t i = 0; i < mod->functions.size(); i++)
+        std::fill(region.begin()+mod->functions[i].entry, region.begin()+bodyends[i], i+1);
+    
+    std::vector<verifystate> states(codesize+1);
+    std::vector<bool> seen(codesize+1, false);
+    std::vector<uint64_t> work;
+    states[0].heights = {0};
+    seen[0] = true;
+    work.push_back(0);
+    // a function body starts in a scope of its own, with its arguments on the value stack
+    for(const auto & function : mod->functions)
+    {
+        states[function.entry].heights = {function.arity};
+        seen[function.entry] = true;
+        work.push_back(function.entry);
+    }
+    
+    auto flow = [&](uint64_t from, int64_t offset, const verifystate & state)
+    {
+        uint64_t to = from+offset;
+        if((offset < 0 and uint64_t(-offset) > from) or to > codesize or !boundary[to])
+        {
+            printf("Verifier error: jump at 0x%08X does not land on an instruction\n", unsigned(from));
+            return false;
+        }
+        if(region[to] != region[from])
+        {
+            printf("Verifier error: control flows into or out of a function body at 0x%08X\n", unsigned(from));
+            return false;
+        }
+        if(!seen[to])
+        {
+            seen[to] = true;
+            states[to] = state;
+            work.push_back(to);
+            return true;
+        }
+        auto & old = states[to];
+        if(old.heights != state.heights or old.saved != state.saved)
+        {
+            printf("Verifier error: inconsistent stack or scope depth at 0x%08X when reached from 0x%08X\n", unsigned(to), unsigned(from));
+            return false;
+        }
+        if(old.lvalue and !state.lvalue)
+        {
+            old.lvalue = false;
+            work.push_back(to);
+        }
+        return true;
+    };
+    
+    while(work.size() > 0)
+    {
+        auto loc = work.back();
+        work.pop_back();
+        if(loc == codesize)
+            continue;
+        
+        verifystate state = states[loc];
+        pc = loc;
+        auto opcode = bytecode[pc++];
+        uint64_t popped = 0;
+        uint64_t pushed = 0;
+        uint64_t symbol = 0;
+        bool uses_symbol = false;
+        bool falls_through = true;
+        switch(opcode)
+        {
+        case NOP:
+            break;
+        case PUSHVAL:
+            decode_double(bytecode, pc);
+            pushed = 1;
+            break;
+        case PUSHTEXT:
+            if(decode_u16(bytecode, pc) >= mod->textcount)
+            {
+                printf("Verifier error: string literal index out of range at 0x%08X\n", unsigned(loc));
+                return false;
+            }
+            pushed = 1;
+            break;
+        case PUSHVAR:
+            symbol = decode_u16(bytecode, pc);
+            uses_symbol = true;
+            pushed = 1;
+            break;
+        case POP:
+            popped = 1;
+            break;
+        case DECLARE:
+            symbol = decode_u16(bytecode, pc);
+            uses_symbol = true;
+            break;
+        case DECLSET:
+            symbol = decode_u16(bytecode, pc);
+            uses_symbol = true;
+            popped = 1;
+            break;
+        case BINOP:
+        case NUMBINOP:
+        {
+            auto op = bytecode[pc++];
+            if(op < ADD or op > OR)
+            {
+                printf("Verifier error: unknown binary operation 0x%02X at 0x%08X\n", op, unsigned(loc));
+                return false;
+            }
+            popped = 2;
+            pushed = 1;
+            break;
+        }
+        case UNOP:
+        case NUMUNOP:
+        {
+            auto op = bytecode[pc++];
+            if(op < POSITIVE or op > NEGATION)
+            {
+                printf("Verifier error: unknown unary operation 0x%02X at 0x%08X\n", op, unsigned(loc));
+                return false;
+            }
+            popped = 1;
+            pushed = 1;
+            break;
+        }
+        case DIRECT:
+            symbol = decode_u16(bytecode, pc);
+            uses_symbol = true;
+            state.lvalue = true;
+            break;
+        case INDIRECT:
+        case INDEXP:
+            symbol = decode_u16(bytecode, pc);
+            uses_symbol = true;
+            if(decode_u16(bytecode, pc) >= mod->caches.size())
+            {
+                printf("Verifier error: inline cache slot out of range at 0x%08X\n", unsigned(loc));
+                return false;
+            }
+            popped = 1;
+            if(opcode == INDIRECT)
+                state.lvalue = true;
+            else
+                pushed = 1;
+            break;
+        case BINAS:
+        case UNAS:
+        {
+            auto op = bytecode[pc++];
+            if((opcode == BINAS and (op < ASSIGN or op > MUTDIV)) or (opcode == UNAS and (op < INCREMENT or op > DECREMENT)))
+            {
+                printf("Verifier error: unknown assignment operation 0x%02X at 0x%08X\n", op, unsigned(loc));
+                return false;
+            }
+            if(!state.lvalue)
+            {
+                printf("Verifier error: assignment at 0x%08X is reachable without an lvalue\n", unsigned(loc));
+                return false;
+            }
+            popped = (opcode == BINAS) ? 1 : 0;
+            break;
+        }
+        case TRUTH:
+        case NUMTRUTH:
+            popped = 1;
+            break;
+        case OPENSCOPE:
+            state.heights.push_back(0);
+            break;
+        case EXITSCOPE:
+            if(state.heights.size() < 2)
+            {
+                printf("Verifier error: scope exited more times than it was opened at 0x%08X\n", unsigned(loc));
+                return false;
+            }
+            state.heights.pop_back();
+            break;
+        case SAVESCOPE:
+            state.saved.push_back(state.heights.size());
+            break;
+        case LOADSCOPE:
+        case BREAK:
+        {
+            if(state.saved.size() == 0)
+            {
+                printf("Verifier error: scope depth restored without being saved at 0x%08X\n", unsigned(loc));
+                return false;
+            }
+            if(state.saved.back() > state.heights.size())
+            {
+                printf("Verifier error: scope depth restored to a scope that is no longer open at 0x%08X\n", unsigned(loc));
+                return false;
+            }
+            state.heights.resize(state.saved.back());
+            state.saved.pop_back();
+            if(opcode == BREAK)
+            {
+                if(!flow(loc, decode_i64(bytecode, pc), state))
+                    return false;
+                falls_through = false;
+            }
+            break;
+        }
+        case JSIT:
+        case JSIF:
+        case JS:
+        case JLIT:
+        case JLIF:
+        case JL:
+        {
+            int64_t offset = (opcode == JSIT or opcode == JSIF or opcode == JS) ? decode_i16(bytecode, pc) : decode_i64(bytecode, pc);
+            if(!flow(loc, offset, state))
+                return false;
+            falls_through = !(opcode == JS or opcode == JL);
+            break;
+        }
+        case CALL:
+        case TAILCALL:
+            symbol = decode_u16(bytecode, pc);
+            uses_symbol = true;
+            popped = bytecode[pc++];
+            pushed = 1;
+            // the RETURN is what runs when the call can't replace the running function
+            if(opcode == TAILCALL and (pc >= codesize or bytecode[pc] != RETURN))
+            {
+                printf("Verifier error: tail call not followed by a return at 0x%08X\n", unsigned(loc));
+                return false;
+            }
+            break;
+        case FUNCDEF:
+        {
+            int64_t length = decode_i64(bytecode, pc);
+            decode_u16(bytecode, pc);
+            pc++;
+            if(!flow(loc, length, state))
+                return false;
+            falls_through = false;
+            break;
+        }
+        case RETURN:
+            popped = 1;
+            falls_through = false;
+            break;
+        }
+        if(uses_symbol and symbol >= mod->symbolcount)
+        {
+            printf("Verifier error: symbol index out of range at 0x%08X\n", unsigned(loc));
+            return false;
+        }
+        if((opcode == INDIRECT or opcode == INDEXP) and !is_builtin_field(mod->symbolids[symbol]))
+            isolated = false;
+        // calls are linked here: to one of the module's own functions if it has one by that name, otherwise to a
+        // builtin. the module's own functions are verified along with the rest of it; builtins can do anything
+        if(opcode == CALL or opcode == TAILCALL)
+        {
+            auto function = mod->function_of[symbol];
+            uint8_t arity;
+            if(function != NO_FUNCTION)
+                arity = mod->functions[function].arity;
+            else
+            {
+                auto native = builtins.find(mod->symbolids[symbol]);
+                if(native.function == nullptr)
+                {
+                    printf("Verifier error: unknown function \"%s\" at 0x%08X\n", mod->symbol(symbol).data(), unsigned(loc));
+                    return false;
+                }
+                mod->natives[symbol] = native.function;
+                arity = native.arity;
+                isolated = false;
+            }
+            if(popped != arity)
+            {
+                printf("Verifier error: wrong number of arguments to function \"%s\" at 0x%08X\n", mod->symbol(symbol).data(), unsigned(loc));
+                return false;
+            }
+        }
+        auto & height = state.heights.back();
+        if(height < popped)
+        {
+            printf("Verifier error: value stack underflow at 0x%08X\n", unsigned(loc));
+            return false;
+        }
+        height = height - popped + pushed;
+        if(falls_through and !flow(loc, pc-loc, state))
+            return false;
+    }
+    
+    std::sort(mod->loopheads.begin(), mod->loopheads.end());
+    mod->loopheads.erase(std::unique(mod->loopheads.begin(), mod->loopheads.end()), mod->loopheads.end());
+    mod->loops = std::vector<loopstate>(mod->loopheads.size());
+    
+    mod->verified = true;
+    mod->isolated = isolated;
+    return true;
+}
+
+// FNV-1a, used to tell whether a cached image is stale
+uint64_t hash_bytes(const uint8_t * data, uint64_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for(uint64_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+uint64_t hash_source(const std::string & source)
+{
+    return hash_bytes((const uint8_t *)source.data(), source.size());
+}
+
+std::vector<uint8_t> build_image(const std::vector<uint8_t> & code, const constpool & pool, uint64_t sourcehash, uint32_t cachecount, uint16_t version = BYTECODE_VERSION)
+{
+    bytecode_header header;
+    header.version = version;
+    header.sourcehash = sourcehash;
+    header.textcount = pool.texts.size();
+    header.symbolcount = pool.symbols.size();
+    header.cachecount = cachecount;
+    header.codesize = code.size();
+    
+    uint64_t tables = sizeof(header);
+    uint64_t data = tables + (pool.texts.size() + pool.symbols.size())*sizeof(poolentry);
+    std::vector<uint8_t> image(data);
+    auto write_string = [&](uint64_t entry, const std::string & str)
+    {
+        poolentry info = {uint32_t(image.size()), uint32_t(str.size())};
+        memcpy(&image[tables + entry*sizeof(poolentry)], &info, sizeof(info));
+        image.insert(image.end(), str.begin(), str.end());
+        image.push_back(0);
+    };
+    uint64_t entry = 0;
+    for(const auto & text : pool.texts)
+        write_string(entry++, text);
+    for(const auto & symbol : pool.symbols)
+        write_string(entry++, symbol);
+    if(image.size() >= 0xFFFFFFFF)
+    {
+        puts("Internal error: constant pool is too large to serialize");
+        exit(0);
+    }
+    while(image.size() % 8 != 0)
+        image.push_back(0);
+    header.codeoffset = image.size();
+    memcpy(image.data(), &header, sizeof(header));
+    vector_append(&image, code);
+    return image;
+}
+
+void module::unload()
+{
+#ifndef _WIN32
+    if(mapping)
+        munmap(mapping, mappingsize);
+#endif
+    mapping = nullptr;
+    mappingsize = 0;
+    owned.clear();
+    image = nullptr;
+    imagesize = 0;
+    code = nullptr;
+    codesize = 0;
+    texts = nullptr;
+    textcount = 0;
+    symbols = nullptr;
+    symbolcount = 0;
+    sourcehash = 0;
+    verified = false;
+    isolated = false;
+    symbolids.clear();
+    functions.clear();
+    function_of.clear();
+    natives.clear();
+    caches.clear();
+    delete jitted.exchange(nullptr);
+    loopheads.clear();
+    for(auto & loop : loops)
+        delete loop.trace.exchange(nullptr);
+    loops.clear();
+    aot = nullptr;
+    aotlibrary.reset();
+}
+
+// sets up a module over the image it holds (mod->image), checking that the layout is sound before anything points into it
+// version 1 images are converted into an owned version 3 image; version 3 images are used in place
+bool open_module(module * mod)
+{
+    bytecode_header header;
+    if(mod->imagesize < sizeof(header))
+    {
+        puts("Error: bytecode image is too short to have a header");
+        return false;
+    }
+    memcpy(&header, mod->image, sizeof(header));
+    if(memcmp(header.magic, "NGML", 4) != 0)
+    {
+        puts("Error: not a bytecode image");
+        return false;
+    }
+    bool foreign = false;
+    if(header.byteorder == 0x0201)
+    {
+        foreign = true;
+        header.version = __builtin_bswap16(header.version);
+        header.sourcehash = __builtin_bswap64(header.sourcehash);
+        header.textcount = __builtin_bswap32(header.textcount);
+        header.symbolcount = __builtin_bswap32(header.symbolcount);
+        header.cachecount = __builtin_bswap32(header.cachecount);
+        header.codeoffset = __builtin_bswap64(header.codeoffset);
+        header.codesize = __builtin_bswap64(header.codesize);
+    }
+    else if(header.byteorder != 0x0102)
+    {
+        puts("Error: bytecode image has a corrupt byte order marker");
+        return false;
+    }
+    if(header.version != BYTECODE_V1 and header.version != BYTECODE_V3)
+    {
+        printf("Error: unsupported bytecode version %d\n", header.version);
+        return false;
+    }
+    if(header.version == BYTECODE_V3 and foreign)
+    {
+        puts("Error: bytecode image was built for a machine with the other byte order");
+        return false;
+    }
+    uint64_t tables_end = sizeof(header) + (uint64_t(header.textcount) + header.symbolcount)*sizeof(poolentry);
+    // each cache slot belongs to one INDIRECT or INDEXP, so there can't be more of them than those fit in the code
+    uint64_t cached_size = std::min(aligned_layout_size(INDIRECT, 0), aligned_layout_size(INDIRECT, 1));
+    if(tables_end > header.codeoffset or header.codeoffset % 8 != 0
+       or header.codeoffset > mod->imagesize or header.codesize > mod->imagesize - header.codeoffset
+       or header.cachecount > header.codesize / cached_size)
+    {
+        puts("Error: bytecode image is truncated or has a corrupt layout");
+        return false;
+    }
+    auto entries = reinterpret_cast<const poolentry *>(mod->image + sizeof(header));
+    for(uint64_t i = 0; i < uint64_t(header.textcount) + header.symbolcount; i++)
+    {
+        poolentry entry = entries[i];
+        if(foreign)
+        {
+            entry.offset = __builtin_bswap32(entry.offset);
+            entry.length = __builtin_bswap32(entry.length);
+        }
+        if(entry.offset < tables_end or uint64_t(entry.offset) + entry.length >= header.codeoffset
+           or mod->image[entry.offset + entry.length] != 0)
+        {
+            puts("Error: bytecode image has a corrupt constant pool");
+            return false;
+        }
+    }
+    
+    if(header.version == BYTECODE_V1)
+    {
+        constpool pool;
+        for(uint64_t i = 0; i < uint64_t(header.textcount) + header.symbolcount; i++)
+        {
+            poolentry entry = entries[i];
+            if(foreign)
+                entry.offset = __builtin_bswap32(entry.offset);
+            std::string str((const char *)mod->image + entry.offset);
+            if(i < header.textcount)
+                pool.texts.push_back(str);
+            else
+                pool.symbols.push_back(str);
+        }
+        std::vector<uint8_t> v1(mod->image + header.codeoffset, mod->image + header.codeoffset + header.codesize);
+        std::vector<uint8_t> code;
+        uint32_t cachecount = 0;
+        if(!convert_bytecode(v1, &code, &cachecount))
+            return false;
+        auto image = build_image(code, pool, header.sourcehash, cachecount);
+        mod->unload();
+        mod->owned = std::move(image);
+        mod->image = mod->owned.data();
+        mod->imagesize = mod->owned.size();
+        return open_module(mod);
+    }
+    
+    mod->sourcehash = header.sourcehash;
+    mod->texts = entries;
+    mod->textcount = header.textcount;
+    mod->symbols = entries + header.textcount;
+    mod->symbolcount = header.symbolcount;
+    mod->code = mod->image + header.codeoffset;
+    mod->codesize = header.codesize;
+    mod->symbolids.resize(mod->symbolcount);
+    for(uint64_t i = 0; i < mod->symbolcount; i++)
+        mod->symbolids[i] = symtab.intern(mod->symbol(i));
+    mod->caches.assign(header.cachecount, fieldcache());
+    return true;
+}
+
+// loads a module from an image in memory, which it takes ownership of, and verifies it
+bool load_module(std::vector<uint8_t> image, module * mod)
+{
+    mod->unload();
+    mod->owned = std::move(image);
+    mod->image = mod->owned.data();
+    mod->imagesize = mod->owned.size();
+    if(!open_module(mod) or !verify_bytecode(mod))
+    {
+        mod->unload();
+        return false;
+    }
+    return true;
+}
+
+// maps a module file read-only and verifies it; the interpreter then runs straight out of the mapping
+bool map_module(const std::string & path, module * mod)
+{
+    mod->unload();
+#ifdef _WIN32
+    std::vector<uint8_t> image;
+    auto file = fopen(path.data(), "rb");
+    if(file == nullptr)
+        return false;
+    uint8_t buffer[4096];
+    size_t got;
+    while((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        image.insert(image.end(), buffer, buffer+got);
+    fclose(file);
+    return load_module(std::move(image), mod);
+#else
+    int fd = open(path.data(), O_RDONLY);
+    if(fd < 0)
+        return false;
+    struct stat info;
+    if(fstat(fd, &info) != 0 or info.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    void * mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+        return false;
+    mod->mapping = mapping;
+    mod->mappingsize = info.st_size;
+    mod->image = (const uint8_t *)mapping;
+    mod->imagesize = info.st_size;
+    if(!open_module(mod) or !verify_bytecode(mod))
+    {
+        mod->unload();
+        return false;
+    }
+    return true;
+#endif
+}
+
+// the same, but returning a module that can be shared between progstates, or nullptr on failure
+moduleref load_module(std::vector<uint8_t> image)
+{
+    auto mod = std::make_shared<module>();
+    if(!load_module(std::move(image), mod.get()))
+        return nullptr;
+    return mod;
+}
+moduleref map_module(const std::string & path)
+{
+    auto mod = std::make_shared<module>();
+    if(!map_module(path, mod.get()))
+        return nullptr;
+    return mod;
+}
+
+// the interpreter is instantiated twice: checked, which defends against malformed bytecode, and unchecked, which is only
+// run on bytecode that passed verify_bytecode() and skips the checks that the verifier already proved can't fail.
+// single runs just the instruction at pc, for the jit to hand instructions it has no code of its own for back to.
+bool run_hot_loop(progstate * program);
+
+template<bool checked, bool single = false>
+bool interpret_impl(progstate * program)
+{
+    if(program == nullptr)
+    {
+        puts("Program is nullptr");
+        return false;
+    }
+    if(!program->mod)
+    {
+        puts("Program has no code");
+        return false;
+    }
+    if(program->global == nullptr)
+    {
+        puts("Program has no context");
+        return false;
+    }
+    auto & global = *program->global;
+    auto & pc = program->pc;
+    // whoever hands the program its module keeps it alive for the run, and run_event() holds on to the module it
+    // swaps out, so this doesn't take a reference; every instance in a parallel pass would contend for the count
+    auto & mod = *program->mod;
+    auto bytecode = mod.code;
+    auto codesize = mod.codesize;
+    auto & variables = program->variables;
+    auto & truth_register = program->truth_register;
+    // top level declarations go in the root scope, so code run by an instance declares instance variables
+    if(variables.size() == 0)
+        variables.push_back({});
+    auto * valstack = &program->stack;
+    auto * varstack = &(variables.back());
+    auto & stackdepths = program->stackdepths;
+    auto & frames = program->frames;
+    auto framebase = frames.size(); // frames below this belong to whatever this run is nested in
+    auto & lvalue_islocal = program->lvalue_islocal;
+    auto & lvalue_id = program->lvalue_id;
+    auto & lvalue_symbol = program->lvalue_symbol;
+    uint64_t steps = 0;
+    while(1)
+    {
+        if(single and steps++ > 0)
+            return true;
+        if(pc == codesize)
+        {
+            return true;
+        }
+        //printf(">%08X\n", pc);
+        if(checked and pc > codesize)
+        {
+            puts("Flew out of program");
+            return false;
+        }
+        auto loc = pc;
+        auto opcode = bytecode[pc++];
+        switch(opcode)
+        {
+        case NOP:
+        {
+            break;
+        }
+        case PUSHVAL:
+        {
+            double value = decode_double(bytecode, pc);
+            valstack->push_back(value);
+            break;
+        }
+        case PUSHTEXT:
+        {
+            std::string_view text = mod.text(decode_u16(bytecode, pc));
+            
+            valstack->push_back(std::string(text));
+            break;
+        }
+        case PUSHVAR:
+        {
+            uint32_t symbol = mod.symbolids[decode_u16(bytecode, pc)];
+            
+            if(checked and variables.size() == 0)
+            {
+                puts("Internal error: no stack of variables");
+                exit(0);
+            }
+            if(program->self != 0 and is_builtin_field(symbol))
+            {
+                auto position = global.find_position(program->self);
+                if(position == globalstate::no_slot)
+                {
+                    puts("Error: instance being dereferenced does not exist");
+                    return false;
+                }
+                if(symbol == SYM_ID)
+                    valstack->push_back(program->self);
+                else
+                    valstack->push_back(*global.builtin(position, symbol));
+            }
+            else if(auto found = program->find_variable(symbol))
+            {
+                valstack->push_back(*found);
+            }
+            else
+            {
+                puts("Error: access of undeclared variable");
+                return false;
+            }
+            
+            break;
+        }
+        case POP:
+        {
+            if(checked and variables.size() == 0)
+            {
+                puts("Internal error: no stack of variables");
+                exit(0);
+            }
+            if(checked and valstack->size() < 1)
+            {
+                puts("Error: no value on the stack to pop");
+                return false;
+            }
+            valstack->pop_back();
+            
+            break;
+        }
+        case DECLARE:
+        {
+            uint32_t symbol = mod.symbolids[decode_u16(bytecode, pc)];
+            if(program->self != 0 and is_builtin_field(symbol))
+            {
+                puts("Error: declaration of built-in instance variable");
+                return false;
+            }
+            if(varstack->insert(symbol, 0) == nullptr)
+            {
+                puts("Error: redeclaration");
+                return false;
+            }
+            
+            break;
+        }
+        case DECLSET:
+        {
+            if(checked and valstack->size() < 1)
+            {
+                puts("Error: not enough arguments to compound declaration");
+                return false;
+            }
+            uint32_t symbol = mod.symbolids[decode_u16(bytecode, pc)];
+            if(program->self != 0 and is_builtin_field(symbol))
+            {
+                puts("Error: declaration of built-in instance variable");
+                return false;
+            }
+            if(varstack->find(symbol))
+            {
+                puts("Error: redeclaration");
+                return false;
+            }
+            else if(checked and valstack->size() < 1)
+            {
+                puts("Error: not enough arguments to declaration-assignment");
+                return false;
+            }
+            else
+            {
+                value right = valstack->back();
+                valstack->pop_back();
+                varstack->insert(symbol, right);
+            }
+            
+            break;
+        }
+        case BINOP:
+        {
+            if(checked and valstack->size() < 2)
+            {
+                puts("Error: not enough arguments to binary operation");
+                return false;
+            }
+            value right = valstack->back();
+            valstack->pop_back();
+            value left = valstack->back();
+            valstack->pop_back();
+            
+            if(right.is_number and left.is_number)
+            {
+                switch(bytecode[pc++])
+                {
+                case ADD:
+                {
+                    valstack->push_back(left.real+right.real);
+                    break;
+                }
+                case SUB:
+                {
+                    valstack->push_back(left.real-right.real);
+                    break;
+                }
+                case MUL:
+                {
+                    valstack->push_back(left.real*right.real);
+                    break;
+                }
+                case DIV:
+                {
+                    valstack->push_back(left.real/right.real);
+                    break;
+                }
+                case EQ:
+                {
+                    valstack->push_back(left.real==right.real);
+                    break;
+                }
+                case NEQ:
+                {
+                    valstack->push_back(left.real!=right.real);
+                    break;
+                }
+                case GTE:
+                {
+                    valstack->push_back(left.real>=right.real);
+                    break;
+                }
+                case LTE:
+                {
+                    valstack->push_back(left.real<=right.real);
+                    break;
+                }
+                case GT:
+                {
+                    valstack->push_back(left.real>right.real);
+                    break;
+                }
+                case LT:
+                {
+                    valstack->push_back(left.real<right.real);
+                    break;
+                }
+                case AND:
+                {
+                    valstack->push_back(left.real&&right.real);
+                    break;
+                }
+                case OR:
+                {
+                    valstack->push_back(left.real||right.real);
+                    break;
+                }
+                default:
+                printf("Unknown binary numeric operation 0x%02X at 0x%08X\n", bytecode[pc-1], unsigned(pc-1));
+                return false;
+                }
+            }
+            else if(!right.is_number and !left.is_number)
+            {
+                switch(bytecode[pc++])
+                {
+                case ADD:
+                {
+                    valstack->push_back(left.text+right.text);
+                    break;
+                }
+                case EQ:
+                {
+                    valstack->push_back(left.text==right.text);
+                    break;
+                }
+                case NEQ:
+                {
+                    valstack->push_back(left.text!=right.text);
+                    break;
+                }
+                default:
+                printf("Unknown binary string operation 0x%02X at 0x%08X\n", bytecode[pc-1], unsigned(pc-1));
+                return false;
+                }
+            }
+            else
+            {
+                printf("Error: tried to apply a binary operation to a string and a number at 0x%08X\n", unsigned(pc-1));
+                return false;
+            }
+            break;
+        }
+        case UNOP:
+        {
+            if(checked and valstack->size() < 1)
+            {
+                puts("Error: not enough arguments to unary operation");
+                return false;
+            }
+            value right = valstack->back();
+            valstack->pop_back();
+            
+            // TODO: Make negative operator reverse strings, maybe?
+            if(right.is_number)
+            {
+                switch(bytecode[pc++])
+                {
+                case POSITIVE:
+                {
+                    valstack->push_back(right);
+                    break;
+                }
+                case NEGATIVE:
+                {
+                    valstack->push_back(-right.real);
+                    break;
+                }
+                case NEGATION:
+                {
+                    valstack->push_back(!right.real);
+                    break;
+                }
+                default:
+                printf("Unknown unary numeric operation 0x%02X at 0x%08X\n", bytecode[pc-1], unsigned(pc-1));
+                return false;
+                }
+            }
+            else
+            {
+                printf("Error: tried to apply a unary operation to a string at 0x%08X\n", unsigned(pc-1));
+                return false;
+            }
+            
+            break;
+        }
+        case BINAS:
+        {
+            if(checked and valstack->size() < 1)
+            {
+                puts("Error: not enough arguments to binary assignment");
+                return false;
+            }
+            auto right = valstack->back();
+            valstack->pop_back();
+            
+            
+            
+            if(checked and lvalue_symbol == NO_SYMBOL)
+            {
+                puts("Internal error: no lvalue in binary assignment");
+                exit(0);
+            }
+            
+            value * lvalue = nullptr;
+            double * builtin = nullptr; // built-in variables are operated on in scratch, then stored back
+            value scratch;
+            if(lvalue_islocal)
+            {
+                if(checked and variables.size() == 0)
+                {
+                    puts("Internal error: tried operating on a zero-size stack of variable heaps");
+                    exit(0);
+                }
+                lvalue = program->find_variable(lvalue_symbol);
+            }
+            else if(is_builtin_field(lvalue_symbol))
+            {
+                auto position = global.find_position(lvalue_id);
+                if(position == globalstate::no_slot)
+                {
+                    puts("Error: instance being dereferenced does not exist");
+                    return false;
+                }
+                if(is_readonly_field(lvalue_symbol))
+                {
+                    puts("Error: assigning to read-only variable");
+                    return false;
+                }
+                if(program->view != nullptr and lvalue_id != program->self)
+                {
+                    // another instance's variable, written once the pass is over
+                    auto operation = bytecode[pc++];
+                    if(right.is_number)
+                        program->view->defer(lvalue_id, lvalue_symbol, operation, right.real);
+                    break;
+                }
+                builtin = global.builtin(position, lvalue_symbol);
+                scratch = value(*builtin);
+                lvalue = &scratch;
+            }
+            else
+            {
+                progstate * other;
+                lvalue = find_field(global, program->lvalue_cache, lvalue_id, lvalue_symbol, &other);
+                if(other == nullptr)
+                {
+                    puts("Error: instance being dereferenced does not exist");
+                    return false;
+                }
+            }
+            if(lvalue == nullptr)
+            {
+                puts("Error: assigning to undeclared variable");
+                return false;
+            }
+            
+            
+            
+            if(lvalue->is_number and right.is_number)
+            {
+                switch(bytecode[pc++])
+                {
+                case ASSIGN:
+                {
+                    *lvalue = right;
+                    break;
+                }
+                case MUTADD:
+                {
+                    lvalue->real += right.real;
+                    break;
+                }
+                case MUTSUB:
+                {
+                    lvalue->real -= right.real;
+                    break;
+                }
+                case MUTMUL:
+                {
+                    lvalue->real *= right.real;
+                    break;
+                }
+                case MUTDIV:
+                {
+                    lvalue->real /= right.real;
+                    break;
+                }
+                default:
+                printf("Unknown binary numeric assignment 0x%02X at 0x%08X\n", bytecode[pc-1], unsigned(pc-1));
+                return false;
+                }
+            }
+            else if(!lvalue->is_number and !right.is_number)
+            {
+                switch(bytecode[pc++])
+                {
+                case ASSIGN:
+                {
+                    *lvalue = right;
+                    break;
+                }
+                case MUTADD:
+                {
+                    lvalue->text += right.text;
+                    break;
+                }
+                default:
+                printf("Unknown binary assignment 0x%02X at 0x%08X\n", bytecode[pc-1], unsigned(pc-1));
+                return false;
+                }
+            }
+            else if(bytecode[pc] == ASSIGN and builtin == nullptr)
+            {
+                // plain assignment replaces the value, whatever type it had before
+                pc++;
+                *lvalue = right;
+            }
+            else
+            {
+                printf("Error: tried to apply a binary assignment to a string and a number at 0x%08X\n", unsigned(pc-1));
+                return false;
+            }
+            
+            if(builtin != nullptr)
+                *builtin = scratch.real;
+            
+            break;
+        }
+        case UNAS:
+        {
+            if(checked and lvalue_symbol == NO_SYMBOL)
+            {
+                puts("Internal error: no lvalue in binary assignment");
+                exit(0);
+            }
+            
+            value * lvalue = nullptr;
+            double * builtin = nullptr; // built-in variables are operated on in scratch, then stored back
+            value scratch;
+            if(lvalue_islocal)
+            {
+                if(checked and variables.size() == 0)
+                {
+                    puts("Internal error: tried operating on a zero-size stack of variable heaps");
+                    exit(0);
+                }
+                lvalue = program->find_variable(lvalue_symbol);
+            }
+            else if(is_builtin_field(lvalue_symbol))
+            {
+                auto position = global.find_position(lvalue_id);
+                if(position == globalstate::no_slot)
+                {
+                    puts("Error: instance being dereferenced does not exist");
+                    return false;
+                }
+                if(is_readonly_field(lvalue_symbol))
+                {
+                    puts("Error: assigning to read-only variable");
+                    return false;
+                }
+                if(program->view != nullptr and lvalue_id != program->self)
+                {
+                    auto operation = bytecode[pc++];
+                    if(checked and operation != INCREMENT and operation != DECREMENT)
+                    {
+                        printf("Unknown unary numeric assignment 0x%02X at 0x%08X\n", operation, unsigned(pc-1));
+                        return false;
+                    }
+                    program->view->defer(lvalue_id, lvalue_symbol, MUTADD, (operation == INCREMENT) ? 1 : -1);
+                    break;
+                }
+                builtin = global.builtin(position, lvalue_symbol);
+                scratch = value(*builtin);
+                lvalue = &scratch;
+            }
+            else
+            {
+                progstate * other;
+                lvalue = find_field(global, program->lvalue_cache, lvalue_id, lvalue_symbol, &other);
+                if(other == nullptr)
+                {
+                    puts("Error: instance being dereferenced does not exist");
+                    return false;
+                }
+            }
+            if(lvalue == nullptr)
+            {
+                puts("Error: assigning to undeclared variable");
+                return false;
+            }
+            
+            
+            if(lvalue->is_number)
+            {
+                switch(bytecode[pc++])
+                {
+                case INCREMENT:
+                {
+                    lvalue->real += 1;
+                    break;
+                }
+                case DECREMENT:
+                {
+                    lvalue->real -= 1;
+                    break;
+                }
+                default:
+                printf("Unknown unary numeric assignment 0x%02X at 0x%08X\n", bytecode[pc-1], unsigned(pc-1));
+                return false;
+                }
+            }
+            else
+            {
+                printf("Tried to apply unary numeric assignment to string at 0x%08X\n", unsigned(pc-1));
+                return false;
+            }
+            
+            if(builtin != nullptr)
+                *builtin = scratch.real;
+            
+            break;
+        }
+        // x = 7
+        // DIRECT x; BINAS ASSIGN 7
+        case DIRECT:
+        {
+            uint32_t symbol = mod.symbolids[decode_u16(bytecode, pc)];
+            
+            // an instance's own built-in variables are reached the same way as another instance's
+            lvalue_id = (is_builtin_field(symbol)) ? program->self : 0;
+            lvalue_islocal = (lvalue_id == 0);
+            lvalue_symbol = symbol;
+            
+            break;
+        }
+        // (10000).x
+        // only at the tail end of a left hand expression, the rest is INDEXP
+        case INDIRECT:
+        // indirection /expression/, as in it puts a value onto the stack
+        case INDEXP:
+        {
+            if(checked and valstack->size() < 1)
+            {
+                puts("Error: not enough arguments to lvalue indirection");
+                return false;
+            }
+            value lhs = valstack->back();
+            valstack->pop_back();
+            
+            if(!lhs.is_number)
+            {
+                puts("Error: left hand side of derefence is not a number");
+                return false;
+            }
+            
+            uint32_t symbol = mod.symbolids[decode_u16(bytecode, pc)];
+            auto cache = &mod.caches[decode_u16(bytecode, pc)];
+            
+            if(is_builtin_field(symbol))
+            {
+                auto position = global.find_position(lhs.real);
+                if(position == globalstate::no_slot)
+                {
+                    puts("Error: attempt to dereference non-existent object");
+                    return false;
+                }
+                if(opcode == INDIRECT)
+                {
+                    lvalue_id = lhs.real;
+                    lvalue_symbol = symbol;
+                    lvalue_islocal = false;
+                }
+                else if(symbol == SYM_ID)
+                    valstack->push_back(lhs.real);
+                else if(program->view != nullptr and lhs.real != program->self and symbol != SYM_OBJECT_ID)
+                    // object_id doesn't change during a pass, so only x and y are read from the snapshot
+                    valstack->push_back((symbol == SYM_X) ? program->view->xs[position] : program->view->ys[position]);
+                else
+                    valstack->push_back(*global.builtin(position, symbol));
+                break;
+            }
+            
+            progstate * other;
+            auto found = find_field(global, cache, lhs.real, symbol, &other);
+            if(other == nullptr)
+            {
+                puts("Error: attempt to dereference non-existent object");
+                return false;
+            }
+            
+            if(opcode == INDIRECT)
+            {
+                lvalue_id = lhs.real;
+                lvalue_symbol = symbol;
+                lvalue_islocal = false;
+                program->lvalue_cache = cache;
+            }
+            else
+            {
+                if(found)
+                    valstack->push_back(*found);
+                else
+                {
+                    puts("Error: instance contains no such variable");
+                    return false;
+                }
+            }
+            
+            break;
+        }
+        case TRUTH:
+        {
+            if(checked and valstack->size() < 1)
+            {
+                puts("Error: not enough arguments to set truth register");
+                return false;
+            }
+            value truth = valstack->back();
+            valstack->pop_back();
+            
+            if(truth.is_number)
+            {
+                truth_register = !!truth.real;
+            }
+            else
+            {
+                puts("Error: tried to take truth of string");
+                return false;
+            }
+            
+            break;
+        }
+        // the operands are numbers, so they're worked on where they are on the stack
+        case NUMBINOP:
+        {
+            if(checked and valstack->size() < 2)
+            {
+                puts("Error: not enough arguments to binary operation");
+                return false;
+            }
+            double right = valstack->back().real;
+            valstack->pop_back();
+            auto & left = valstack->back().real;
+            left = fold_binop(bytecode[pc++], left, right);
+            break;
+        }
+        case NUMUNOP:
+        {
+            if(checked and valstack->size() < 1)
+            {
+                puts("Error: not enough arguments to unary operation");
+                return false;
+            }
+            auto & right = valstack->back().real;
+            right = fold_unop(bytecode[pc++], right);
+            break;
+        }
+        case NUMTRUTH:
+        {
+            if(checked and valstack->size() < 1)
+            {
+                puts("Error: not enough arguments to set truth register");
+                return false;
+            }
+            truth_register = !!valstack->back().real;
+            valstack->pop_back();
+            break;
+        }
+        case OPENSCOPE:
+        {
+            program->open_scope();
+            varstack = &variables.back();
+            
+            break;
+        }
+        case EXITSCOPE:
+        {
+            program->close_scopes(variables.size()-1);
+            varstack = &variables.back();
+            
+            break;
+        }
+        case SAVESCOPE:
+        {
+            stackdepths.push_back(variables.size());
+            break;
+        }
+        case LOADSCOPE:
+        {
+            program->close_scopes(stackdepths.back());
+            stackdepths.pop_back();
+            
+            varstack = &variables.back();
+            
+            break;
+        }
+        case BREAK:
+        {
+            program->close_scopes(stackdepths.back());
+            stackdepths.pop_back();
+            
+            varstack = &variables.back();
+            
+            int64_t offset = decode_i64(bytecode, pc);
+            
+            pc = loc+offset;
+            
+            if(!checked and !single and offset < 0 and global.tracing)
+            {
+                if(!run_hot_loop(program))
+                    return false;
+                varstack = &variables.back();
+            }
+            
+            break;
+        }
+        case JSIT:
+        case JSIF:
+        case JS:
+        {
+            int16_t offset = decode_i16(bytecode, pc);
+            
+            if(opcode == JSIT)
+            {
+                if(truth_register)
+                    pc = loc+offset;
+            }
+            else if(opcode == JSIF)
+            {
+                if(!truth_register)
+                    pc = loc+offset;
+            }
+            else
+            {
+                pc = loc+offset;
+                if(!checked and !single and offset < 0 and global.tracing)
+                {
+                    if(!run_hot_loop(program))
+                        return false;
+                    varstack = &variables.back();
+                }
+            }
+            
+            break;
+        }
+        case JLIT:
+        case JLIF:
+        case JL:
+        {
+            int64_t offset = decode_i64(bytecode, pc);
+            
+            if(opcode == JLIT)
+            {
+                if(truth_register)
+                    pc = loc+offset;
+            }
+            else if(opcode == JLIF)
+            {
+                if(!truth_register)
+                    pc = loc+offset;
+            }
+            else
+            {
+                pc = loc+offset;
+                if(!checked and !single and offset < 0 and global.tracing)
+                {
+                    if(!run_hot_loop(program))
+                        return false;
+                    varstack = &variables.back();
+                }
+            }
+            
+            break;
+        }
+        case CALL:
+        case TAILCALL:
+        {
+            auto symbol = decode_u16(bytecode, pc);
+            uint8_t args = bytecode[pc++];
+            if(checked and valstack->size() < args)
+            {
+                puts("Error: function call uses more arguments than are on stack");
+                return false;
+            }
+            auto function = (!checked or symbol < mod.function_of.size()) ? mod.function_of[symbol] : NO_FUNCTION;
+            if(function != NO_FUNCTION)
+            {
+                auto & callee = mod.functions[function];
+                if(checked and args != callee.arity)
+                {
+                    printf("Error: wrong number of arguments to function \"%s\"\n", mod.symbol(symbol).data());
+                    return false;
+                }
+                // a tail call in a function reuses its frame, so recursion through tail calls runs in constant space
+                if(opcode == TAILCALL and frames.size() > framebase)
+                {
+                    program->replace_frame(args);
+                    stackdepths.resize(frames.back().depths);
+                    varstack = &variables.back();
+                    pc = callee.entry;
+                    break;
+                }
+                if(frames.size() >= progstate::max_frames)
+                {
+                    puts("Error: call stack overflow");
+                    return false;
+                }
+                frames.push_back({pc, uint32_t(variables.size()), uint32_t(stackdepths.size()), program->framescope});
+                // the arguments stay where they are, as the bottom of the callee's first scope
+                program->framescope = variables.size();
+                program->open_scope();
+                variables.back().stackbase -= args;
+                varstack = &variables.back();
+                pc = callee.entry;
+                break;
+            }
+            nativefunction native;
+            if(!checked)
+                native = mod.natives[symbol];
+            else
+            {
+                // unverified code hasn't been linked, so look the builtin up by name
+                auto found = builtins.find(mod.symbolids[symbol]);
+                if(found.function == nullptr)
+                {
+                    printf("Error: unknown function \"%s\"\n", mod.symbol(symbol).data());
+                    return false;
+                }
+                if(args != found.arity)
+                {
+                    printf("Error: wrong number of arguments to function \"%s\"\n", mod.symbol(symbol).data());
+                    return false;
+                }
+                native = found.function;
+            }
+            // the arguments are read where they are, then replaced by the result
+            value result;
+            if(!native(program, valstack->data() + valstack->size() - args, &result))
+                return false;
+            valstack->resize(valstack->size() - args);
+            valstack->push_back(std::move(result));
+            // builtins can end up running events on this same state, so the scope vector may have moved
+            varstack = &variables.back();
+            break;
+        }
+        // the body was already found when the module was verified, so defining a function is just skipping it
+        case FUNCDEF:
+        {
+            pc = loc + decode_i64(bytecode, pc);
+            break;
+        }
+        case RETURN:
+        {
+            if(checked and valstack->size() < 1)
+            {
+                puts("Error: no value to return");
+                return false;
+            }
+            value result = std::move(valstack->back());
+            valstack->pop_back();
+            if(frames.size() == framebase)
+                return true;
+            auto frame = frames.back();
+            frames.pop_back();
+            program->close_scopes(frame.scopes);
+            stackdepths.resize(frame.depths);
+            program->framescope = frame.framescope;
+            pc = frame.returnpc;
+            valstack->push_back(std::move(result));
+            varstack = &variables.back();
+            break;
+        }
+        default:
+        printf("Unknown instruction 0x%02X at 0x%08X\n", bytecode[pc-1], unsigned(pc-1));
+        exit(0);
+        return false;
+        }
+    }
+}
+
+// the baseline jit. a verified module is translated instruction by instruction into x86-64 code: branches become
+// native jumps on the truth register, and every other instruction becomes a call to a runtime helper (below) with its
+// operands decoded ahead of time as immediates, so nothing is decoded or dispatched while the code runs. helpers take
+// the fast path for the common cases (numbers, local variables) and hand anything else, like string operations and
+// other instances' fields, to the interpreter one instruction at a time with jit_step(). code returning into a
+// function goes through the table of instruction addresses.
+// helpers can't throw through the generated code, which has no unwind information.
+struct jitframe
+{
+    progstate * program;
+    const module * mod;
+    const jitcode * code;
+    bool * truth; // the program's truth register, which compiled branches test directly
+    uint64_t framebase; // frames below this belong to whatever this run is nested in
+    bool finished; // set when a helper stops the run because the program ended rather than failed
+};
+
+bool jit_step(jitframe * f, uint64_t loc)
+{
+    f->program->pc = loc;
+    return interpret_impl<false, true>(f->program);
+}
+
+void jit_pushval(jitframe * f, uint64_t bits)
+{
+    double number;
+    memcpy(&number, &bits, sizeof(double));
+    f->program->stack.emplace_back(number);
+}
+
+bool jit_pushvar(jitframe * f, uint64_t symbol, uint64_t loc)
+{
+    auto program = f->program;
+    if(program->self != 0 and is_builtin_field(symbol))
+        return jit_step(f, loc);
+    if(auto found = program->find_variable(symbol))
+    {
+        program->stack.push_back(*found);
+        return true;
+    }
+    puts("Error: access of undeclared variable");
+    return false;
+}
+
+void jit_pop(jitframe * f)
+{
+    f->program->stack.pop_back();
+}
+
+bool jit_declset(jitframe * f, uint64_t symbol)
+{
+    auto program = f->program;
+    if(program->self != 0 and is_builtin_field(symbol))
+    {
+        puts("Error: declaration of built-in instance variable");
+        return false;
+    }
+    auto & top = program->variables.back();
+    if(top.find(symbol))
+    {
+        puts("Error: redeclaration");
+        return false;
+    }
+    top.insert(symbol, std::move(program->stack.back()));
+    program->stack.pop_back();
+    return true;
+}
+
+bool jit_binop(jitframe * f, uint64_t operation, uint64_t loc)
+{
+    auto & stack = f->program->stack;
+    auto & left = stack[stack.size()-2];
+    auto & right = stack.back();
+    if(!left.is_number or !right.is_number)
+        return jit_step(f, loc);
+    double l = left.real, r = right.real;
+    switch(operation)
+    {
+    case ADD: left.real = l+r; break;
+    case SUB: left.real = l-r; break;
+    case MUL: left.real = l*r; break;
+    case DIV: left.real = l/r; break;
+    case EQ:  left.real = l==r; break;
+    case NEQ: left.real = l!=r; break;
+    case GTE: left.real = l>=r; break;
+    case LTE: left.real = l<=r; break;
+    case GT:  left.real = l>r; break;
+    case LT:  left.real = l<r; break;
+    case AND: left.real = l&&r; break;
+    case OR:  left.real = l||r; break;
+    default: return jit_step(f, loc);
+    }
+    stack.pop_back();
+    return true;
+}
+
+// the optimizer proved both operands are numbers
+void jit_numbinop(jitframe * f, uint64_t operation)
+{
+    auto & stack = f->program->stack;
+    double right = stack.back().real;
+    stack.pop_back();
+    stack.back().real = fold_binop(operation, stack.back().real, right);
+}
+
+void jit_direct(jitframe * f, uint64_t symbol)
+{
+    auto program = f->program;
+    program->lvalue_id = (is_builtin_field(symbol)) ? program->self : 0;
+    program->lvalue_islocal = (program->lvalue_id == 0);
+    program->lvalue_symbol = symbol;
+}
+
+bool jit_binas(jitframe * f, uint64_t operation, uint64_t loc)
+{
+    auto program = f->program;
+    if(!program->lvalue_islocal)
+        return jit_step(f, loc);
+    auto lvalue = program->find_variable(program->lvalue_symbol);
+    auto & right = program->stack.back();
+    if(lvalue == nullptr or !lvalue->is_number or !right.is_number)
+        return jit_step(f, loc);
+    switch(operation)
+    {
+    case ASSIGN: lvalue->real = right.real; break;
+    case MUTADD: lvalue->real += right.real; break;
+    case MUTSUB: lvalue->real -= right.real; break;
+    case MUTMUL: lvalue->real *= right.real; break;
+    case MUTDIV: lvalue->real /= right.real; break;
+    default: return jit_step(f, loc);
+    }
+    program->stack.pop_back();
+    return true;
+}
+
+bool jit_truth(jitframe * f)
+{
+    auto & stack = f->program->stack;
+    if(!stack.back().is_number)
+    {
+        puts("Error: tried to take truth of string");
+        return false;
+    }
+    *f->truth = !!stack.back().real;
+    stack.pop_back();
+    return true;
+}
+
+void jit_numtruth(jitframe * f)
+{
+    auto & stack = f->program->stack;
+    *f->truth = !!stack.back().real;
+    stack.pop_back();
+}
+
+void jit_openscope(jitframe * f)
+{
+    f->program->open_scope();
+}
+void jit_exitscope(jitframe * f)
+{
+    f->program->close_scopes(f->program->variables.size()-1);
+}
+void jit_savescope(jitframe * f)
+{
+    f->program->stackdepths.push_back(f->program->variables.size());
+}
+// also the unwinding half of BREAK
+void jit_loadscope(jitframe * f)
+{
+    auto program = f->program;
+    program->close_scopes(program->stackdepths.back());
+    program->stackdepths.pop_back();
+}
+
+enum : uint64_t {
+    NO_PC = 0xFFFFFFFFFFFFFFFF,
+};
+
+// CALL and TAILCALL; returns the bytecode position to go on from, or NO_PC on an error
+uint64_t jit_call_pc(jitframe * f, uint64_t symbol, uint64_t args, uint64_t next)
+{
+    auto program = f->program;
+    auto & mod = *f->mod;
+    bool tail = args >> 8;
+    args &= 0xFF;
+    auto function = mod.function_of[symbol];
+    if(function != NO_FUNCTION)
+    {
+        auto & callee = mod.functions[function];
+        if(tail and program->frames.size() > f->framebase)
+        {
+            program->replace_frame(args);
+            program->stackdepths.resize(program->frames.back().depths);
+            return callee.entry;
+        }
+        if(program->frames.size() >= progstate::max_frames)
+        {
+            puts("Error: call stack overflow");
+            return NO_PC;
+        }
+        program->frames.push_back({next, uint32_t(program->variables.size()), uint32_t(program->stackdepths.size()), program->framescope});
+        program->framescope = program->variables.size();
+        program->open_scope();
+        program->variables.back().stackbase -= args;
+        return callee.entry;
+    }
+    auto & stack = program->stack;
+    value result;
+    if(!mod.natives[symbol](program, stack.data() + stack.size() - args, &result))
+        return NO_PC;
+    stack.resize(stack.size() - args);
+    stack.push_back(std::move(result));
+    return next;
+}
+
+// returns the bytecode position to go on from, or NO_PC if the program ended
+uint64_t jit_return_pc(jitframe * f)
+{
+    auto program = f->program;
+    value result = std::move(program->stack.back());
+    program->stack.pop_back();
+    if(program->frames.size() == f->framebase)
+    {
+        f->finished = true;
+        return NO_PC;
+    }
+    auto frame = program->frames.back();
+    program->frames.pop_back();
+    program->close_scopes(frame.scopes);
+    program->stackdepths.resize(frame.depths);
+    program->framescope = frame.framescope;
+    program->stack.push_back(std::move(result));
+    return frame.returnpc;
+}
+
+// the same for machine code: returns where to go next, or nullptr to stop
+const uint8_t * jit_call(jitframe * f, uint64_t symbol, uint64_t args, uint64_t next)
+{
+    auto pc = jit_call_pc(f, symbol, args, next);
+    return (pc == NO_PC) ? nullptr : f->code->addresses[pc];
+}
+const uint8_t * jit_return(jitframe * f)
+{
+    auto pc = jit_return_pc(f);
+    return (pc == NO_PC) ? nullptr : f->code->addresses[pc];
+}
+
+#ifdef NOTGML_JIT
+// just enough of an x86-64 assembler for jit_compile(). the generated code keeps the jitframe in rbx and the address
+// of the truth register in r12.
+struct jitassembler
+{
+    std::vector<uint8_t> out;
+    std::vector<std::pair<uint64_t, uint64_t>> fixups; // rel32 field, bytecode position it jumps to
+    
+    void bytes(std::initializer_list<uint8_t> list)
+    {
+        out.insert(out.end(), list);
+    }
+    void imm32(uint32_t value)
+    {
+        for(int i = 0; i < 4; i++)
+            out.push_back(value >> (8*i));
+    }
+    void imm64(uint64_t value)
+    {
+        for(int i = 0; i < 8; i++)
+            out.push_back(value >> (8*i));
+    }
+    // rel32 to a position in the generated code
+    void rel32(uint64_t target)
+    {
+        imm32(uint32_t(int64_t(target) - int64_t(out.size()+4)));
+    }
+    // rel32 to the code of a bytecode position, filled in once all the code is laid out
+    void rel32_pc(uint64_t pc)
+    {
+        fixups.push_back({out.size(), pc});
+        imm32(0);
+    }
+    // helper(frame, args...), with up to three integer arguments
+    template<typename F>
+    void call(F * helper, std::initializer_list<uint64_t> args = {})
+    {
+        static const uint8_t registers[] = {0xBE, 0xBA, 0xB9}; // rsi, rdx, rcx
+        bytes({0x48, 0x89, 0xDF}); // mov rdi, rbx
+        int i = 0;
+        for(auto arg : args)
+        {
+            bytes({0x48, registers[i++]}); // mov reg, imm64
+            imm64(arg);
+        }
+        bytes({0x48, 0xB8}); // mov rax, imm64
+        imm64(uint64_t(helper));
+        bytes({0xFF, 0xD0}); // call rax
+    }
+    // after a helper returning bool: stop the run if it failed
+    void check(uint64_t fail)
+    {
+        bytes({0x84, 0xC0}); // test al, al
+        bytes({0x0F, 0x84}); // jz fail
+        rel32(fail);
+    }
+    // after a helper returning where to go next: go there, or stop the run on nullptr
+    void dispatch(uint64_t leave)
+    {
+        bytes({0x48, 0x85, 0xC0}); // test rax, rax
+        bytes({0x0F, 0x84}); // jz leave
+        rel32(leave);
+        bytes({0xFF, 0xE0}); // jmp rax
+    }
+    void epilogue()
+    {
+        bytes({0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3}); // pop r13; pop r12; pop rbx; ret
+    }
+    // prefix 0F op between two xmm registers, for the SSE2 scalar double instructions compile_trace() uses
+    void sse(uint8_t prefix, uint8_t op, int reg, int rm)
+    {
+        out.push_back(prefix);
+        if(reg >= 8 or rm >= 8)
+            out.push_back(0x40 | (reg >= 8 ? 4 : 0) | (rm >= 8 ? 1 : 0));
+        bytes({0x0F, op, uint8_t(0xC0 | (reg&7)<<3 | (rm&7))});
+    }
+    // the same with a memory operand at [rip+disp32]; returns where the disp32 is, for the caller to fill in
+    uint64_t sse_rip(uint8_t prefix, uint8_t op, int reg)
+    {
+        out.push_back(prefix);
+        if(reg >= 8)
+            out.push_back(0x44);
+        bytes({0x0F, op, uint8_t((reg&7)<<3 | 5)});
+        auto position = out.size();
+        imm32(0);
+        return position;
+    }
+};
+#endif
+
+// translates a verified module into machine code. instructions the jit has no code for run through jit_step(); a
+// module with an instruction it doesn't know at all, or on a platform it doesn't support, gets a jitcode with no entry
+// point and is interpreted instead.
+jitcode * jit_compile(const module & mod)
+{
+    auto code = new jitcode;
+#ifdef NOTGML_JIT
+    auto bytecode = mod.code;
+    auto codesize = mod.codesize;
+    jitassembler a;
+    
+    // entry(frame, start): saves the registers it uses, keeping the stack 16-byte aligned for calls, and jumps in
+    a.bytes({0x53, 0x41, 0x54, 0x41, 0x55}); // push rbx; push r12; push r13
+    a.bytes({0x48, 0x89, 0xFB}); // mov rbx, rdi
+    a.bytes({0x4C, 0x8B, 0x63, uint8_t(offsetof(jitframe, truth))}); // mov r12, [rbx+truth]
+    a.bytes({0xFF, 0xE6}); // jmp rsi
+    auto leave = a.out.size();
+    a.bytes({0x0F, 0xB6, 0x43, uint8_t(offsetof(jitframe, finished))}); // movzx eax, byte [rbx+finished]
+    a.epilogue();
+    auto fail = a.out.size();
+    a.bytes({0x31, 0xC0}); // xor eax, eax
+    a.epilogue();
+    auto done = a.out.size();
+    a.bytes({0xB8}); // mov eax, 1
+    a.imm32(1);
+    a.epilogue();
+    
+    std::vector<int64_t> offsets(codesize+1, -1);
+    offsets[codesize] = done;
+    uint64_t pc = 0;
+    while(pc < codesize)
+    {
+        auto loc = pc;
+        auto opcode = bytecode[pc++];
+        offsets[loc] = a.out.size();
+        switch(opcode)
+        {
+        case NOP:
+            break;
+        case PUSHVAL:
+        {
+            double number = decode_double(bytecode, pc);
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(double));
+            a.call(jit_pushval, {bits});
+            break;
+        }
+        case PUSHVAR:
+            a.call(jit_pushvar, {mod.symbolids[decode_u16(bytecode, pc)], loc});
+            a.check(fail);
+            break;
+        case POP:
+            a.call(jit_pop);
+            break;
+        case DECLSET:
+            a.call(jit_declset, {mod.symbolids[decode_u16(bytecode, pc)]});
+            a.check(fail);
+            break;
+        case BINOP:
+            a.call(jit_binop, {bytecode[pc++], loc});
+            a.check(fail);
+            break;
+        case DIRECT:
+            a.call(jit_direct, {mod.symbolids[decode_u16(bytecode, pc)]});
+            break;
+        case BINAS:
+            a.call(jit_binas, {bytecode[pc++], loc});
+            a.check(fail);
+            break;
+        case TRUTH:
+            a.call(jit_truth);
+            a.check(fail);
+            break;
+        case NUMBINOP:
+            a.call(jit_numbinop, {bytecode[pc++]});
+            break;
+        case NUMTRUTH:
+            a.call(jit_numtruth);
+            break;
+        case OPENSCOPE:
+            a.call(jit_openscope);
+            break;
+        case EXITSCOPE:
+            a.call(jit_exitscope);
+            break;
+        case SAVESCOPE:
+            a.call(jit_savescope);
+            break;
+        case LOADSCOPE:
+            a.call(jit_loadscope);
+            break;
+        case BREAK:
+        {
+            int64_t offset = decode_i64(bytecode, pc);
+            a.call(jit_loadscope);
+            a.bytes({0xE9}); // jmp
+            a.rel32_pc(loc+offset);
+            break;
+        }
+        case JSIT:
+        case JSIF:
+        case JS:
+        case JLIT:
+        case JLIF:
+        case JL:
+        {
+            int64_t offset = (opcode == JSIT or opcode == JSIF or opcode == JS) ? decode_i16(bytecode, pc) : decode_i64(bytecode, pc);
+            if(opcode == JS or opcode == JL)
+                a.bytes({0xE9}); // jmp
+            else
+            {
+                a.bytes({0x41, 0x80, 0x3C, 0x24, 0x00}); // cmp byte [r12], 0
+                if(opcode == JSIT or opcode == JLIT)
+                    a.bytes({0x0F, 0x85}); // jnz
+                else
+                    a.bytes({0x0F, 0x84}); // jz
+            }
+            a.rel32_pc(loc+offset);
+            break;
+        }
+        case FUNCDEF:
+        {
+            int64_t length = decode_i64(bytecode, pc);
+            a.bytes({0xE9}); // jmp
+            a.rel32_pc(loc+length);
+            break;
+        }
+        case CALL:
+        case TAILCALL:
+        {
+            auto symbol = decode_u16(bytecode, pc);
+            uint64_t args = bytecode[pc++];
+            if(opcode == TAILCALL)
+                args |= 0x100;
+            a.call(jit_call, {symbol, args, loc+aligned_layout_size(opcode, loc)});
+            a.dispatch(leave);
+            break;
+        }
+        case RETURN:
+            a.call(jit_return);
+            a.dispatch(leave);
+            break;
+        // rare enough, or with enough cases, that the interpreter can have them
+        case PUSHTEXT:
+        case DECLARE:
+        case UNOP:
+        case NUMUNOP:
+        case INDIRECT:
+        case INDEXP:
+        case UNAS:
+            a.call(jit_step, {loc});
+            a.check(fail);
+            break;
+        default:
+            return code;
+        }
+        pc = loc+aligned_layout_size(opcode, loc);
+    }
+    // running off the end finishes the program
+    a.bytes({0xE9}); // jmp
+    a.rel32(done);
+    for(auto & fixup : a.fixups)
+    {
+        uint32_t rel = uint32_t(offsets[fixup.second] - int64_t(fixup.first+4));
+        memcpy(&a.out[fixup.first], &rel, 4);
+    }
+    
+    auto size = (a.out.size() + 4095) & ~uint64_t(4095);
+    void * memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED)
+        return code;
+    memcpy(memory, a.out.data(), a.out.size());
+    if(mprotect(memory, size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, size);
+        return code;
+    }
+    code->memory = (uint8_t *)memory;
+    code->size = size;
+    code->addresses.assign(codesize+1, nullptr);
+    for(uint64_t i = 0; i <= codesize; i++)
+    {
+        if(offsets[i] >= 0)
+            code->addresses[i] = code->memory + offsets[i];
+    }
+    code->enter = (bool (*)(jitframe *, const uint8_t *))code->memory;
+#endif
+    return code;
+}
+
+// the module's machine code, compiling it if nobody has yet, or nullptr if it can't be compiled
+const jitcode * jit_code(const module & mod)
+{
+    auto code = mod.jitted.load(std::memory_order_acquire);
+    if(code == nullptr)
+    {
+        auto fresh = jit_compile(mod);
+        // whoever loses a race to compile it throws their copy away
+        if(mod.jitted.compare_exchange_strong(code, fresh, std::memory_order_acq_rel))
+            code = fresh;
+        else
+            delete fresh;
+    }
+    return code->enter ? code : nullptr;
+}
+
+bool interpret_jit(progstate * program, const jitcode * code)
+{
+    if(program->variables.size() == 0)
+        program->variables.push_back({});
+    jitframe frame = {program, program->mod.get(), code, &program->truth_register, program->frames.size(), false};
+    return code->enter(&frame, code->addresses[program->pc]);
+}
+
+// the tracing jit. the interpreter counts how often it jumps back to the head of each loop, and once a loop is hot it
+// records one iteration of it (record_trace()): the arithmetic the body does on numbers and which way each branch
+// went. compile_trace() turns that into machine code that keeps the loop's variables in registers and checks their
+// types once on the way in, since nothing in a trace can change them; a branch going the other way leaves the trace
+// and the interpreter carries on from there. only loop bodies that stick to reading and assigning numbers in
+// variables declared outside the loop are traced, anything else just stays interpreted.
+
+#ifdef NOTGML_JIT
+enum {
+    TRACE_CONST,
+    TRACE_VAR,
+    TRACE_BINOP,
+    TRACE_UNOP,
+    
+    TRACE_STORE,
+    TRACE_GUARD,
+};
+
+// a number computed in a recorded iteration: a constant, a variable as it is when the node is used, or an operation
+// on two nodes (one for TRACE_UNOP)
+struct tracenode
+{
+    uint8_t kind;
+    uint8_t op;
+    uint32_t left; // the variable, for TRACE_VAR
+    uint32_t right;
+    double number;
+};
+
+// something a recorded iteration did with a node: assigned it to a variable, or branched on it
+struct tracestep
+{
+    uint8_t kind;
+    uint8_t op; // ASSIGN, MUTADD...
+    uint32_t variable;
+    uint32_t node;
+    bool expected; // the truth the branch was taken on when the loop was recorded
+    uint32_t exit;
+};
+
+struct tracerecording
+{
+    std::vector<tracenode> nodes;
+    std::vector<tracestep> steps;
+    std::vector<uint32_t> symbols;
+    std::vector<traceexit> exits;
+    bool builtin_names = false;
+};
+
+enum {
+    max_trace_variables = 8, // one register each
+    max_trace_length = 1000, // instructions in a recorded iteration
+};
+
+enum {
+    RECORD_DONE,
+    RECORD_UNTRACEABLE,
+    RECORD_ERROR,
+};
+
+double trace_fold(uint8_t kind, uint8_t op, double left, double right)
+{
+    return (kind == TRACE_UNOP) ? fold_unop(op, left) : fold_binop(op, left, right);
+}
+
+// runs one iteration of the loop at the program's pc one instruction at a time, recording what it does. the program
+// really runs, so whatever happens it's left wherever it got to, for the interpreter to carry on from.
+int record_trace(progstate * program, tracerecording * out)
+{
+    auto & mod = *program->mod;
+    auto bytecode = mod.code;
+    auto head = program->pc;
+    auto depth = program->variables.size();
+    auto saved = program->stackdepths.size();
+    auto height = program->stack.size();
+    
+    std::vector<uint32_t> operands; // the value stack above height, as nodes
+    int64_t truth = -1; // the node the truth register was last set from
+    int64_t lvalue = -1; // the variable the lvalue registers last pointed at
+    
+    auto variable = [&](uint32_t symbol) -> int64_t
+    {
+        if(is_builtin_field(symbol))
+        {
+            if(program->self != 0)
+                return -1;
+            out->builtin_names = true;
+        }
+        auto found = program->find_variable(symbol);
+        if(found == nullptr or !found->is_number)
+            return -1;
+        for(uint64_t i = 0; i < out->symbols.size(); i++)
+        {
+            if(out->symbols[i] == symbol)
+                return i;
+        }
+        if(out->symbols.size() == max_trace_variables)
+            return -1;
+        out->symbols.push_back(symbol);
+        return out->symbols.size()-1;
+    };
+    auto node = [&](tracenode n) -> uint32_t
+    {
+        out->nodes.push_back(n);
+        return out->nodes.size()-1;
+    };
+    
+    for(uint64_t length = 0; length < max_trace_length; length++)
+    {
+        auto loc = program->pc;
+        if(loc >= mod.codesize)
+            return RECORD_UNTRACEABLE;
+        auto opcode = bytecode[loc];
+        uint64_t pc = loc+1;
+        switch(opcode)
+        {
+        case NOP:
+        case EXITSCOPE:
+        case SAVESCOPE:
+        case LOADSCOPE:
+        case BREAK:
+        case JS:
+        case JL:
+            break;
+        case OPENSCOPE:
+            if(operands.size() != 0)
+                return RECORD_UNTRACEABLE;
+            break;
+        case PUSHVAL:
+            operands.push_back(node({TRACE_CONST, 0, 0, 0, decode_double(bytecode, pc)}));
+            break;
+        case PUSHVAR:
+        {
+            auto found = variable(mod.symbolids[decode_u16(bytecode, pc)]);
+            if(found < 0)
+                return RECORD_UNTRACEABLE;
+            operands.push_back(node({TRACE_VAR, 0, uint32_t(found), 0, 0}));
             break;
         }
-        case UNAS:
+        case POP:
+            if(operands.size() == 0)
+                return RECORD_UNTRACEABLE;
+            operands.pop_back();
+            break;
+        case BINOP:
+        case UNOP:
+        case NUMBINOP:
+        case NUMUNOP:
         {
-            if(lvalue_name == "")
-            {
-                puts("Internal error: no lvalue in binary assignment");
-                exit(0);
-            }
-            
-            value * lvalue = nullptr;
-            if(lvalue_islocal)
-            {
-                if(variables.size() == 0)
-                {
-                    puts("Internal error: tried operating on a zero-size stack of variable heaps");
-                    exit(0);
-                }
-                auto varstack_current = variables.size()-1;
-                while(variables[varstack_current].count(lvalue_name) == 0 and varstack_current > 0)
-                    varstack_current--;
-                auto & vstack = variables[varstack_current];
-                if(vstack.count(lvalue_name))
-                    lvalue = &(vstack[lvalue_name]);
-            }
-            else
-            {
-                if(!global.instances.count(lvalue_id))
-                {
-                    puts("Error: instance being dereferenced does not exist");
-                    break;
-                }
-                auto other = global.instances[lvalue_id];
-                if(other->variables.size() == 0)
-                {
-                    puts("Internal error: tried operating on a zero-size stack of variable heaps");
-                    exit(0);
-                }
-                auto varstack_current = other->variables.size()-1;
-                while(other->variables[varstack_current].count(lvalue_name) == 0 and varstack_current > 0)
-                    varstack_current--;
-                auto & vstack = other->variables[varstack_current];
-                if(vstack.count(lvalue_name))
-                    lvalue = &(vstack[lvalue_name]);
-            }
-            if(lvalue == nullptr)
-            {
-                puts("Error: assigning to undeclared variable");
-                break;
-            }
-            
-            
-            if(lvalue->is_number)
-            {
-                switch(bytecode[pc++])
-                {
-                case INCREMENT:
-                {
-                    lvalue->real += 1;
-                    break;
-                }
-                case DECREMENT:
-                {
-                    lvalue->real -= 1;
-                    break;
-                }
-                default:
-                printf("Unknown unary numeric assignment 0x%02X at 0x%08X\n", bytecode[pc-1], pc-1);
-                return;
-                }
-            }
+            bool binary = (opcode == BINOP or opcode == NUMBINOP);
+            uint8_t kind = binary ? TRACE_BINOP : TRACE_UNOP;
+            uint64_t count = binary ? 2 : 1;
+            if(operands.size() < count)
+                return RECORD_UNTRACEABLE;
+            uint32_t right = operands.back();
+            uint32_t left = (count == 2) ? operands[operands.size()-2] : right;
+            operands.resize(operands.size()-count);
+            auto op = bytecode[pc];
+            if((binary and (op < ADD or op > OR)) or (!binary and (op < POSITIVE or op > NEGATION)))
+                return RECORD_UNTRACEABLE;
+            if(out->nodes[left].kind == TRACE_CONST and out->nodes[right].kind == TRACE_CONST)
+                operands.push_back(node({TRACE_CONST, 0, 0, 0, trace_fold(kind, op, out->nodes[left].number, out->nodes[right].number)}));
             else
-            {
-                printf("Tried to apply unary numeric assignment to string at 0x%08X\n", pc-1);
-                return;
-            }
+                operands.push_back(node({kind, op, left, right, 0}));
             break;
         }
-        // x = 7
-        // DIRECT x; BINAS ASSIGN 7
         case DIRECT:
+            lvalue = variable(mod.symbolids[decode_u16(bytecode, pc)]);
+            if(lvalue < 0)
+                return RECORD_UNTRACEABLE;
+            break;
+        case BINAS:
+        case UNAS:
         {
-            std::string name;
-            uint8_t c = bytecode[pc++];
-            while (c != 0)
+            auto op = bytecode[pc];
+            if(lvalue < 0 or operands.size() != ((opcode == BINAS) ? 1 : 0))
+                return RECORD_UNTRACEABLE;
+            if(opcode == BINAS)
             {
-                name += c;
-                c = bytecode[pc++];
+                if(op < ASSIGN or op > MUTDIV)
+                    return RECORD_UNTRACEABLE;
+                out->steps.push_back({TRACE_STORE, op, uint32_t(lvalue), operands.back(), false, 0});
+                operands.pop_back();
             }
-            
-            lvalue_id = 0;
-            lvalue_islocal = true;
-            lvalue_name = name;
-            
+            else
+                out->steps.push_back({TRACE_STORE, MUTADD, uint32_t(lvalue), node({TRACE_CONST, 0, 0, 0, (op == INCREMENT) ? 1.0 : -1.0}), false, 0});
+            truth = -1; // guards read their variables where the branch is, so they mustn't have changed since TRUTH
             break;
         }
-        // (10000).x
-        // only at the tail end of a left hand expression, the rest is INDEXP
-        case INDIRECT:
-        // indirection /expression/, as in it puts a value onto the stack
-        case INDEXP:
+        case TRUTH:
+        case NUMTRUTH:
+            if(operands.size() != 1)
+                return RECORD_UNTRACEABLE;
+            truth = operands.back();
+            operands.pop_back();
+            break;
+        case JSIT:
+        case JSIF:
+        case JLIT:
+        case JLIF:
+            if(truth < 0 or operands.size() != 0)
+                return RECORD_UNTRACEABLE;
+            break;
+        default:
+            return RECORD_UNTRACEABLE;
+        }
+        
+        if(!interpret_impl<false, true>(program))
+            return RECORD_ERROR;
+        
+        if(program->variables.size() < depth or program->stackdepths.size() < saved or program->stack.size() != height+operands.size())
+            return RECORD_UNTRACEABLE;
+        if(opcode == JSIT or opcode == JSIF or opcode == JLIT or opcode == JLIF)
         {
-            if(valstack->size() < 1)
-            {
-                puts("Error: not enough arguments to lvalue indirection");
-                return;
-            }
-            value lhs = valstack->back();
-            valstack->pop_back();
-            
-            if(!lhs.is_number)
-            {
-                puts("Error: left hand side of derefence is not a number");
-                return;
-            }
-            
-            if(!global.instances.count(lhs.real))
+            auto next = loc+aligned_layout_size(opcode, loc);
+            int64_t offset = (opcode == JSIT or opcode == JSIF) ? decode_i16(bytecode, pc) : decode_i64(bytecode, pc);
+            if(loc+offset != next)
             {
-                puts("Error: attempt to dereference non-existent object");
-                return;
+                traceexit exit = {(program->pc == next) ? loc+offset : next, program->truth_register, uint32_t(program->variables.size()-depth), {}};
+                for(uint64_t i = saved; i < program->stackdepths.size(); i++)
+                    exit.saved.push_back(program->stackdepths[i]-depth);
+                out->steps.push_back({TRACE_GUARD, 0, 0, uint32_t(truth), program->truth_register, uint32_t(out->exits.size())});
+                out->exits.push_back(std::move(exit));
             }
-            
-            std::string name;
-            uint8_t c = bytecode[pc++];
-            while (c != 0)
+        }
+        if(program->pc == head)
+        {
+            if(program->variables.size() != depth or program->stackdepths.size() != saved or operands.size() != 0)
+                return RECORD_UNTRACEABLE;
+            return RECORD_DONE;
+        }
+        // any other way back is an inner loop
+        if(program->pc <= loc)
+            return RECORD_UNTRACEABLE;
+    }
+    return RECORD_UNTRACEABLE;
+}
+
+// where a node can be read from without computing anything: a register, or a constant in the pool
+struct traceoperand
+{
+    int reg = -1;
+    int64_t constant = -1;
+};
+
+// turns a recorded iteration into a loop in machine code. it takes its variables in rdi, as pointers to the numbers
+// of the values that hold them, and keeps variable i in xmm8+i, followed by the values of operations that don't
+// depend on anything the loop assigns, which it works out once before the loop. expressions are computed on xmm0-5,
+// xmm6 holds zero and xmm7 is scratch. returns nullptr if the iteration doesn't fit in that.
+looptrace * compile_trace(const tracerecording & recording)
+{
+    auto & nodes = recording.nodes;
+    auto variables = recording.symbols.size();
+    
+    std::vector<bool> written(variables, false);
+    for(auto & step : recording.steps)
+    {
+        if(step.kind == TRACE_STORE)
+            written[step.variable] = true;
+    }
+    std::vector<bool> invariant(nodes.size());
+    for(uint64_t i = 0; i < nodes.size(); i++)
+    {
+        auto & n = nodes[i];
+        if(n.kind == TRACE_CONST)
+            invariant[i] = true;
+        else if(n.kind == TRACE_VAR)
+            invariant[i] = !written[n.left];
+        else
+            invariant[i] = invariant[n.left] and invariant[n.right];
+    }
+    
+    std::vector<int> hoisted(nodes.size(), -1);
+    std::vector<uint32_t> preheader;
+    int next = 8+variables;
+    std::function<void(uint32_t)> hoist = [&](uint32_t i)
+    {
+        auto & n = nodes[i];
+        if(n.kind != TRACE_BINOP and n.kind != TRACE_UNOP)
+            return;
+        if(invariant[i])
+        {
+            if(hoisted[i] < 0 and next < 16)
             {
-                name += c;
-                c = bytecode[pc++];
+                hoisted[i] = next++;
+                preheader.push_back(i);
             }
-            
-            if(opcode == INDIRECT)
+            return;
+        }
+        hoist(n.left);
+        if(n.kind == TRACE_BINOP)
+            hoist(n.right);
+    };
+    for(auto & step : recording.steps)
+        hoist(step.node);
+    
+    jitassembler a;
+    std::vector<double> constants = {1.0, -0.0}; // for turning compare masks into 1 and 0, and flipping signs
+    struct reference
+    {
+        uint64_t field; // disp32 of an instruction reading a constant
+        uint64_t end; // end of the instruction, which the displacement is relative to
+        uint64_t constant;
+    };
+    std::vector<reference> references;
+    std::vector<std::pair<uint64_t, uint64_t>> exitjumps; // rel32 field, exit
+    
+    auto constant = [&](double number) -> int64_t
+    {
+        for(uint64_t i = 0; i < constants.size(); i++)
+        {
+            if(memcmp(&constants[i], &number, sizeof(double)) == 0)
+                return i;
+        }
+        constants.push_back(number);
+        return constants.size()-1;
+    };
+    auto direct = [&](uint32_t i, bool hoisting) -> traceoperand
+    {
+        traceoperand operand;
+        if(!hoisting and hoisted[i] >= 0)
+            operand.reg = hoisted[i];
+        else if(nodes[i].kind == TRACE_CONST)
+            operand.constant = constant(nodes[i].number);
+        else if(nodes[i].kind == TRACE_VAR)
+            operand.reg = 8+nodes[i].left;
+        return operand;
+    };
+    // op reg, operand; with an immediate byte after it if imm >= 0
+    auto apply = [&](uint8_t prefix, uint8_t op, int reg, traceoperand operand, int imm = -1)
+    {
+        if(operand.reg >= 0)
+            a.sse(prefix, op, reg, operand.reg);
+        else
+        {
+            auto field = a.sse_rip(prefix, op, reg);
+            if(imm >= 0)
+                a.out.push_back(imm);
+            references.push_back({field, a.out.size(), uint64_t(operand.constant)});
+            return;
+        }
+        if(imm >= 0)
+            a.out.push_back(imm);
+    };
+    traceoperand one, sign, zero;
+    one.constant = 0;
+    sign.constant = 1;
+    zero.reg = 6;
+    auto reg = [](int r)
+    {
+        traceoperand operand;
+        operand.reg = r;
+        return operand;
+    };
+    
+    // computes node i into xmm(target). the preheader computes the nodes it hoists from scratch, since they're in
+    // no particular order.
+    std::function<bool(uint32_t, int, bool)> emit = [&](uint32_t i, int target, bool hoisting) -> bool
+    {
+        if(target > 5)
+            return false;
+        auto & n = nodes[i];
+        auto operand = direct(i, hoisting);
+        if(operand.reg >= 0 or operand.constant >= 0)
+        {
+            apply(0xF2, 0x10, target, operand); // movsd
+            return true;
+        }
+        if(!emit(n.left, target, hoisting))
+            return false;
+        if(n.kind == TRACE_UNOP)
+        {
+            if(n.op == NEGATIVE)
             {
-                lvalue_id = lhs.real;
-                lvalue_name = name;
-                lvalue_islocal = false;
+                apply(0xF2, 0x10, 7, sign);
+                a.sse(0x66, 0x57, target, 7); // xorpd
             }
-            else
+            else if(n.op == NEGATION)
             {
-                if(!global.instances.count(lhs.real))
-                {
-                    puts("Error: instance being dereferenced does not exist");
-                    break;
-                }
-                auto other = global.instances[lhs.real];
-                if(other->variables.size() == 0)
-                {
-                    puts("Internal error: tried operating on a zero-size stack of variable heaps");
-                    exit(0);
-                }
-                auto varstack_current = other->variables.size()-1;
-                while(other->variables[varstack_current].count(name) == 0 and varstack_current > 0)
-                    varstack_current--;
-                auto & vstack = other->variables[varstack_current];
-                if(vstack.count(name))
-                    valstack->push_back((vstack[name]));
-                else
-                {
-                    puts("Error: instance contains no such variable");
-                    break;
-                }
+                apply(0xF2, 0xC2, target, zero, 0); // cmpeqsd
+                apply(0xF2, 0x10, 7, one);
+                a.sse(0x66, 0x54, target, 7); // andpd
             }
-            
+            return true;
+        }
+        auto right = direct(n.right, hoisting);
+        if(right.reg < 0 and right.constant < 0)
+        {
+            if(!emit(n.right, target+1, hoisting))
+                return false;
+            right = reg(target+1);
+        }
+        switch(n.op)
+        {
+        case ADD: apply(0xF2, 0x58, target, right); return true;
+        case SUB: apply(0xF2, 0x5C, target, right); return true;
+        case MUL: apply(0xF2, 0x59, target, right); return true;
+        case DIV: apply(0xF2, 0x5E, target, right); return true;
+        case EQ:
+        case NEQ:
+        case LT:
+        case LTE:
+        {
+            int predicate = (n.op == EQ) ? 0 : (n.op == NEQ) ? 4 : (n.op == LT) ? 1 : 2;
+            apply(0xF2, 0xC2, target, right, predicate); // cmpsd
+            break;
+        }
+        case GT:
+        case GTE:
+            // the other way round, with the right hand side in scratch
+            apply(0xF2, 0x10, 7, right);
+            a.sse(0xF2, 0xC2, 7, target);
+            a.out.push_back((n.op == GT) ? 1 : 2);
+            a.sse(0xF2, 0x10, target, 7);
+            break;
+        case AND:
+        case OR:
+            apply(0xF2, 0xC2, target, zero, 4); // cmpneqsd
+            apply(0xF2, 0x10, 7, right);
+            a.sse(0xF2, 0xC2, 7, 6);
+            a.out.push_back(4);
+            a.sse(0x66, (n.op == AND) ? 0x54 : 0x56, target, 7); // andpd, orpd
+            break;
+        }
+        // compare masks are all ones or all zeroes
+        apply(0xF2, 0x10, 7, one);
+        a.sse(0x66, 0x54, target, 7);
+        return true;
+    };
+    
+    for(uint64_t i = 0; i < variables; i++)
+    {
+        a.bytes({0x48, 0x8B, 0x47, uint8_t(8*i)}); // mov rax, [rdi+8*i]
+        a.bytes({0xF2, 0x44, 0x0F, 0x10, uint8_t((i&7)<<3)}); // movsd xmm8+i, [rax]
+    }
+    a.sse(0x66, 0x57, 6, 6); // xorpd xmm6, xmm6
+    for(auto i : preheader)
+    {
+        if(!emit(i, 0, true))
+            return nullptr;
+        a.sse(0xF2, 0x10, hoisted[i], 0);
+    }
+    
+    auto loop = a.out.size();
+    for(auto & step : recording.steps)
+    {
+        auto operand = direct(step.node, false);
+        if(operand.reg < 0 and operand.constant < 0)
+        {
+            if(!emit(step.node, 0, false))
+                return nullptr;
+            operand = reg(0);
+        }
+        if(step.kind == TRACE_STORE)
+        {
+            static const uint8_t ops[] = {0x10, 0x58, 0x5C, 0x59, 0x5E}; // movsd, addsd, subsd, mulsd, divsd
+            apply(0xF2, ops[step.op-ASSIGN], 8+step.variable, operand);
+            continue;
+        }
+        if(operand.reg != 0)
+            apply(0xF2, 0x10, 0, operand);
+        a.sse(0x66, 0x2E, 0, 6); // ucomisd xmm0, xmm6; unordered means NaN, which is true
+        if(step.expected)
+        {
+            a.bytes({0x7A, 0x06}); // jp over
+            a.bytes({0x0F, 0x84}); // je exit
+        }
+        else
+        {
+            a.bytes({0x0F, 0x8A}); // jp exit
+            exitjumps.push_back({a.out.size(), step.exit});
+            a.imm32(0);
+            a.bytes({0x0F, 0x85}); // jne exit
+        }
+        exitjumps.push_back({a.out.size(), step.exit});
+        a.imm32(0);
+    }
+    a.out.push_back(0xE9); // jmp loop
+    a.rel32(loop);
+    
+    // exits store the variables the loop assigns back and return their number
+    std::vector<uint64_t> exits;
+    for(uint64_t e = 0; e < recording.exits.size(); e++)
+    {
+        exits.push_back(a.out.size());
+        for(uint64_t i = 0; i < variables; i++)
+        {
+            if(!written[i])
+                continue;
+            a.bytes({0x48, 0x8B, 0x47, uint8_t(8*i)}); // mov rax, [rdi+8*i]
+            a.bytes({0xF2, 0x44, 0x0F, 0x11, uint8_t((i&7)<<3)}); // movsd [rax], xmm8+i
+        }
+        a.out.push_back(0xB8); // mov eax, e
+        a.imm32(e);
+        a.out.push_back(0xC3); // ret
+    }
+    for(auto & jump : exitjumps)
+    {
+        int32_t rel = int64_t(exits[jump.second]) - int64_t(jump.first+4);
+        memcpy(&a.out[jump.first], &rel, 4);
+    }
+    while(a.out.size() % 8 != 0)
+        a.out.push_back(0xCC);
+    auto pool = a.out.size();
+    for(auto number : constants)
+    {
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+        a.imm64(bits);
+    }
+    for(auto & r : references)
+    {
+        int32_t rel = int64_t(pool + 8*r.constant) - int64_t(r.end);
+        memcpy(&a.out[r.field], &rel, 4);
+    }
+    
+    auto size = a.out.size();
+    void * memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED)
+        return nullptr;
+    memcpy(memory, a.out.data(), size);
+    if(mprotect(memory, size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, size);
+        return nullptr;
+    }
+    auto trace = new looptrace;
+    trace->memory = (uint8_t *)memory;
+    trace->size = size;
+    trace->run = (uint32_t (*)(double **))memory;
+    trace->symbols = recording.symbols;
+    trace->builtin_names = recording.builtin_names;
+    trace->exits = recording.exits;
+    return trace;
+}
+
+// runs a loop's trace from the head of the loop, if its variables are all there and still numbers, and leaves the
+// program at the exit it took, with the scopes the interpreter would have had open there
+void run_trace(progstate * program, const looptrace * trace)
+{
+    if(trace->builtin_names and program->self != 0)
+        return;
+    double * variables[max_trace_variables];
+    for(uint64_t i = 0; i < trace->symbols.size(); i++)
+    {
+        auto found = program->find_variable(trace->symbols[i]);
+        if(found == nullptr or !found->is_number)
+            return;
+        variables[i] = &found->real;
+    }
+    auto depth = program->variables.size();
+    auto & exit = trace->exits[trace->run(variables)];
+    for(uint32_t i = 0; i < exit.scopes; i++)
+        program->open_scope();
+    for(auto offset : exit.saved)
+        program->stackdepths.push_back(depth+offset);
+    program->truth_register = exit.truth;
+    program->pc = exit.pc;
+}
+#endif
+
+// called by the interpreter when it jumps back to the head of a loop: counts the loop, records and compiles it once
+// it's hot, and runs it as machine code from then on. returns false if the program stopped on an error while its
+// loop was being recorded.
+bool run_hot_loop(progstate * program)
+{
+#ifdef NOTGML_JIT
+    auto & mod = *program->mod;
+    auto found = std::lower_bound(mod.loopheads.begin(), mod.loopheads.end(), program->pc);
+    if(found == mod.loopheads.end() or *found != program->pc)
+        return true;
+    auto & loop = mod.loops[found-mod.loopheads.begin()];
+    auto count = loop.count.load(std::memory_order_acquire);
+    if(count == LOOP_TRACED)
+    {
+        run_trace(program, loop.trace.load(std::memory_order_relaxed));
+        return true;
+    }
+    if(count < LOOP_HOT)
+    {
+        // a lost update between threads only delays recording a little
+        loop.count.store(count+1, std::memory_order_relaxed);
+        return true;
+    }
+    // only one thread records a loop; everybody else carries on interpreting it meanwhile
+    if(count != LOOP_HOT or !loop.count.compare_exchange_strong(count, LOOP_RECORDING, std::memory_order_relaxed))
+        return true;
+    
+    tracerecording recording;
+    auto status = record_trace(program, &recording);
+    auto trace = (status == RECORD_DONE) ? compile_trace(recording) : nullptr;
+    if(trace == nullptr)
+    {
+        loop.count.store(LOOP_UNTRACEABLE, std::memory_order_relaxed);
+        return status != RECORD_ERROR;
+    }
+    loop.trace.store(trace, std::memory_order_relaxed);
+    loop.count.store(LOOP_TRACED, std::memory_order_release);
+    run_trace(program, trace);
+#endif
+    return true;
+}
+
+// ahead of time compilation. aot_emit() translates a verified module into a C++ function that does what the baseline
+// jit's machine code does: branches become gotos on the truth register and everything else calls the same runtime
+// helpers, here through an aotruntime table handed to it, since the shared library it's built into can't link against
+// the program loading it. modules find their function in a library by a hash of their image, so a library built from
+// an older version of a script is just ignored. symbols are passed as indices into the module's symbol table, since
+// interned ids only hold for the process that interned them.
+
+enum {
+    AOT_VERSION = 1, // bumped whenever aotruntime or the generated code changes
+};
+
+struct aotruntime
+{
+    bool (*step)(jitframe *, uint64_t);
+    void (*pushval)(jitframe *, uint64_t);
+    bool (*pushvar)(jitframe *, uint64_t, uint64_t);
+    void (*pop)(jitframe *);
+    bool (*declset)(jitframe *, uint64_t);
+    bool (*binop)(jitframe *, uint64_t, uint64_t);
+    void (*direct)(jitframe *, uint64_t);
+    bool (*binas)(jitframe *, uint64_t, uint64_t);
+    bool (*truth)(jitframe *);
+    void (*openscope)(jitframe *);
+    void (*exitscope)(jitframe *);
+    void (*savescope)(jitframe *);
+    void (*loadscope)(jitframe *);
+    uint64_t (*call)(jitframe *, uint64_t, uint64_t, uint64_t);
+    uint64_t (*ret)(jitframe *);
+    bool (*finished)(jitframe *);
+};
+
+// aotruntime as the generated code sees it; goes at the top of every file of generated code
+const char * aot_prelude =
+"// generated by notgml, see aot_emit()\n"
+"struct frame;\n"
+"struct runtime\n"
+"{\n"
+"    bool (*step)(frame *, unsigned long long);\n"
+"    void (*pushval)(frame *, unsigned long long);\n"
+"    bool (*pushvar)(frame *, unsigned long long, unsigned long long);\n"
+"    void (*pop)(frame *);\n"
+"    bool (*declset)(frame *, unsigned long long);\n"
+"    bool (*binop)(frame *, unsigned long long, unsigned long long);\n"
+"    void (*direct)(frame *, unsigned long long);\n"
+"    bool (*binas)(frame *, unsigned long long, unsigned long long);\n"
+"    bool (*truth)(frame *);\n"
+"    void (*openscope)(frame *);\n"
+"    void (*exitscope)(frame *);\n"
+"    void (*savescope)(frame *);\n"
+"    void (*loadscope)(frame *);\n"
+"    unsigned long long (*call)(frame *, unsigned long long, unsigned long long, unsigned long long);\n"
+"    unsigned long long (*ret)(frame *);\n"
+"    bool (*finished)(frame *);\n"
+"};\n";
+
+bool aot_pushvar(jitframe * f, uint64_t symbol, uint64_t loc)
+{
+    return jit_pushvar(f, f->mod->symbolids[symbol], loc);
+}
+bool aot_declset(jitframe * f, uint64_t symbol)
+{
+    return jit_declset(f, f->mod->symbolids[symbol]);
+}
+void aot_direct(jitframe * f, uint64_t symbol)
+{
+    jit_direct(f, f->mod->symbolids[symbol]);
+}
+bool aot_finished(jitframe * f)
+{
+    return f->finished;
+}
+
+const aotruntime aot_runtime = {
+    jit_step, jit_pushval, aot_pushvar, jit_pop, aot_declset, jit_binop, aot_direct, jit_binas, jit_truth,
+    jit_openscope, jit_exitscope, jit_savescope, jit_loadscope, jit_call_pc, jit_return_pc, aot_finished,
+};
+
+// the name of the module's function in generated code
+std::string aot_symbol(const module & mod)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "notgml_aot_%d_%016llx", AOT_VERSION, (unsigned long long)hash_bytes(mod.image, mod.imagesize));
+    return name;
+}
+
+// C++ source for a function running a verified module, for a file starting with aot_prelude. returns an empty string
+// if the module has an instruction this doesn't know.
+std::string aot_emit(const module & mod)
+{
+    auto bytecode = mod.code;
+    auto codesize = mod.codesize;
+    std::string out;
+    char line[256];
+    auto emit = [&](const char * format, auto... args)
+    {
+        snprintf(line, sizeof(line), format, args...);
+        out += line;
+    };
+    typedef unsigned long long ull;
+    
+    emit("\nextern \"C\" bool %s(const runtime * rt, frame * f, bool * truth, unsigned long long pc)\n{\n", aot_symbol(mod).data());
+    // calls and returns go on from a position only known at run time
+    out += "dispatch:\n    switch(pc)\n    {\n";
+    for(uint64_t pc = 0; pc < codesize; pc += aligned_layout_size(bytecode[pc], pc))
+        emit("    case %lluull: goto L%llu;\n", ull(pc), ull(pc));
+    emit("    case %lluull: goto L%llu;\n", ull(codesize), ull(codesize));
+    out += "    default: return false;\n    }\n";
+    
+    uint64_t pc = 0;
+    while(pc < codesize)
+    {
+        auto loc = pc;
+        auto opcode = bytecode[pc++];
+        emit("L%llu:\n", ull(loc));
+        switch(opcode)
+        {
+        case NOP:
             break;
-        }
-        case TRUTH:
+        case PUSHVAL:
         {
-            if(valstack->size() < 1)
-            {
-                puts("Error: not enough arguments to set truth register");
-                return;
-            }
-            value truth = valstack->back();
-            valstack->pop_back();
-            
-            if(truth.is_number)
-            {
-                truth_register = !!truth.real;
-            }
-            else
-            {
-                puts("Error: tried to take truth of string");
-                return;
-            }
-            
+            double number = decode_double(bytecode, pc);
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(double));
+            emit("    rt->pushval(f, 0x%llxull);\n", ull(bits));
             break;
         }
+        case PUSHVAR:
+            emit("    if(!rt->pushvar(f, %u, %llu)) return false;\n", unsigned(decode_u16(bytecode, pc)), ull(loc));
+            break;
+        case POP:
+            out += "    rt->pop(f);\n";
+            break;
+        case DECLSET:
+            emit("    if(!rt->declset(f, %u)) return false;\n", unsigned(decode_u16(bytecode, pc)));
+            break;
+        case BINOP:
+        case NUMBINOP:
+            emit("    if(!rt->binop(f, %u, %llu)) return false;\n", unsigned(bytecode[pc]), ull(loc));
+            break;
+        case DIRECT:
+            emit("    rt->direct(f, %u);\n", unsigned(decode_u16(bytecode, pc)));
+            break;
+        case BINAS:
+            emit("    if(!rt->binas(f, %u, %llu)) return false;\n", unsigned(bytecode[pc]), ull(loc));
+            break;
+        case TRUTH:
+        case NUMTRUTH:
+            out += "    if(!rt->truth(f)) return false;\n";
+            break;
         case OPENSCOPE:
-        {
-            variables.push_back({});
-            stack.push_back({});
-            
-            varstack = &variables.back();
-            valstack = &stack.back();
-            
+            out += "    rt->openscope(f);\n";
             break;
-        }
         case EXITSCOPE:
-        {
-            variables.pop_back();
-            stack.pop_back();
-            
-            varstack = &variables.back();
-            valstack = &stack.back();
-            
+            out += "    rt->exitscope(f);\n";
             break;
-        }
         case SAVESCOPE:
-        {
-            stackdepths.push_back(variables.size());
+            out += "    rt->savescope(f);\n";
             break;
-        }
         case LOADSCOPE:
-        {
-            auto target_depth = stackdepths.back();
-            while(variables.size() > target_depth)
-            {
-                variables.pop_back();
-                stack.pop_back();
-            }
-            stackdepths.pop_back();
-            
+            out += "    rt->loadscope(f);\n";
             break;
-        }
         case BREAK:
-        {
-            auto target_depth = stackdepths.back();
-            while(variables.size() > target_depth)
-            {
-                variables.pop_back();
-                stack.pop_back();
-            }
-            stackdepths.pop_back();
-            
-            uint8_t b1 = bytecode[pc++];
-            uint8_t b2 = bytecode[pc++];
-            uint8_t b3 = bytecode[pc++];
-            uint8_t b4 = bytecode[pc++];
-            uint8_t b5 = bytecode[pc++];
-            uint8_t b6 = bytecode[pc++];
-            uint8_t b7 = bytecode[pc++];
-            uint8_t b8 = bytecode[pc++];
-            // big endian
-            uint64_t temp = 0;
-            temp |= uint64_t(b1)<<(8*7);
-            temp |= uint64_t(b2)<<(8*6);
-            temp |= uint64_t(b3)<<(8*5);
-            temp |= uint64_t(b4)<<(8*4);
-            temp |= uint64_t(b5)<<(8*3);
-            temp |= uint64_t(b6)<<(8*2);
-            temp |= uint64_t(b7)<<(8*1);
-            temp |= uint64_t(b8)<<(8*0);
-            
-            int64_t offset = static_cast<int64_t>(temp);
-            
-            pc = loc+offset;
-            
+            out += "    rt->loadscope(f);\n";
+            emit("    goto L%llu;\n", ull(loc+decode_i64(bytecode, pc)));
             break;
-        }
         case JSIT:
         case JSIF:
         case JS:
-        {
-            uint8_t b1 = bytecode[pc++];
-            uint8_t b2 = bytecode[pc++];
-            // big endian
-            uint16_t temp = 0;
-            temp |= uint16_t(b1)<<(8*1);
-            temp |= uint16_t(b2)<<(8*0);
-            
-            int16_t offset;
-            if(temp >= 0x8000)
-                offset = int32_t(temp)-0x10000;
-            else
-                offset = temp;
-            
-            if(opcode == JSIT)
-            {
-                if(truth_register)
-                    pc = loc+offset;
-            }
-            else if(opcode == JSIF)
-            {
-                if(!truth_register)
-                    pc = loc+offset;
-            }
-            else
-            {
-                pc = loc+offset;
-            }
-            
-            break;
-        }
         case JLIT:
         case JLIF:
         case JL:
         {
-            uint8_t b1 = bytecode[pc++];
-            uint8_t b2 = bytecode[pc++];
-            uint8_t b3 = bytecode[pc++];
-            uint8_t b4 = bytecode[pc++];
-            uint8_t b5 = bytecode[pc++];
-            uint8_t b6 = bytecode[pc++];
-            uint8_t b7 = bytecode[pc++];
-            uint8_t b8 = bytecode[pc++];
-            // big endian
-            uint64_t temp = 0;
-            temp |= uint64_t(b1)<<(8*7);
-            temp |= uint64_t(b2)<<(8*6);
-            temp |= uint64_t(b3)<<(8*5);
-            temp |= uint64_t(b4)<<(8*4);
-            temp |= uint64_t(b5)<<(8*3);
-            temp |= uint64_t(b6)<<(8*2);
-            temp |= uint64_t(b7)<<(8*1);
-            temp |= uint64_t(b8)<<(8*0);
-            
-            int64_t offset = static_cast<int64_t>(temp);
-            
-            if(opcode == JLIT)
-            {
-                if(truth_register)
-                    pc = loc+offset;
-            }
-            else if(opcode == JLIF)
-            {
-                if(!truth_register)
-                    pc = loc+offset;
-            }
-            else
-            {
-                pc = loc+offset;
-            }
-            
-            break;
-        }
-        case CALL:
-        {
-            std::string name;
-            uint8_t c = bytecode[pc++];
-            while (c != 0)
-            {
-                name += c;
-                c = bytecode[pc++];
-            }
-            uint8_t args = bytecode[pc++];
-            if(valstack->size() < args)
-            {
-                puts("Error: function call uses more arguments than are on stack");
-                return;
-            }
-            std::vector<value> arguments;
-            for(int i = 0; i < args; i++)
-            {
-                arguments.push_back(valstack->back());
-                valstack->pop_back();
-            }
-            std::reverse(arguments.begin(), arguments.end());
-            if(name == "print")
-            {
-                if(args != 1)
-                {
-                    puts("Error: wrong number of arguments to function \"print\"");
-                    return;
-                }
-                if(arguments[0].is_number)
-                    printf("%f\n", arguments[0].real);
-                else
-                    printf("%s\n", arguments[0].text.data());
-                valstack->push_back(0);
-            }
-            else if(name == "instance_create")
-            {
-                if(args != 3)
-                {
-                    puts("Error: wrong number of arguments to function \"print\"");
-                    return;
-                }
-                if(arguments[0].is_number and arguments[1].is_number and arguments[2].is_number)
-                {
-                    // FIXME: handle object event stuff
-                    auto id = global.instance_spawn();
-                    auto n = global.instances[id];
-                    n->variables[0]["x"] = arguments[0];
-                    n->variables[0]["y"] = arguments[1];
-                    n->variables[0]["object_id"] = arguments[2];
-                    n->variables[0]["id"] = id;
-                    
-                    valstack->push_back(id);
-                }
-            }
+            int64_t offset = (opcode == JSIT or opcode == JSIF or opcode == JS) ? decode_i16(bytecode, pc) : decode_i64(bytecode, pc);
+            if(opcode == JSIT or opcode == JLIT)
+                out += "    if(*truth) ";
+            else if(opcode == JSIF or opcode == JLIF)
+                out += "    if(!*truth) ";
             else
-            {
-                printf("Error: unknown function \"%s\"\n", name.data());
-                return;
-            }
+                out += "    ";
+            emit("goto L%llu;\n", ull(loc+offset));
             break;
         }
         case FUNCDEF:
+            emit("    goto L%llu;\n", ull(loc+decode_i64(bytecode, pc)));
+            break;
+        case CALL:
+        case TAILCALL:
         {
-            // TODO: implement
-            puts("Unimplemented FUNCDEF");
-            return;
+            auto symbol = decode_u16(bytecode, pc);
+            unsigned args = bytecode[pc++];
+            if(opcode == TAILCALL)
+                args |= 0x100;
+            emit("    pc = rt->call(f, %u, %u, %llu);\n", unsigned(symbol), args, ull(loc+aligned_layout_size(opcode, loc)));
+            out += "    if(pc == ~0ull) return false;\n    goto dispatch;\n";
             break;
         }
         case RETURN:
-        {
-            // TODO: implement
-            puts("Unimplemented RETURN");
-            return;
+            out += "    pc = rt->ret(f);\n    if(pc == ~0ull) return rt->finished(f);\n    goto dispatch;\n";
+            break;
+        case PUSHTEXT:
+        case DECLARE:
+        case UNOP:
+        case NUMUNOP:
+        case INDIRECT:
+        case INDEXP:
+        case UNAS:
+            emit("    if(!rt->step(f, %llu)) return false;\n", ull(loc));
             break;
-        }
         default:
-        printf("Unknown instruction 0x%02X at 0x%08X\n", bytecode[pc-1], pc-1);
+            return "";
+        }
+        pc = loc+aligned_layout_size(opcode, loc);
+    }
+    emit("L%llu:\n    return true;\n}\n", ull(codesize));
+    return out;
+}
+
+// looks for the module's function in a library opened with dlopen(), and has the module run it from then on if it's
+// there. like the rest of the module, this has to be done before anybody runs it.
+bool attach_aot(const module & mod, const std::shared_ptr<void> & library)
+{
+#ifndef _WIN32
+    if(!mod.verified or !library)
+        return false;
+    auto entry = (aotentry)dlsym(library.get(), aot_symbol(mod).data());
+    if(entry == nullptr)
+        return false;
+    mod.aotlibrary = library;
+    mod.aot = entry;
+    return true;
+#else
+    return false;
+#endif
+}
+
+// dlopen() with a dlclose() once the last module using it is gone; nullptr if it can't be opened
+std::shared_ptr<void> open_aot_library(const std::string & path)
+{
+#ifndef _WIN32
+    // without a slash, dlopen() would search the library path instead
+    auto handle = dlopen((path.find('/') == std::string::npos ? "./" + path : path).data(), RTLD_NOW | RTLD_LOCAL);
+    if(handle == nullptr)
+        return nullptr;
+    return std::shared_ptr<void>(handle, [](void * handle) { dlclose(handle); });
+#else
+    return nullptr;
+#endif
+}
+
+bool interpret_aot(progstate * program)
+{
+    if(program->variables.size() == 0)
+        program->variables.push_back({});
+    jitframe frame = {program, program->mod.get(), nullptr, &program->truth_register, program->frames.size(), false};
+    return program->mod->aot(&aot_runtime, &frame, &program->truth_register, program->pc);
+}
+
+// returns true if the program ran to its end, false if it stopped on an error
+bool interpret(progstate * program)
+{
+    if(program == nullptr or !program->mod or !program->mod->verified)
+        return interpret_impl<true>(program);
+    if(program->mod->aot != nullptr and program->global != nullptr and program->pc <= program->mod->codesize)
+        return interpret_aot(program);
+    if(program->global != nullptr and program->global->jit and program->pc <= program->mod->codesize)
+    {
+        auto code = jit_code(*program->mod);
+        if(code != nullptr and code->addresses[program->pc] != nullptr)
+            return interpret_jit(program, code);
+    }
+    return interpret_impl<false>(program);
+}
+
+// runs an event script on an instance. the create event runs in the instance's root scope, so its top level
+// declarations become the instance's variables; other events run in a scope of their own on top of it.
+// an instance can be made to run an event while it's in the middle of another one (destroying itself from its step
+// event, say), so the registers and scope depth are saved around the script and put back afterwards.
+bool run_event(progstate * n, const moduleref & code, bool in_root)
+{
+    auto pc = n->pc;
+    auto truth_register = n->truth_register;
+    auto lvalue_islocal = n->lvalue_islocal;
+    auto lvalue_id = n->lvalue_id;
+    auto lvalue_symbol = n->lvalue_symbol;
+    auto lvalue_cache = n->lvalue_cache;
+    moduleref mod = std::move(n->mod);
+    auto depth = n->variables.size();
+    auto height = n->stack.size();
+    auto saved = n->stackdepths.size();
+    auto frames = n->frames.size();
+    auto framescope = n->framescope;
+    
+    // the event doesn't see the scopes of whatever the instance was in the middle of, only its own and the root
+    if(!in_root)
+        n->open_scope();
+    n->framescope = in_root ? 0 : depth;
+    n->mod = code;
+    n->pc = 0;
+    n->running++;
+    bool finished = interpret(n);
+    n->running--;
+    
+    n->close_scopes(depth);
+    n->stack.resize(height);
+    n->stackdepths.resize(saved);
+    n->frames.resize(frames);
+    n->framescope = framescope;
+    n->pc = pc;
+    n->truth_register = truth_register;
+    n->lvalue_islocal = lvalue_islocal;
+    n->lvalue_id = lvalue_id;
+    n->lvalue_symbol = lvalue_symbol;
+    n->lvalue_cache = lvalue_cache;
+    n->mod = std::move(mod);
+    
+    if(n->running == 0 and n->released)
+    {
+        n->recycle();
+        n->global->spare.push_back(n);
+    }
+    return finished;
+}
+
+// registers a new object type with no events, returning its object_id
+uint32_t globalstate::define_object(const std::string & name)
+{
+    if(objects.size() >= NO_TYPE)
+    {
+        puts("Error: too many object types");
         exit(0);
-        return;
+    }
+    objects.push_back({});
+    objects.back().name = name;
+    return objects.size()-1;
+}
+
+// spawns an instance and runs its type's create event
+double globalstate::instance_create(double x, double y, double object_id)
+{
+    auto id = instance_spawn();
+    auto slot = find_slot(id);
+    auto position = slots[slot].link;
+    xs[position] = x;
+    ys[position] = y;
+    object_ids[position] = object_id;
+    
+    auto type = type_of(object_id);
+    if(type != NO_TYPE)
+    {
+        slots[slot].type = type;
+        slots[slot].member = objects[type].members.size();
+        objects[type].members.push_back(slot);
+        if(objects[type].events[EVENT_CREATE])
+        {
+            nesting++;
+            run_event(slots[slot].instance, objects[type].events[EVENT_CREATE], true);
+            nesting--;
+        }
+    }
+    return id;
+}
+
+// runs an instance's destroy event and then releases it; returns false if the id doesn't refer to a live instance
+bool globalstate::instance_destroy(double id)
+{
+    auto slot = find_slot(id);
+    if(slot == no_slot)
+        return false;
+    auto type = slots[slot].type;
+    if(type != NO_TYPE and objects[type].events[EVENT_DESTROY])
+    {
+        // the instance stays alive while its destroy event runs, and the event might destroy it itself
+        nesting++;
+        run_event(slots[slot].instance, objects[type].events[EVENT_DESTROY], false);
+        nesting--;
+        if(find_slot(id) == no_slot)
+            return true;
+    }
+    return instance_release(id);
+}
+
+// runs an event for every instance that handles it, one object type at a time, so each type's script stays hot while
+// all of its instances run it. instances created during the pass don't run until the next one, and instances destroyed
+// during it are skipped.
+// a type whose script is isolated runs as a parallel pass, on all the worker threads at once if there are any, see
+// dispatch_parallel().
+void globalstate::dispatch(int event)
+{
+    for(uint64_t type = 0; type < objects.size(); type++)
+    {
+        moduleref code = objects[type].events[event];
+        if(!code)
+            continue;
+        dispatching.clear();
+        for(auto slot : objects[type].members)
+            dispatching.push_back(id_of(slot));
+        if(code->isolated)
+        {
+            dispatch_parallel(dispatching, code);
+            continue;
+        }
+        for(auto id : dispatching)
+        {
+            if(auto n = find_instance(id))
+                run_event(n, code, false);
+        }
+    }
+}
+
+// runs an isolated script on a list of instances across the worker pool, or on the calling thread if there isn't one.
+// an isolated script can't create or destroy instances, so the instance table only gets read while the pass runs;
+// instances read each other's built-in variables from a snapshot taken at the start and their writes to each other are
+// buffered, then applied at the end in the order of the instances that made them, so the pass comes out the same
+// however many threads it runs on, none included.
+void globalstate::dispatch_parallel(const std::vector<double> & ids, const moduleref & code)
+{
+    snapshot_xs = xs;
+    snapshot_ys = ys;
+    for(auto & buffer : deferred)
+        buffer.clear();
+    // doesn't own the module, which code keeps alive, so the threads don't fight over its reference count
+    moduleref borrowed(moduleref(), code.get());
+    auto chunk = [&](uint64_t begin, uint64_t end, uint32_t worker)
+    {
+        for(uint64_t i = begin; i < end; i++)
+        {
+            auto n = find_instance(ids[i]);
+            if(n == nullptr)
+                continue;
+            passview view = {snapshot_xs.data(), snapshot_ys.data(), &deferred[worker], i};
+            n->view = &view;
+            run_event(n, borrowed, false);
+            n->view = nullptr;
+        }
+    };
+    if(workers)
+        workers->run(ids.size(), 64, chunk);
+    else
+        chunk(0, ids.size(), 0);
+    
+    applying.clear();
+    for(auto & buffer : deferred)
+        applying.insert(applying.end(), buffer.begin(), buffer.end());
+    std::sort(applying.begin(), applying.end(), [](const deferredwrite & a, const deferredwrite & b)
+    {
+        return (a.order != b.order) ? a.order < b.order : a.sequence < b.sequence;
+    });
+    for(const auto & write : applying)
+    {
+        auto position = find_position(write.target);
+        if(position == no_slot)
+            continue;
+        auto field = builtin(position, write.symbol);
+        switch(write.operation)
+        {
+        case ASSIGN: *field = write.operand; break;
+        case MUTADD: *field += write.operand; break;
+        case MUTSUB: *field -= write.operand; break;
+        case MUTMUL: *field *= write.operand; break;
+        case MUTDIV: *field /= write.operand; break;
         }
     }
 }
@@ -1032,15 +6192,22 @@ void disassemble(progstate * program)
         puts("Program is nullptr");
         return;
     }
+    if(!program->mod)
+    {
+        puts("Program has no code");
+        return;
+    }
     auto & pc = program->pc;
-    auto & bytecode = program->bytecode;
+    auto & mod = *program->mod;
+    auto bytecode = mod.code;
+    auto codesize = mod.codesize;
     while(1)
     {
-        if(pc >= bytecode.size())
+        if(pc >= codesize)
         {
             return;
         }
-        printf("%08X: ", pc);
+        printf("%08X: ", unsigned(pc));
         auto opcode = bytecode[pc++];
         switch(opcode)
         {
@@ -1050,52 +6217,21 @@ void disassemble(progstate * program)
         }
         case PUSHVAL:
         {
-            uint8_t b1 = bytecode[pc++];
-            uint8_t b2 = bytecode[pc++];
-            uint8_t b3 = bytecode[pc++];
-            uint8_t b4 = bytecode[pc++];
-            uint8_t b5 = bytecode[pc++];
-            uint8_t b6 = bytecode[pc++];
-            uint8_t b7 = bytecode[pc++];
-            uint8_t b8 = bytecode[pc++];
-            // big endian
-            uint64_t temp = 0;
-            temp |= uint64_t(b1)<<(8*7);
-            temp |= uint64_t(b2)<<(8*6);
-            temp |= uint64_t(b3)<<(8*5);
-            temp |= uint64_t(b4)<<(8*4);
-            temp |= uint64_t(b5)<<(8*3);
-            temp |= uint64_t(b6)<<(8*2);
-            temp |= uint64_t(b7)<<(8*1);
-            temp |= uint64_t(b8)<<(8*0);
-            double value;
-            memcpy(&value, &temp, sizeof(double));
+            double value = decode_double(bytecode, pc);
             
             printf("PUSHVAL %f\n", value);
             break;
         }
         case PUSHTEXT:
         {
-            std::string text;
-            uint8_t c = bytecode[pc++];
-            while (c != 0)
-            {
-                text += c;
-                c = bytecode[pc++];
-            }
+            std::string_view text = mod.text(decode_u16(bytecode, pc));
             
             printf("PUSHTEXT \"%s\"\n", text.data());
             break;
         }
         case PUSHVAR:
         {
-            std::string name;
-            uint8_t c = bytecode[pc++];
-            while (c != 0)
-            {
-                name += c;
-                c = bytecode[pc++];
-            }
+            std::string_view name = mod.symbol(decode_u16(bytecode, pc));
             
             printf("PUSHVAR %s\n", name.data());
             
@@ -1109,13 +6245,7 @@ void disassemble(progstate * program)
         }
         case DECLARE:
         {
-            std::string name;
-            uint8_t c = bytecode[pc++];
-            while (c != 0)
-            {
-                name += c;
-                c = bytecode[pc++];
-            }
+            std::string_view name = mod.symbol(decode_u16(bytecode, pc));
             
             printf("DECLARE %s\n", name.data());
             
@@ -1123,18 +6253,16 @@ void disassemble(progstate * program)
         }
         case DECLSET:
         {
-            std::string name;
-            uint8_t c = bytecode[pc++];
-            while (c != 0)
-            {
-                name += c;
-                c = bytecode[pc++];
-            }
+            std::string_view name = mod.symbol(decode_u16(bytecode, pc));
             
             printf("DECLSET %s\n", name.data());
             
             break;
         }
+        // printed as the generic instruction, marked
+        case NUMBINOP:
+            printf("NUM");
+            [[fallthrough]];
         case BINOP:
         {
             switch(bytecode[pc++])
@@ -1200,11 +6328,14 @@ void disassemble(progstate * program)
                 break;
             }
             default:
-            printf("Unknown unary numeric operation 0x%02X at 0x%08X\n", bytecode[pc-1], pc-1);
+            printf("Unknown unary numeric operation 0x%02X at 0x%08X\n", bytecode[pc-1], unsigned(pc-1));
             return;
             }
             break;
         }
+        case NUMUNOP:
+            printf("NUM");
+            [[fallthrough]];
         case UNOP:
         {
             switch(bytecode[pc++])
@@ -1225,7 +6356,7 @@ void disassemble(progstate * program)
                 break;
             }
             default:
-            printf("Unknown unary numeric operation 0x%02X at 0x%08X\n", bytecode[pc-1], pc-1);
+            printf("Unknown unary numeric operation 0x%02X at 0x%08X\n", bytecode[pc-1], unsigned(pc-1));
             return;
             }
             
@@ -1235,13 +6366,7 @@ void disassemble(progstate * program)
         case INDIRECT:
         case INDEXP:
         {
-            std::string name;
-            uint8_t c = bytecode[pc++];
-            while (c != 0)
-            {
-                name += c;
-                c = bytecode[pc++];
-            }
+            std::string_view name = mod.symbol(decode_u16(bytecode, pc));
             if(opcode == DIRECT)
                 printf("DIRECT");
             if(opcode == INDIRECT)
@@ -1249,7 +6374,10 @@ void disassemble(progstate * program)
             if(opcode == INDEXP)
                 printf("INDEXP");
             
-            printf(" %s\n", name.data());
+            if(opcode == DIRECT)
+                printf(" %s\n", name.data());
+            else
+                printf(" %s (cache %d)\n", name.data(), decode_u16(bytecode, pc));
             
             break;
         }
@@ -1283,7 +6411,7 @@ void disassemble(progstate * program)
                 break;
             }
             default:
-            printf("Unknown binary numeric assignment 0x%02X at 0x%08X\n", bytecode[pc-1], pc-1);
+            printf("Unknown binary numeric assignment 0x%02X at 0x%08X\n", bytecode[pc-1], unsigned(pc-1));
             return;
             }
             
@@ -1305,12 +6433,15 @@ void disassemble(progstate * program)
                 break;
             }
             default:
-            printf("Unknown unary numeric assignment 0x%02X at 0x%08X\n", bytecode[pc-1], pc-1);
+            printf("Unknown unary numeric assignment 0x%02X at 0x%08X\n", bytecode[pc-1], unsigned(pc-1));
             return;
             }
             
             break;
         }
+        case NUMTRUTH:
+            printf("NUM");
+            [[fallthrough]];
         case TRUTH:
         {
             puts("TRUTH");
@@ -1338,28 +6469,9 @@ void disassemble(progstate * program)
         }
         case BREAK:
         {
-            uint8_t b1 = bytecode[pc++];
-            uint8_t b2 = bytecode[pc++];
-            uint8_t b3 = bytecode[pc++];
-            uint8_t b4 = bytecode[pc++];
-            uint8_t b5 = bytecode[pc++];
-            uint8_t b6 = bytecode[pc++];
-            uint8_t b7 = bytecode[pc++];
-            uint8_t b8 = bytecode[pc++];
-            // big endian
-            uint64_t temp = 0;
-            temp |= uint64_t(b1)<<(8*7);
-            temp |= uint64_t(b2)<<(8*6);
-            temp |= uint64_t(b3)<<(8*5);
-            temp |= uint64_t(b4)<<(8*4);
-            temp |= uint64_t(b5)<<(8*3);
-            temp |= uint64_t(b6)<<(8*2);
-            temp |= uint64_t(b7)<<(8*1);
-            temp |= uint64_t(b8)<<(8*0);
+            int64_t offset = decode_i64(bytecode, pc);
             
-            int64_t offset = static_cast<int64_t>(temp);
-            
-            printf("BREAK %d\n", offset);
+            printf("BREAK %d\n", int(offset));
             
             break;
         }
@@ -1367,18 +6479,7 @@ void disassemble(progstate * program)
         case JSIF:
         case JS:
         {
-            uint8_t b1 = bytecode[pc++];
-            uint8_t b2 = bytecode[pc++];
-            // big endian
-            uint16_t temp = 0;
-            temp |= uint16_t(b1)<<(8*1);
-            temp |= uint16_t(b2)<<(8*0);
-            
-            int16_t offset;
-            if(temp >= 0x8000)
-                offset = int32_t(temp)-0x10000;
-            else
-                offset = temp;
+            int16_t offset = decode_i16(bytecode, pc);
             
             if(opcode == JSIT)
                 printf("JSIT");
@@ -1394,26 +6495,7 @@ void disassemble(progstate * program)
         case JLIF:
         case JL:
         {
-            uint8_t b1 = bytecode[pc++];
-            uint8_t b2 = bytecode[pc++];
-            uint8_t b3 = bytecode[pc++];
-            uint8_t b4 = bytecode[pc++];
-            uint8_t b5 = bytecode[pc++];
-            uint8_t b6 = bytecode[pc++];
-            uint8_t b7 = bytecode[pc++];
-            uint8_t b8 = bytecode[pc++];
-            // big endian
-            uint64_t temp = 0;
-            temp |= uint64_t(b1)<<(8*7);
-            temp |= uint64_t(b2)<<(8*6);
-            temp |= uint64_t(b3)<<(8*5);
-            temp |= uint64_t(b4)<<(8*4);
-            temp |= uint64_t(b5)<<(8*3);
-            temp |= uint64_t(b6)<<(8*2);
-            temp |= uint64_t(b7)<<(8*1);
-            temp |= uint64_t(b8)<<(8*0);
-            
-            int64_t offset = static_cast<int64_t>(temp);
+            int64_t offset = decode_i64(bytecode, pc);
             
             if(opcode == JLIT)
                 printf("JLIT");
@@ -1421,28 +6503,36 @@ void disassemble(progstate * program)
                 printf("JLIF");
             if(opcode == JL)
                 printf("JL");
-            printf(" %d\n", offset);
+            printf(" %d\n", int(offset));
             
             break;
         }
         case CALL:
         {
-            std::string name;
-            uint8_t c = bytecode[pc++];
-            while (c != 0)
-            {
-                name += c;
-                c = bytecode[pc++];
-            }
+            std::string_view name = mod.symbol(decode_u16(bytecode, pc));
             uint8_t args = bytecode[pc++];
             
             printf("CALL %s %d\n", name.data(), args);
             
             break;
         }
+        case TAILCALL:
+        {
+            std::string_view name = mod.symbol(decode_u16(bytecode, pc));
+            uint8_t args = bytecode[pc++];
+            
+            printf("TAILCALL %s %d\n", name.data(), args);
+            
+            break;
+        }
         case FUNCDEF:
         {
-            puts("FUNCDEF");
+            int64_t length = decode_i64(bytecode, pc);
+            std::string_view name = mod.symbol(decode_u16(bytecode, pc));
+            uint8_t arity = bytecode[pc++];
+            
+            printf("FUNCDEF %s %d %d\n", name.data(), arity, (int)length);
+            
             break;
         }
         case RETURN:
@@ -1451,7 +6541,7 @@ void disassemble(progstate * program)
             break;
         }
         default:
-        printf("Unknown instruction 0x%02X at 0x%08X\n", bytecode[pc-1], pc-1);
+        printf("Unknown instruction 0x%02X at 0x%08X\n", bytecode[pc-1], unsigned(pc-1));
         exit(0);
         return;
         }
@@ -1476,7 +6566,5 @@ int main()
 
 /*
 TODO list
-- implement funcdef
-- implement with(){} and real object descriptions
 - implement more standard functions
 */
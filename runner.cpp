@@ -1,9 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
 
 #include <vector>
 #include <map>
 #include <string>
+#include <chrono>
+#include <thread>
 
 template <typename T>
 void vector_append(std::vector<T> * a, const std::vector<T> & b)
@@ -1367,8 +1371,27 @@ node * parse_mutation(const std::vector<token> & tokens, uint64_t i, uint64_t &
 {
     if(i >= tokens.size()) return unexpected_eos(i);
     
+    // the left hand side is either a plain name or the field of an instance (character.player.x). most are plain
+    // names, so the indirection is only parsed if a "." follows the name, or the call it starts (make().x)
     uint64_t name_consumed = 0;
     auto name = parse_name(tokens, i, name_consumed);
+    uint64_t after = i+name_consumed;
+    if(!name->iserror and after < tokens.size() and tokens[after].text == "(")
+    {
+        for(int64_t depth = 0; after < tokens.size(); )
+        {
+            depth += (tokens[after].text == "(") - (tokens[after].text == ")");
+            after++;
+            if(depth == 0)
+                break;
+        }
+    }
+    if(name->iserror or (after < tokens.size() and tokens[after].text == "."))
+    {
+        delete_node(name);
+        name_consumed = 0;
+        name = parse_indirection(tokens, i, name_consumed);
+    }
     if(name->iserror)
     {
         delete_node(name);
@@ -1810,6 +1833,117 @@ node * parse_instruction(const std::vector<token> & tokens, uint64_t i, uint64_t
     }
 }
 
+// function name(a, b) { ... }
+node * parse_funcdef(const std::vector<token> & tokens, uint64_t i, uint64_t & consumed)
+{
+    if(i >= tokens.size()) return unexpected_eos(i);
+    
+    consumed = 0;
+    auto mynode = new node;
+    mynode->identity = "funcdef";
+    mynode->position = i;
+    
+    std::vector<node *> parameters;
+    auto fail = [&](const char * error, uint64_t at)
+    {
+        for(auto parameter : parameters)
+            delete_node(parameter);
+        mynode->iserror = true;
+        mynode->error = error;
+        mynode->errorpos = (at < tokens.size()) ? tokens[at].position : tokens[tokens.size()-1].endposition;
+        return mynode;
+    };
+    
+    if(i+2 >= tokens.size() or !is_name(tokens[i+1].text) or tokens[i+2].text != "(")
+        return fail("Error: expected function name and parameter list", i+1);
+    mynode->text = tokens[i+1].text;
+    
+    uint64_t j = i+3;
+    while(j < tokens.size() and tokens[j].text != ")")
+    {
+        if(parameters.size() > 0)
+        {
+            if(tokens[j].text != ",")
+                return fail("Error: expected \",\" or \")\" in function parameter list", j);
+            j++;
+        }
+        uint64_t name_consumed = 0;
+        auto name = parse_name(tokens, j, name_consumed);
+        if(name->iserror)
+        {
+            delete_node(name);
+            return fail("Error: expected parameter name", j);
+        }
+        name->parent = mynode;
+        parameters.push_back(name);
+        j += name_consumed;
+    }
+    if(j >= tokens.size())
+        return fail("Error: unexpected end of stream in function parameter list", j);
+    if(parameters.size() > 255)
+        return fail("Error: function has more than 255 parameters", i+1);
+    
+    uint64_t body_consumed = 0;
+    auto body = parse_bigblock(tokens, j+1, body_consumed);
+    if(body->iserror)
+    {
+        delete_node(body);
+        return fail("Error: expected function body", j+1);
+    }
+    
+    mynode->right = body;
+    body->parent = mynode;
+    if(parameters.size() > 0)
+    {
+        mynode->nodearray = (node **)malloc(sizeof(node*)*parameters.size());
+        for(uint64_t k = 0; k < parameters.size(); k++)
+            mynode->nodearray[k] = parameters[k];
+        mynode->arraynodes = parameters.size();
+    }
+    consumed = j+1+body_consumed-i;
+    return mynode;
+}
+
+// return; or return expression;
+node * parse_return(const std::vector<token> & tokens, uint64_t i, uint64_t & consumed)
+{
+    if(i >= tokens.size()) return unexpected_eos(i);
+    
+    consumed = 0;
+    auto mynode = new node;
+    mynode->identity = "return";
+    mynode->position = i;
+    
+    if(i+1 < tokens.size() and tokens[i+1].text == ";")
+    {
+        consumed = 2;
+        return mynode;
+    }
+    
+    uint64_t expr_consumed = 0;
+    auto expr = parse_expression(tokens, i+1, expr_consumed);
+    if(expr->iserror)
+    {
+        delete_node(expr);
+        mynode->iserror = true;
+        mynode->error = "Error: expected expression or \";\" after return";
+        mynode->errorpos = (i+1 < tokens.size()) ? tokens[i+1].position : tokens[i].endposition;
+        return mynode;
+    }
+    if(i+1+expr_consumed >= tokens.size() or tokens[i+1+expr_consumed].text != ";")
+    {
+        delete_node(expr);
+        mynode->iserror = true;
+        mynode->error = "Error: expected \";\" after returned expression";
+        mynode->errorpos = tokens[i+expr_consumed].endposition;
+        return mynode;
+    }
+    mynode->right = expr;
+    expr->parent = mynode;
+    consumed = 1+expr_consumed+1;
+    return mynode;
+}
+
 node * parse_statement(const std::vector<token> & tokens, uint64_t i, uint64_t & consumed)
 {
     if(i >= tokens.size()) return unexpected_eos(i);
@@ -1829,6 +1963,14 @@ node * parse_statement(const std::vector<token> & tokens, uint64_t i, uint64_t &
     {
         return parse_declaration(tokens, i, consumed);
     }
+    else if(tokens[i].text == "function")
+    {
+        return parse_funcdef(tokens, i, consumed);
+    }
+    else if(tokens[i].text == "return")
+    {
+        return parse_return(tokens, i, consumed);
+    }
     else if(tokens[i].text == "{")
     {
         return parse_bigblock(tokens, i, consumed);
@@ -2076,6 +2218,9 @@ node * fix_precedence(node * tree)
 
 #include "bytecode.cpp"
 
+// the context the test cases and benchmarks run in
+globalstate global;
+
 void encode_u16(std::vector<uint8_t> * bytecode, uint16_t value)
 {
     bytecode->push_back(((value>>(8*1)&0xFF)));
@@ -2106,33 +2251,197 @@ void encode_double(std::vector<uint8_t> * bytecode, double value)
     bytecode->push_back(((punned_value>>(8*0)&0xFF)));
 }
 
+// names and string literals are interned in the program's constant pool and referenced by index
+void encode_symbol(std::vector<uint8_t> * bytecode, constpool * pool, const std::string & name)
+{
+    encode_u16(bytecode, pool->add_symbol(name));
+}
+void encode_text(std::vector<uint8_t> * bytecode, constpool * pool, const std::string & text)
+{
+    encode_u16(bytecode, pool->add_text(text));
+}
+
 struct stackinfo {
     std::vector<uint64_t> breaks;
     std::vector<uint64_t> continues;
 };
 
-void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata, bool is_lvalue_area = false);
+void compile(node * tree, std::vector<uint8_t> * bytecode, constpool * pool, stackinfo * jumpdata, bool is_lvalue_area = false);
+
+// inlining: a call to a small function whose body is just `return expression;` is compiled as that expression, with
+// each parameter compiled as the argument given for it at the call site. the function itself is still compiled, for
+// calls that can't be inlined.
+// functions don't see the variables of whoever calls them, so bodies that use any name other than their parameters
+// aren't inlined; neither are calls with arguments that call functions, which would run in a different order or not at
+// all, or that would evaluate a nontrivial argument more than once.
+struct inlinecandidate
+{
+    node * definition;
+    node * body; // the returned expression
+    std::vector<int> uses; // how many times the body uses each parameter
+};
+
+// a call being inlined. while its body compiles, its parameters compile as its arguments, in the frame of the call site.
+struct inlineframe
+{
+    node * definition;
+    node * call;
+    const inlineframe * outer;
+    int depth;
+};
+
+bool inline_functions = true;
+const uint64_t inline_budget = 16; // most nodes a body can have to be inlined
+const int max_inline_depth = 4; // inlined calls inside inlined bodies
+// per thread, since hosts compile scripts for separate contexts on separate threads
+thread_local std::map<std::string, inlinecandidate> inline_candidates; // set up by compile_program()
+thread_local const inlineframe * inlining = nullptr;
+
+bool inlinable_expression(node * tree, node * definition, std::vector<int> & uses, uint64_t & size)
+{
+    if(tree == nullptr)
+        return true;
+    if(++size > inline_budget)
+        return false;
+    if(tree->identity == "corevalue")
+        return true;
+    if(tree->identity == "name")
+    {
+        for(int i = 0; i < definition->arraynodes; i++)
+        {
+            if(definition->nodearray[i]->text == tree->text)
+            {
+                uses[i]++;
+                return true;
+            }
+        }
+        return false;
+    }
+    if(tree->identity == "exp_paren" or tree->identity == "unary_op")
+        return inlinable_expression(tree->right, definition, uses, size);
+    if(tree->identity == "binary_op")
+        return inlinable_expression(tree->left, definition, uses, size) and inlinable_expression(tree->right, definition, uses, size);
+    if(tree->identity == "funccall")
+    {
+        for(int i = 0; tree->right and i < tree->right->arraynodes; i++)
+        {
+            if(!inlinable_expression(tree->right->nodearray[i], definition, uses, size))
+                return false;
+        }
+        return true;
+    }
+    // the names after the first are fields, not variables
+    if(tree->identity == "indirection")
+        return inlinable_expression(tree->nodearray[0], definition, uses, size);
+    return false;
+}
+
+bool calls_function(node * tree)
+{
+    if(tree == nullptr)
+        return false;
+    if(tree->identity == "funccall")
+        return true;
+    for(int i = 0; i < tree->arraynodes; i++)
+    {
+        if(calls_function(tree->nodearray[i]))
+            return true;
+    }
+    return calls_function(tree->left) or calls_function(tree->right);
+}
+
+void find_inline_candidates(node * tree, std::map<std::string, int> & definitions)
+{
+    if(tree == nullptr)
+        return;
+    if(tree->identity == "funcdef")
+    {
+        definitions[tree->text]++;
+        auto block = tree->right;
+        if(block and block->right and block->right->identity == "return" and block->right->right)
+        {
+            inlinecandidate candidate = {tree, block->right->right, std::vector<int>(tree->arraynodes, 0)};
+            uint64_t size = 0;
+            if(inlinable_expression(candidate.body, tree, candidate.uses, size))
+                inline_candidates[tree->text] = candidate;
+        }
+    }
+    for(int i = 0; i < tree->arraynodes; i++)
+        find_inline_candidates(tree->nodearray[i], definitions);
+    find_inline_candidates(tree->left, definitions);
+    find_inline_candidates(tree->right, definitions);
+}
+
+// what an argument really compiles as: inside an inlined body, a parameter is whatever was passed for it
+node * resolve_argument(node * arg)
+{
+    for(auto frame = inlining; frame and arg->identity == "name"; frame = frame->outer)
+    {
+        int i = 0;
+        while(i < frame->definition->arraynodes and frame->definition->nodearray[i]->text != arg->text)
+            i++;
+        if(i == frame->definition->arraynodes)
+            break;
+        arg = frame->call->right->nodearray[i];
+    }
+    return arg;
+}
+
+// the candidate a call can be inlined as, or nullptr
+const inlinecandidate * inline_target(node * call)
+{
+    auto found = inline_candidates.find(call->text);
+    if(found == inline_candidates.end())
+        return nullptr;
+    auto & candidate = found->second;
+    int args = call->right ? call->right->arraynodes : 0;
+    // the verifier reports wrong argument counts
+    if(args != candidate.definition->arraynodes)
+        return nullptr;
+    if(inlining and inlining->depth >= max_inline_depth)
+        return nullptr;
+    for(auto frame = inlining; frame; frame = frame->outer)
+    {
+        if(frame->definition == candidate.definition)
+            return nullptr;
+    }
+    for(int i = 0; i < args; i++)
+    {
+        auto arg = resolve_argument(call->right->nodearray[i]);
+        if(calls_function(arg))
+            return nullptr;
+        bool trivial = arg->identity == "corevalue" or arg->identity == "name";
+        // an unused argument is dropped, and reading a variable that doesn't exist is an error
+        if(candidate.uses[i] == 0 and arg->identity != "corevalue")
+            return nullptr;
+        if(candidate.uses[i] > 1 and !trivial)
+            return nullptr;
+    }
+    return &candidate;
+}
 
-void compile_while(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata)
+void compile_while(node * tree, std::vector<uint8_t> * bytecode, constpool * pool, stackinfo * jumpdata)
 {
     std::vector<uint8_t> conditionhead;
     std::vector<uint8_t> loopblock;
     
     conditionhead.push_back(SAVESCOPE);
-    compile(tree->nodearray[0], &conditionhead, jumpdata);
+    compile(tree->nodearray[0], &conditionhead, pool, jumpdata);
     conditionhead.push_back(TRUTH);
     conditionhead.push_back(JLIF);
     
     stackinfo newjumpinfo;
     loopblock.push_back(OPENSCOPE);
-    compile(tree->nodearray[1], &loopblock, &newjumpinfo);
+    compile(tree->nodearray[1], &loopblock, pool, &newjumpinfo);
     
     newjumpinfo.continues.push_back(loopblock.size());
     loopblock.push_back(BREAK);
     encode_u64(&loopblock, 0);
     
-    uint64_t break_target = loopblock.size();
+    uint64_t exit_target = loopblock.size();
     loopblock.push_back(LOADSCOPE);
+    // BREAK already restores the saved scope depth, so breaks land past the LOADSCOPE that the failed condition uses
+    uint64_t break_target = loopblock.size();
     
     for(auto break_addr : newjumpinfo.breaks)
     {
@@ -2144,7 +2453,7 @@ void compile_while(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jum
             loopblock[break_addr+i+1] = temp[i];
     }
     
-    encode_u64(&conditionhead, break_target+9);
+    encode_u64(&conditionhead, exit_target+9);
     
     uint64_t condition_size = conditionhead.size();
     if(condition_size >= 0x8000'0000'0000'0000)
@@ -2174,20 +2483,23 @@ void compile_while(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jum
             loopblock[continue_addr+i+1] = temp[i];
     }
     
+    // the loop gets a scope of its own, like a for loop's, which the optimizer declares what it hoists out of the loop in
+    bytecode->push_back(OPENSCOPE);
     vector_append(bytecode, conditionhead);
     vector_append(bytecode, loopblock);
+    bytecode->push_back(EXITSCOPE);
 }
 
-void compile_for(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata)
+void compile_for(node * tree, std::vector<uint8_t> * bytecode, constpool * pool, stackinfo * jumpdata)
 {
     std::vector<uint8_t> initblock;
     std::vector<uint8_t> continueblock;
     std::vector<uint8_t> conditionhead;
     std::vector<uint8_t> loopblock;
     
-    compile(tree->nodearray[0], &initblock, jumpdata);
+    compile(tree->nodearray[0], &initblock, pool, jumpdata);
     
-    compile(tree->nodearray[2], &continueblock, jumpdata);
+    compile(tree->nodearray[2], &continueblock, pool, jumpdata);
     
     // jump over continue block
     if(continueblock.size()+3 < 0x8000)
@@ -2206,14 +2518,14 @@ void compile_for(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpd
         exit(0);
     }
     
-    compile(tree->nodearray[1], &conditionhead, jumpdata);
+    compile(tree->nodearray[1], &conditionhead, pool, jumpdata);
     conditionhead.push_back(TRUTH);
     conditionhead.push_back(JLIF);
     
     stackinfo newjumpinfo;
     loopblock.push_back(SAVESCOPE);
     loopblock.push_back(OPENSCOPE);
-    compile(tree->nodearray[3], &loopblock, &newjumpinfo);
+    compile(tree->nodearray[3], &loopblock, pool, &newjumpinfo);
     loopblock.push_back(EXITSCOPE);
     loopblock.push_back(LOADSCOPE);
     
@@ -2292,7 +2604,7 @@ void compile_for(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpd
     bytecode->push_back(EXITSCOPE);
 }
 
-void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata, bool is_lvalue_area)
+void compile(node * tree, std::vector<uint8_t> * bytecode, constpool * pool, stackinfo * jumpdata, bool is_lvalue_area)
 {
     if(tree == nullptr)
     {
@@ -2308,9 +2620,9 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
         }
         else
         {
-            compile(tree->left, bytecode, jumpdata);
+            compile(tree->left, bytecode, pool, jumpdata);
             if(tree->right)
-                compile(tree->right, bytecode, jumpdata);
+                compile(tree->right, bytecode, pool, jumpdata);
             return;
         }
     }
@@ -2323,7 +2635,7 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
         }
         else
         {
-            compile(tree->right, bytecode, jumpdata);
+            compile(tree->right, bytecode, pool, jumpdata);
             if(tree->right->identity == "funccall")
                 bytecode->push_back(POP);
             return;
@@ -2337,15 +2649,17 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
             exit(0);
         }
         
-        // TODO: compile in different ways depending on the nature of the left hand
-        bytecode->push_back(DIRECT);
-        for(const auto & c : tree->left->text)
-            bytecode->push_back(c);
-        bytecode->push_back('\0');
+        if(tree->left->identity == "indirection")
+            compile(tree->left, bytecode, pool, jumpdata, true);
+        else
+        {
+            bytecode->push_back(DIRECT);
+            encode_symbol(bytecode, pool, tree->left->text);
+        }
         
         if(tree->right)
         {
-            compile(tree->right, bytecode, jumpdata);
+            compile(tree->right, bytecode, pool, jumpdata);
             
             bytecode->push_back(BINAS);
             
@@ -2393,13 +2707,11 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
         {
             bytecode->push_back(DECLARE);
             
-            for(const auto & c : tree->right->text)
-                bytecode->push_back(c);
-            bytecode->push_back('\0');
+            encode_symbol(bytecode, pool, tree->right->text);
         }
         else if(tree->right->identity == "deflist" or tree->right->identity == "compound_name")
         {
-            compile(tree->right, bytecode, jumpdata);
+            compile(tree->right, bytecode, pool, jumpdata);
         }
         return;
     }
@@ -2411,23 +2723,19 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
             {
                 bytecode->push_back(DECLARE);
                 
-                for(const auto & c : tree->left->text)
-                    bytecode->push_back(c);
-                bytecode->push_back('\0');
+                encode_symbol(bytecode, pool, tree->left->text);
             }
             else
-                compile(tree->left, bytecode, jumpdata);
+                compile(tree->left, bytecode, pool, jumpdata);
             
             if(tree->right->identity == "name")
             {
                 bytecode->push_back(DECLARE);
                 
-                for(const auto & c : tree->right->text)
-                    bytecode->push_back(c);
-                bytecode->push_back('\0');
+                encode_symbol(bytecode, pool, tree->right->text);
             }
             else
-                compile(tree->right, bytecode, jumpdata);
+                compile(tree->right, bytecode, pool, jumpdata);
             
             return;
         }
@@ -2441,13 +2749,11 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
     {
         if(tree->left and tree->right)
         {
-            compile(tree->right, bytecode, jumpdata);
+            compile(tree->right, bytecode, pool, jumpdata);
             
             bytecode->push_back(DECLSET);
             
-            for(const auto & c : tree->left->text)
-                bytecode->push_back(c);
-            bytecode->push_back('\0');
+            encode_symbol(bytecode, pool, tree->left->text);
             
             return;
         }
@@ -2459,11 +2765,21 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
     }
     if(tree->identity == "name")
     {
+        // a parameter of a function being inlined; inline_target() made sure nothing else is named in its body
+        for(int i = 0; inlining and i < inlining->definition->arraynodes; i++)
+        {
+            if(inlining->definition->nodearray[i]->text == tree->text)
+            {
+                auto frame = inlining;
+                inlining = frame->outer;
+                compile(frame->call->right->nodearray[i], bytecode, pool, jumpdata);
+                inlining = frame;
+                return;
+            }
+        }
         bytecode->push_back(PUSHVAR);
         
-        for(const auto & c : tree->text)
-            bytecode->push_back(c);
-        bytecode->push_back('\0');
+        encode_symbol(bytecode, pool, tree->text);
         
         return;
     }
@@ -2481,10 +2797,7 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
             if(tree->text.length() >= 2 and tree->text[0] == '"' and tree->text[tree->text.size()-1] == '"')
             {
                 bytecode->push_back(PUSHTEXT);
-                
-                for(uint64_t i = 1; i+1 < tree->text.size(); i++)
-                    bytecode->push_back(tree->text[i]);
-                bytecode->push_back('\0');
+                encode_text(bytecode, pool, tree->text.substr(1, tree->text.size()-2));
             }
             else
             {
@@ -2503,7 +2816,7 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
     if(tree->identity == "condition_if")
     {
         // conditional expression
-        compile(tree->nodearray[0], bytecode, jumpdata);
+        compile(tree->nodearray[0], bytecode, pool, jumpdata);
         bytecode->push_back(TRUTH);
         
         if(tree->arraynodes == 3)
@@ -2512,8 +2825,8 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
             std::vector<uint8_t> elseblock;
             mainblock.push_back(OPENSCOPE);
             elseblock.push_back(OPENSCOPE);
-            compile(tree->nodearray[1], &mainblock, jumpdata);
-            compile(tree->nodearray[2], &elseblock, jumpdata);
+            compile(tree->nodearray[1], &mainblock, pool, jumpdata);
+            compile(tree->nodearray[2], &elseblock, pool, jumpdata);
             mainblock.push_back(EXITSCOPE);
             elseblock.push_back(EXITSCOPE);
             
@@ -2560,7 +2873,7 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
         {
             std::vector<uint8_t> mainblock;
             mainblock.push_back(OPENSCOPE);
-            compile(tree->nodearray[1], &mainblock, jumpdata);
+            compile(tree->nodearray[1], &mainblock, pool, jumpdata);
             mainblock.push_back(EXITSCOPE);
             
             // size of a short jump is 3 bytes
@@ -2593,14 +2906,14 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
     }
     if(tree->identity == "condition_else")
     {
-        compile(tree->right, bytecode, jumpdata);
+        compile(tree->right, bytecode, pool, jumpdata);
         return;
     }
     if(tree->identity == "condition_while")
     {
         if(tree->arraynodes == 2)
         {
-            compile_while(tree, bytecode, jumpdata);
+            compile_while(tree, bytecode, pool, jumpdata);
             return;
         }
         else
@@ -2613,7 +2926,7 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
     {
         if(tree->arraynodes == 4)
         {
-            compile_for(tree, bytecode, jumpdata);
+            compile_for(tree, bytecode, pool, jumpdata);
             return;
         }
         else
@@ -2624,13 +2937,13 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
     }
     if(tree->identity == "exp_paren")
     {
-        compile(tree->right, bytecode, jumpdata);
+        compile(tree->right, bytecode, pool, jumpdata);
         return;
     }
     if(tree->identity == "bigblock")
     {
         bytecode->push_back(OPENSCOPE);
-        compile(tree->right, bytecode, jumpdata);
+        compile(tree->right, bytecode, pool, jumpdata);
         bytecode->push_back(EXITSCOPE);
         return;
     }
@@ -2642,8 +2955,8 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
     {
         if(tree->left and tree->left)
         {
-            compile(tree->left, bytecode, jumpdata);
-            compile(tree->right, bytecode, jumpdata);
+            compile(tree->left, bytecode, pool, jumpdata);
+            compile(tree->right, bytecode, pool, jumpdata);
             bytecode->push_back(BINOP);
             
             if(tree->text == "+")
@@ -2688,7 +3001,7 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
     {
         if(tree->right)
         {
-            compile(tree->right, bytecode, jumpdata);
+            compile(tree->right, bytecode, pool, jumpdata);
             bytecode->push_back(UNOP);
             
             if(tree->text == "+")
@@ -2713,28 +3026,81 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
     }
     if(tree->identity == "funccall")
     {
+        if(auto candidate = inline_functions ? inline_target(tree) : nullptr)
+        {
+            inlineframe frame = {candidate->definition, tree, inlining, inlining ? inlining->depth+1 : 1};
+            inlining = &frame;
+            compile(candidate->body, bytecode, pool, jumpdata);
+            inlining = frame.outer;
+            return;
+        }
         if(tree->right)
         {
             for(int i = 0; i < tree->right->arraynodes; i++)
             {
-                compile(tree->right->nodearray[i], bytecode, jumpdata);
+                compile(tree->right->nodearray[i], bytecode, pool, jumpdata);
             }
             bytecode->push_back(CALL);
-            for(auto & c : tree->text)
-                bytecode->push_back(c);
-            bytecode->push_back(0x00);
+            encode_symbol(bytecode, pool, tree->text);
             bytecode->push_back(tree->right->arraynodes);
         }
         else
         {
             bytecode->push_back(CALL);
-            for(auto & c : tree->text)
-                bytecode->push_back(c);
-            bytecode->push_back(0x00);
+            encode_symbol(bytecode, pool, tree->text);
             bytecode->push_back(0x00);
         }
         return;
     }
+    if(tree->identity == "funcdef")
+    {
+        // FUNCDEF jumps over the body, which is only ever entered by CALL. the arguments arrive on the value stack in
+        // order, so the body starts by declaring the parameters from last to first.
+        auto start = bytecode->size();
+        bytecode->push_back(FUNCDEF);
+        encode_u64(bytecode, 0);
+        encode_symbol(bytecode, pool, tree->text);
+        bytecode->push_back(tree->arraynodes);
+        for(int i = tree->arraynodes; i > 0; i--)
+        {
+            bytecode->push_back(DECLSET);
+            encode_symbol(bytecode, pool, tree->nodearray[i-1]->text);
+        }
+        // the top level of the body shares the parameters' scope; loops outside the function can't be broken out of
+        if(tree->right->right)
+            compile(tree->right->right, bytecode, pool, nullptr);
+        bytecode->push_back(PUSHVAL);
+        encode_double(bytecode, 0);
+        bytecode->push_back(RETURN);
+        
+        std::vector<uint8_t> temp;
+        encode_u64(&temp, bytecode->size()-start);
+        for(int i = 0; i < 8; i++)
+            (*bytecode)[start+i+1] = temp[i];
+        return;
+    }
+    if(tree->identity == "return")
+    {
+        // return f(...) is a tail call; TAILCALL needs the RETURN after it for calls it can't turn into jumps
+        if(tree->right and tree->right->identity == "funccall" and !(inline_functions and inline_target(tree->right)))
+        {
+            int args = tree->right->right ? tree->right->right->arraynodes : 0;
+            for(int i = 0; i < args; i++)
+                compile(tree->right->right->nodearray[i], bytecode, pool, jumpdata);
+            bytecode->push_back(TAILCALL);
+            encode_symbol(bytecode, pool, tree->right->text);
+            bytecode->push_back(args);
+        }
+        else if(tree->right)
+            compile(tree->right, bytecode, pool, jumpdata);
+        else
+        {
+            bytecode->push_back(PUSHVAL);
+            encode_double(bytecode, 0);
+        }
+        bytecode->push_back(RETURN);
+        return;
+    }
     if(tree->identity == "order")
     {
         if(!jumpdata)
@@ -2758,7 +3124,7 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
     }
     if(tree->identity == "indirection")
     {
-        compile(tree->nodearray[0], bytecode, jumpdata);
+        compile(tree->nodearray[0], bytecode, pool, jumpdata);
         
         for(int i = 1; i < tree->arraynodes; i++)
         {
@@ -2771,9 +3137,7 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
                 bytecode->push_back(INDIRECT);
             else
                 bytecode->push_back(INDEXP);
-            for(const auto & c : tree->nodearray[i]->text)
-                bytecode->push_back(c);
-            bytecode->push_back(0);
+            encode_symbol(bytecode, pool, tree->nodearray[i]->text);
         }
         
         return;
@@ -2782,8 +3146,37 @@ void compile(node * tree, std::vector<uint8_t> * bytecode, stackinfo * jumpdata,
     return;//exit(0);
 }
 
+bool optimize_bytecode = true; // run compile()'s output through the optimizer before laying it out
+
+// compile() emits version 1 bytecode, which is then optimized, laid out as version 3 for the interpreter and verified
+bool compile_program(node * tree, progstate * program, uint64_t sourcehash = 0)
+{
+    std::vector<uint8_t> portable;
+    constpool pool;
+    std::map<std::string, int> definitions;
+    inline_candidates.clear();
+    find_inline_candidates(tree, definitions);
+    // a name defined twice is a verifier error, which shouldn't be hidden by inlining either definition
+    for(auto & definition : definitions)
+    {
+        if(definition.second > 1)
+            inline_candidates.erase(definition.first);
+    }
+    compile(tree, &portable, &pool, nullptr);
+    inline_candidates.clear();
+    std::vector<uint8_t> code;
+    uint32_t cachecount = 0;
+    if(!convert_bytecode(portable, &code, &cachecount, optimize_bytecode ? &pool : nullptr))
+        return false;
+    program->mod = load_module(build_image(code, pool, sourcehash, cachecount));
+    return program->mod != nullptr;
+}
+
+std::vector<std::string> test_sources; // every source test() has been given, for test_aot()
+
 void test(std::string str)
 {
+    test_sources.push_back(str);
     printf("Case: %s\n", str.data());
     
     auto tokens = lex(str);
@@ -2828,11 +3221,17 @@ void test(std::string str)
             puts("");
             printf("Running compiler:\n");
             progstate program;
-            compile(tree, &program.bytecode, nullptr);
-            printf("Output of compiler: %d bytes:\n", program.bytecode.size());
+            program.global = &global;
+            if(!compile_program(tree, &program))
+            {
+                puts("Failed to compile");
+                return;
+            }
+            printf("Output of compiler: %" PRIu64 " bytes:\n", program.mod->codesize);
             int i = 0;
-            for(const uint8_t & c : program.bytecode)
+            for(uint64_t j = 0; j < program.mod->codesize; j++)
             {
+                auto c = program.mod->code[j];
                 printf("%02X ", c);
                 i++;
                 if(i == 16)
@@ -2842,8 +3241,14 @@ void test(std::string str)
                 }
             }
             puts("");
+            printf("Constant pool: %d texts, %d symbols\n", program.mod->textcount, program.mod->symbolcount);
+            for(uint32_t i = 0; i < program.mod->textcount; i++)
+                printf("  text %u: \"%s\"\n", i, program.mod->text(i).data());
+            for(uint32_t i = 0; i < program.mod->symbolcount; i++)
+                printf("  symbol %u: %s\n", i, program.mod->symbol(i).data());
             printf("Running program:\n");
-            interpret(&program);
+            if(interpret(&program))
+                puts("Exited program");
             puts("");
             program.reset();
             printf("Disassembly:\n");
@@ -2859,83 +3264,1446 @@ void test(std::string str)
         printf(" (No parse)\n\n");
 }
 
+// lexes, parses and compiles a program for benchmarking, without the diagnostic output of test()
+bool build_program(std::string str, progstate * program, uint64_t sourcehash = 0)
+{
+    auto tree = parse(lex(str));
+    if(tree == nullptr)
+        return false;
+    while(tree->parent != nullptr)
+        tree = tree->parent;
+    if(tree->iserror)
+    {
+        puts(tree->error.data());
+        return false;
+    }
+    bool success = compile_program(tree, program, sourcehash);
+    delete_tree(tree);
+    return success;
+}
 
-int main()
+// the same image as it would have been written on a machine with the other byte order: the header and the pool's
+// entries are swapped, and the code is left as it is, since version 1 code is big endian everywhere
+std::vector<uint8_t> swap_byte_order(std::vector<uint8_t> image)
 {
-    // for lexer
+    bytecode_header header;
+    memcpy(&header, image.data(), sizeof(header));
+    uint64_t entries = uint64_t(header.textcount) + header.symbolcount;
+    header.version = __builtin_bswap16(header.version);
+    header.byteorder = __builtin_bswap16(header.byteorder);
+    header.sourcehash = __builtin_bswap64(header.sourcehash);
+    header.textcount = __builtin_bswap32(header.textcount);
+    header.symbolcount = __builtin_bswap32(header.symbolcount);
+    header.cachecount = __builtin_bswap32(header.cachecount);
+    header.codeoffset = __builtin_bswap64(header.codeoffset);
+    header.codesize = __builtin_bswap64(header.codesize);
+    memcpy(image.data(), &header, sizeof(header));
+    for(uint64_t i = 0; i < entries; i++)
     {
-        ops.push_back("&&");
-        ops.push_back("||");
-        
-        //ops.push_back("and");
-        //ops.push_back("or");
-        
-        ops.push_back("++");
-        ops.push_back("--");
-        
-        ops.push_back("+=");
-        ops.push_back("-=");
-        ops.push_back("*=");
-        ops.push_back("/=");
-        
-        ops.push_back("==");
-        ops.push_back("!=");
-        ops.push_back(">=");
-        ops.push_back("<=");
-        
-        ops.push_back(">");
-        ops.push_back("<");
-        
-        ops.push_back("+");
-        ops.push_back("-");
-        ops.push_back("*");
-        ops.push_back("/");
-        
-        ops.push_back("!");
-        
-        ops.push_back("=");
-        ops.push_back(",");
-        
-        ops.push_back(";");
-        ops.push_back("{");
-        ops.push_back("}");
-        ops.push_back("(");
-        ops.push_back(")");
-        
-        ops.push_back(".");
+        poolentry entry;
+        memcpy(&entry, &image[sizeof(header) + i*sizeof(entry)], sizeof(entry));
+        entry.offset = __builtin_bswap32(entry.offset);
+        entry.length = __builtin_bswap32(entry.length);
+        memcpy(&image[sizeof(header) + i*sizeof(entry)], &entry, sizeof(entry));
     }
+    return image;
+}
+
+// images that are built by hand or corrupted have to be turned away by load_module() before anything runs them;
+// version 1 images, of either byte order, are converted and run
+void test_loader()
+{
+    puts("Case: loading bytecode images");
+    constpool pool;
+    pool.symbols.push_back("x");
     
-    test("var x = 2*4+1==9;");
-    test("var x = 1+2*4==3||1;");
-    test("var x = 3==2*4+1||0;");
-    test("var x = 3==1+2*4;");
-    test("var x = 1*2==3+4;");
-    test("var x = 1+2==3*4;");
-    test("var x = 1+2+3*4*5;");
-    test("var x = 1*2*3+4+5;");
-    test("var x = 1*2+3*4+5;");
-    test("var x = 1+2*3+4*5;");
-    test("var x = 1*2+3+4*5;");
-    test("var x = 1+2*3*4+5;");
-    test("var x = 1+2-3+4-5;");
-    test("var x = 1+(2-3)+4-5;");
-    test("var x = 1+2-(3+4)-5;");
-    test("var x = 1+2-3+(4-5);");
-    test("var x = 100-8+7-6-5;");
-    test("var x = 100-8+7-(6-5);");
-    test("var x = 100-(8+7)-6-5;");
-    test("var x = 100-(8+7)-(6-5);");
-    test("var x = 100-(8+(7-6)-5);");
-    test("var x = +5;");
-    test("var x = -5;");
-    test("var x = 5-;");
-    test("var x = *5;");
-    test("var x = 5*;");
-    test("var x = !5;");
-    test("var x = !!5;");
-    test("var x = !0;");
-    test("var x = !!0;");
-    test("var x = or 5;");
+    // var x = 42; in version 1 bytecode
+    std::vector<uint8_t> v1 = {PUSHVAL};
+    double answer = 42;
+    uint64_t bits;
+    memcpy(&bits, &answer, sizeof(bits));
+    for(int i = 7; i >= 0; i--)
+        v1.push_back(bits >> (i*8));
+    vector_append(&v1, std::vector<uint8_t>{DECLSET, 0, 0});
+    std::vector<uint8_t> v3;
+    uint32_t cachecount = 0;
+    if(!convert_bytecode(v1, &v3, &cachecount))
+        return;
+    auto valid = build_image(v3, pool, 0, cachecount);
+    
+    // version 3 code, laid out by hand
+    auto code = [](std::initializer_list<uint8_t> opcodes, int16_t jump = 0, uint16_t index = 0)
+    {
+        std::vector<uint8_t> out;
+        for(auto opcode : opcodes)
+        {
+            out.push_back(opcode);
+            if(opcode == JS)
+                emit_aligned<int16_t>(&out, jump);
+            else if(opcode == PUSHVAL)
+                emit_aligned<double>(&out, 1);
+            else if(opcode == PUSHTEXT or opcode == PUSHVAR)
+                emit_aligned<uint16_t>(&out, index);
+        }
+        return out;
+    };
+    
+    struct { const char * name; std::vector<uint8_t> image; } cases[] = {
+        {"version 3", valid},
+        {"version 1", build_image(v1, pool, 0, 0, BYTECODE_V1)},
+        {"version 1, other byte order", swap_byte_order(build_image(v1, pool, 0, 0, BYTECODE_V1))},
+        {"version 3, other byte order", swap_byte_order(valid)},
+        {"truncated header", std::vector<uint8_t>(valid.begin(), valid.begin()+12)},
+        {"jump past the end", build_image(code({JS}, 100), pool, 0, 0)},
+        {"jump into an operand", build_image(code({JS, PUSHVAL, POP}, 8), pool, 0, 0)},
+        {"stack underflow", build_image(code({PUSHVAL, POP, POP}), pool, 0, 0)},
+        {"scope restored without being saved", build_image(code({OPENSCOPE, LOADSCOPE}), pool, 0, 0)},
+        {"scope restored after it closed", build_image(code({OPENSCOPE, SAVESCOPE, EXITSCOPE, LOADSCOPE}), pool, 0, 0)},
+        {"text index out of range", build_image(code({PUSHTEXT, POP}, 0, 0), pool, 0, 0)},
+        {"symbol index out of range", build_image(code({PUSHVAR, POP}, 0, 1), pool, 0, 0)},
+    };
+    for(auto & c : cases)
+    {
+        progstate program;
+        program.global = &global;
+        program.mod = load_module(c.image);
+        if(program.mod == nullptr)
+        {
+            printf("rejected: %s\n", c.name);
+            continue;
+        }
+        if(interpret(&program))
+            printf("loaded: %s, x = %f\n", c.name, program.variables[0].find(symtab.intern("x"))->real);
+    }
+}
+
+// registers an object type with its event scripts given as source; an empty source leaves that event unhandled
+// returns the object_id, or NO_TYPE if a script fails to compile
+uint32_t register_object(globalstate * context, const std::string & name, const std::string & create, const std::string & step, const std::string & destroy)
+{
+    moduleref events[EVENT_COUNT];
+    const std::string * sources[EVENT_COUNT] = {&create, &step, &destroy};
+    for(uint32_t event = 0; event < EVENT_COUNT; event++)
+    {
+        if(sources[event]->empty())
+            continue;
+        progstate script;
+        if(!build_program(*sources[event], &script))
+        {
+            printf("Error: event %u of object %s failed to compile\n", event, name.data());
+            return NO_TYPE;
+        }
+        events[event] = script.mod;
+    }
+    auto type = context->define_object(name);
+    for(uint32_t event = 0; event < EVENT_COUNT; event++)
+        context->objects[type].events[event] = events[event];
+    return type;
+}
+
+// object types: create runs on instance_create, step once per dispatch pass, destroy on instance_destroy, including
+// an instance destroying itself from inside its own step event
+void test_objects()
+{
+    puts("Case: object events");
+    auto ball = register_object(&global, "ball", "var vy = 0; y = 10;", "vy += 1; y += vy;", "print(y);");
+    auto counter = register_object(&global, "counter", "var steps = 0;", "steps += 1; x = steps; if(steps == 2) instance_destroy(id);", "print(\"counter destroyed\");");
+    if(ball == NO_TYPE or counter == NO_TYPE)
+        return;
+    
+    progstate program;
+    program.global = &global;
+    std::string source = "var a = instance_create(0, 0, " + std::to_string(ball) + "), c = instance_create(0, 0, " + std::to_string(counter) + ");";
+    if(!build_program(source, &program) or !interpret(&program))
+        return;
+    double a = program.variables[0].find(symtab.intern("a"))->real;
+    double c = program.variables[0].find(symtab.intern("c"))->real;
+    for(int step = 0; step < 3; step++)
+        global.dispatch(EVENT_STEP);
+    printf("ball y after 3 steps: %f\n", global.ys[global.find_position(a)]);
+    printf("counter alive: %d\n", global.find_instance(c) != nullptr);
+    global.instance_destroy(a);
+    printf("ball alive: %d\n", global.find_instance(a) != nullptr);
+}
+
+// a type whose create event creates another of itself: the events nest until the innermost one stops on an error,
+// and every instance made on the way down is still there afterwards
+void test_nested_events()
+{
+    puts("Case: nested events");
+    auto type = std::to_string(global.objects.size());
+    auto spawner = register_object(&global, "spawner", "instance_create(0, 0, " + type + ");", "", "");
+    if(spawner == NO_TYPE)
+        return;
+    global.instance_create(0, 0, spawner);
+    printf("spawners: %zu, nesting after: %u\n", global.objects[spawner].members.size(), global.nesting);
+    while(global.objects[spawner].members.size() > 0)
+        global.instance_destroy(global.id_of(global.objects[spawner].members.back()));
+}
+
+// isolated step scripts on worker threads: every pusher bumps the anchor and copies its x, but sees it as it was when
+// the pass started, and the bumps land once the pass is over, so any number of threads gives the same result, and so
+// does running them with no threads at all
+void test_parallel()
+{
+    puts("Case: parallel step");
+    double anchor = global.instance_create(0, 0, -1);
+    std::string target = "(" + std::to_string(uint64_t(anchor)) + ")";
+    auto pusher = register_object(&global, "pusher", "", "x += 1; " + target + ".x += 1; y = " + target + ".x;", "");
+    if(pusher == NO_TYPE)
+        return;
+    printf("step script isolated: %d\n", global.objects[pusher].events[EVENT_STEP]->isolated);
+    for(uint32_t threads : {0, 1, 3})
+    {
+        global.set_threads(threads);
+        std::vector<double> ids;
+        for(int i = 0; i < 1000; i++)
+            ids.push_back(global.instance_create(0, 0, pusher));
+        global.xs[global.find_position(anchor)] = 0;
+        for(int step = 0; step < 2; step++)
+            global.dispatch(EVENT_STEP);
+        double total = 0;
+        for(auto id : ids)
+            total += global.ys[global.find_position(id)];
+        printf("%d threads: anchor x %f, pusher y total %f\n", threads, global.xs[global.find_position(anchor)], total);
+        for(auto id : ids)
+            global.instance_destroy(id);
+    }
+    global.set_threads(0);
+    global.instance_destroy(anchor);
+}
+
+// a host registering its own native function
+void test_natives()
+{
+    builtins.add("lerp", 3, [](progstate * program, const value * args, value * result)
+    {
+        *result = args[0].real + (args[1].real - args[0].real) * args[2].real;
+        return true;
+    });
+    test("print(lerp(10, 20, 0.25));");
+    test("var a = 2; print(lerp(a, a*2, 1) + lerp(0, 1, 0.5));");
+    test("print(lerp(1, 2));");
+}
+
+// whether two runs of the same program ended the same way, with the same root variables; NaN matches NaN
+bool same_outcome(progstate * runs, bool * results)
+{
+    bool same = results[0] == results[1] and runs[0].stack.size() == runs[1].stack.size()
+        and runs[0].variables.size() == runs[1].variables.size();
+    if(same and runs[0].variables.size() > 0)
+    {
+        auto & left = runs[0].variables[0];
+        auto & right = runs[1].variables[0];
+        same = left.layout == right.layout and left.values.size() == right.values.size();
+        for(uint64_t i = 0; same and i < left.values.size(); i++)
+        {
+            auto & l = left.values[i];
+            auto & r = right.values[i];
+            same = l.is_number == r.is_number and (l.is_number ? (l.real == r.real or (l.real != l.real and r.real != r.real)) : l.text == r.text);
+        }
+    }
+    return same;
+}
+
+// runs programs through the interpreter and the jit, and checks that they end up in the same state
+void test_jit()
+{
+    puts("Case: jit against interpreter");
+    const char * programs[] = {
+        "var a = 1, b = 2, s = 0; for(var i = 0; i < 100; i++) { s += a * i - b / 2; if(s > 50) s -= 25; } var t = s == 0 or a != b;",
+        "var y = 0, v = 0; while(y < 100) { v += 0.5; y += v; } while(1) { v++; break; } var w = y - v;",
+        "var s = \"a\"; var n = 0; for(var i = 0; i < 5; i++) { s += \"b\"; n++; } var same = s == \"abbbbb\";",
+        "function fib(n) { if(n < 2) return n; return fib(n-1) + fib(n-2); } var r = fib(12);",
+        "function down(n, acc) { if(n == 0) return acc; return down(n - 1, acc + n); } var r = down(5000, 0);",
+        "function f(x) { var k = 0; while(1) { k++; if(k > x) return k; } } var r = f(7) + f(2);",
+        "var a = instance_create(1, 2, 0); a.x += 5; a.y = a.x * 2; var ax = a.x, ay = a.y; instance_destroy(a); a = 0;",
+        "var x = 1; if(x) { var y = 2; x = y + 1; } else { x = 0; } var z = x;",
+        "var q = 1; q = q + missing;",
+        "var g = \"s\"; var v = 0; v += g; print(v);",
+        "var v = \"s\"; v -= 1;",
+        "var x; x = \"hello\"; var s = \"\"; s = 5; s += 1;",
+    };
+    for(auto source : programs)
+    {
+        progstate runs[2];
+        bool results[2];
+        for(int jit = 0; jit < 2; jit++)
+        {
+            global.jit = jit;
+            runs[jit].global = &global;
+            results[jit] = build_program(source, &runs[jit]) and interpret(&runs[jit]);
+        }
+        global.jit = false;
+        bool same = same_outcome(runs, results);
+        printf("%s: %s\n", same ? "jit matches" : "jit MISMATCH", source);
+    }
+}
+
+void test_tracing()
+{
+    puts("Case: traced loops against interpreter");
+    const char * programs[] = {
+        "var y = 0, v = 0, g = 0.5, floor = 300, bounces = 0; for(var i = 0; i < 2000; i++) { v += g/2; y += v; v += g/2; if(y > floor) { y = floor; v = -v * 0.9; bounces += 1; } }",
+        "var a = 0, b = 0; for(var i = 0; i < 300; i++) { if(i < 150) a += 1; else b -= 2; }",
+        "var i = 0, s = 0; while(i < 500 and !(s < -1)) { i += 1; s = s + i * 0.5 - (i > 250) * i; }",
+        "var t = 0; for(var i = 0; i < 20; i++) { for(var j = 0; j < 100; j++) { t += i * j / 3; } }",
+        "var z = 0/0, n = 0, x = 1; while(n < 100 and z) { n++; x = -x * 0.99 + !n + (n >= 50 or n <= 2); }",
+        "function f(n) { var s = 0; for(var i = 0; i < n; i++) s += i * i; return s; } var r = f(200) + f(300);",
+        "var s = \"\", n = 0; for(var i = 0; i < 100; i++) { s += \"a\"; n += 2; }",
+        "var q = 0; for(var i = 0; i < 100; i++) { q += 1; if(i >= 60) q = q + missing; }",
+        "var x = 0; for(var i = 0; i < 200; i++) { if(i < 150) x += 1; else x = \"s\"; }",
+    };
+    for(auto source : programs)
+    {
+        progstate runs[2];
+        bool results[2];
+        for(int tracing = 0; tracing < 2; tracing++)
+        {
+            global.tracing = tracing;
+            runs[tracing].global = &global;
+            results[tracing] = build_program(source, &runs[tracing]) and interpret(&runs[tracing]);
+        }
+        global.tracing = true;
+        bool same = same_outcome(runs, results);
+        int traced = 0;
+        if(runs[1].mod)
+        {
+            for(auto & loop : runs[1].mod->loops)
+                traced += loop.count.load() == LOOP_TRACED;
+        }
+        printf("%s (%d traced): %s\n", same ? "tracing matches" : "tracing MISMATCH", traced, source);
+    }
+}
+
+// two contexts, each with its own object type and instances, stepped at the same time on separate threads; they don't
+// share any state, so both come out the same as if they'd run alone
+void test_contexts()
+{
+    puts("Case: independent contexts");
+    double totals[2] = {0, 0};
+    auto session = [](double * total)
+    {
+        globalstate context;
+        auto ball = register_object(&context, "ball", "var vy = 0;", "vy += 1; y += vy;", "");
+        if(ball == NO_TYPE)
+            return;
+        for(int i = 0; i < 1000; i++)
+            context.instance_create(i, 0, ball);
+        for(int step = 0; step < 100; step++)
+            context.dispatch(EVENT_STEP);
+        for(auto y : context.ys)
+            *total += y;
+    };
+    std::thread other(session, &totals[1]);
+    session(&totals[0]);
+    other.join();
+    printf("context totals: %f %f\n", totals[0], totals[1]);
+}
+
+bool read_file(const std::string & path, std::vector<uint8_t> * data)
+{
+    auto file = fopen(path.data(), "rb");
+    if(file == nullptr)
+        return false;
+    data->clear();
+    uint8_t buffer[4096];
+    size_t got;
+    while((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data->insert(data->end(), buffer, buffer+got);
+    fclose(file);
+    return true;
+}
+
+// writes to a temporary file and renames it over the destination, so that processes that have the old file
+// mapped keep seeing the old contents instead of having it truncated under them
+bool write_file(const std::string & path, const uint8_t * data, uint64_t size)
+{
+    auto temppath = path + ".tmp";
+    auto file = fopen(temppath.data(), "wb");
+    if(file == nullptr)
+        return false;
+    bool success = fwrite(data, 1, size, file) == size;
+    success = (fclose(file) == 0) and success;
+#ifdef _WIN32
+    remove(path.data());
+#endif
+    if(!success or rename(temppath.data(), path.data()) != 0)
+    {
+        remove(temppath.data());
+        return false;
+    }
+    return true;
+}
+
+// loads a program from the bytecode cache at cachepath if it was compiled from this exact source,
+// otherwise compiles it and writes the cache
+// cache hits are mapped rather than read, see map_module()
+bool load_program(const std::string & source, const std::string & cachepath, progstate * program, bool * cache_hit = nullptr)
+{
+    auto hash = hash_source(source);
+    if(cache_hit)
+        *cache_hit = false;
+    
+    // compare the hash before mapping, so a stale cache costs nothing but reading its header
+    bytecode_header header;
+    auto file = fopen(cachepath.data(), "rb");
+    if(file)
+    {
+        bool have_header = fread(&header, 1, sizeof(header), file) == sizeof(header);
+        fclose(file);
+        if(have_header and header.byteorder == 0x0102 and header.sourcehash == hash
+           and (program->mod = map_module(cachepath)) and program->mod->sourcehash == hash)
+        {
+            if(cache_hit)
+                *cache_hit = true;
+            return true;
+        }
+    }
+    
+    if(!build_program(source, program, hash))
+        return false;
+    if(!write_file(cachepath, program->mod->image, program->mod->imagesize))
+        printf("Warning: could not write bytecode cache %s\n", cachepath.data());
+    return true;
+}
+
+// a string as one single-quoted shell word, whatever it contains
+std::string shell_quote(const std::string & text)
+{
+    std::string quoted = "'";
+    for(auto c : text)
+    {
+        if(c == '\'')
+            quoted += "'\\''";
+        else
+            quoted += c;
+    }
+    return quoted + "'";
+}
+
+// compiles generated code into a shared library with the system compiler ($CXX, or c++)
+bool compile_aot(const std::string & sourcepath, const std::string & librarypath)
+{
+    auto compiler = getenv("CXX");
+    std::string command = std::string(compiler ? compiler : "c++") + " -std=c++17 -O2 -shared -fPIC -w -o "
+        + shell_quote(librarypath) + " " + shell_quote(sourcepath);
+    return system(command.data()) == 0;
+}
+
+// compiles a script to bytecode (cached as usual) and then to a native library next to it, which run_file() picks up
+// in place of interpreting the bytecode for as long as the script doesn't change
+int build_aot(const std::string & path)
+{
+    globalstate context;
+    progstate program;
+    program.global = &context;
+    std::vector<uint8_t> data;
+    if(!read_file(path, &data))
+    {
+        printf("Error: could not read %s\n", path.data());
+        return 1;
+    }
+    if(!load_program(std::string(data.begin(), data.end()), path + ".ngbc", &program))
+        return 1;
+    auto code = aot_emit(*program.mod);
+    if(code.empty())
+    {
+        printf("Error: %s can't be compiled ahead of time\n", path.data());
+        return 1;
+    }
+    code = aot_prelude + code;
+    auto sourcepath = path + ".aot.cpp";
+    if(!write_file(sourcepath, (const uint8_t *)code.data(), code.size()) or !compile_aot(sourcepath, path + ".so"))
+    {
+        printf("Error: could not build %s.so\n", path.data());
+        return 1;
+    }
+    remove(sourcepath.data());
+    return 0;
+}
+
+// runs a script file, reusing the compiled bytecode cached next to it in <path>.ngbc when the source hasn't changed
+// a .ngbc module given directly is mapped and run without needing its source
+int run_file(const std::string & path)
+{
+    globalstate context;
+    progstate program;
+    program.global = &context;
+    if(path.size() > 5 and path.substr(path.size()-5) == ".ngbc")
+    {
+        program.mod = map_module(path);
+        if(!program.mod)
+        {
+            printf("Error: could not load module %s\n", path.data());
+            return 1;
+        }
+        attach_aot(*program.mod, open_aot_library(path.substr(0, path.size()-5) + ".so"));
+        if(interpret(&program))
+            puts("Exited program");
+        return 0;
+    }
+    
+    std::vector<uint8_t> data;
+    if(!read_file(path, &data))
+    {
+        printf("Error: could not read %s\n", path.data());
+        return 1;
+    }
+    if(!load_program(std::string(data.begin(), data.end()), path + ".ngbc", &program))
+        return 1;
+    attach_aot(*program.mod, open_aot_library(path + ".so"));
+    if(interpret(&program))
+        puts("Exited program");
+    return 0;
+}
+
+#ifndef _WIN32
+// runs a function with stdout going to a temporary file, and returns what it printed
+template<typename F>
+std::string capture_output(F function)
+{
+    fflush(stdout);
+    auto file = tmpfile();
+    if(file == nullptr)
+    {
+        function();
+        return "";
+    }
+    int saved = dup(1);
+    dup2(fileno(file), 1);
+    function();
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    std::string output;
+    rewind(file);
+    char buffer[4096];
+    size_t got;
+    while((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        output.append(buffer, got);
+    fclose(file);
+    return output;
+}
+
+// optimized code against the same code unoptimized, on programs with something for each pass to do. the instruction
+// counts are what each pass left, which is the same on every run
+void test_optimizer()
+{
+    puts("Case: optimized against unoptimized");
+    const char * programs[] = {
+        "var y = 0, v = 0, g = 0.5, floor = 300, bounces = 0; for(var i = 0; i < 2000; i++) { v += g/2; y += v; v += g/2; if(y > floor) { y = floor; v = -v * 0.9; bounces += 1; } }",
+        "var t = 0; for(var j = 0; j < 10; j++) { for(var i = 0; i < 100; i++) { t += j * j + i; t -= (j - 1) / 2; } }",
+        "var t = 0; for(var i = 0; i < 100; i++) { t += (i * 3 - 1) * (i * 3 - 1) * (i * 3 - 1); }",
+        "var s = \"ab\", n = 2; if(n > 1) { var r = (s + s) + \"-\" + (s + s) + \"-\" + (s + s); print(r); }",
+        "var x = 1, y = 2; x = y * 2; x = y + 1; print(x);",
+        "function f(a) { var b = 0; b = a; return b * b + b; } print(f(3)); print(f(0.5));",
+        "var v = 1; { var v = \"s\"; print(v + v); } v += 1; print(v * 3);",
+        "var q = 0; for(var i = 0; i < 100; i++) { q += 1; if(i >= 60) q = q + missing; }",
+        "var g = 0.5, heavy = 1; if(heavy) g = 0.75; var y = 0, v = 0, n = 0; while(n < 500) { v += g/2; y += v; n += 1; } print(y);",
+        "var x = 0, w = 0, i = 1; while(i < 300) { x += i * 4; if(x > 50) w = x - i * 4; i += 3; } print(x); print(w);",
+        "var x = 0, i = 0, s = 1; while(i < 50) { x += i * 0.75 + i * 0.75; i += s; s = 2; } print(x);",
+        "var h = 7; print(h / 8); print(h / 0.25); print(h / 3); print(-h / 0.5);",
+        "var x = 1; x += 2; x = \"a\"; x += \"b\"; print(x); x = 4; x *= 2; print(x);",
+    };
+    for(auto source : programs)
+    {
+        progstate runs[2];
+        bool results[2];
+        std::string outputs[2];
+        irpassstats before[IRPASS_COUNT];
+        for(int optimized = 0; optimized < 2; optimized++)
+        {
+            optimize_bytecode = optimized;
+            std::copy(ir_stats, ir_stats+IRPASS_COUNT, before);
+            runs[optimized].global = &global;
+            outputs[optimized] = capture_output([&]
+            {
+                results[optimized] = build_program(source, &runs[optimized]) and interpret(&runs[optimized]);
+            });
+        }
+        optimize_bytecode = true;
+        bool same = same_outcome(runs, results) and outputs[0] == outputs[1];
+        std::string counts = std::to_string(ir_stats[IRPASS_BUILD].before - before[IRPASS_BUILD].before);
+        for(int pass = IRPASS_PROPAGATE; pass < IRPASS_LOWER; pass++)
+            counts += " " + std::to_string(ir_stats[pass].after - before[pass].after);
+        printf("%s (instructions after each pass: %s): %s\n", same ? "optimizer matches" : "optimizer MISMATCH", counts.data(), source);
+    }
+}
+
+// how many of the operations in the cases test() ran were proved to be on numbers, and specialized
+void test_specialization()
+{
+    puts("Case: type specialization");
+    uint64_t generic[3] = {0, 0, 0}; // binary, unary, truth
+    uint64_t specialized[3] = {0, 0, 0};
+    capture_output([&]
+    {
+        for(auto & source : test_sources)
+        {
+            progstate program;
+            program.global = &global;
+            if(!build_program(source, &program))
+                continue;
+            auto bytecode = program.mod->code;
+            auto codesize = program.mod->codesize;
+            for(uint64_t pc = 0; pc < codesize; pc += aligned_layout_size(bytecode[pc], pc))
+            {
+                switch(bytecode[pc])
+                {
+                case BINOP: generic[0]++; break;
+                case UNOP: generic[1]++; break;
+                case TRUTH: generic[2]++; break;
+                case NUMBINOP: specialized[0]++; break;
+                case NUMUNOP: specialized[1]++; break;
+                case NUMTRUTH: specialized[2]++; break;
+                }
+            }
+        }
+    });
+    const char * kinds[3] = {"binary", "unary", "truth"};
+    uint64_t total[2] = {0, 0};
+    for(int kind = 0; kind < 3; kind++)
+    {
+        printf("%s: %d specialized, %d generic\n", kinds[kind], int(specialized[kind]), int(generic[kind]));
+        total[0] += specialized[kind];
+        total[1] += specialized[kind] + generic[kind];
+    }
+    printf("specialized %d of %d operations\n", int(total[0]), int(total[1]));
+}
+
+// every case test() ran, interpreted and compiled ahead of time, each in a fresh context so instance ids line up.
+// all the modules go in one library, so the compiler only runs once.
+void test_aot()
+{
+    puts("Case: ahead of time compilation against interpreter");
+    std::vector<std::string> sources;
+    std::string code = aot_prelude;
+    capture_output([&]
+    {
+        for(auto & source : test_sources)
+        {
+            progstate program;
+            program.global = &global;
+            if(!build_program(source, &program) or !program.mod->verified)
+                continue;
+            auto function = aot_emit(*program.mod);
+            if(function.empty())
+                continue;
+            // the same source twice is the same function twice
+            if(code.find(aot_symbol(*program.mod)) == std::string::npos)
+                code += function;
+            sources.push_back(source);
+        }
+    });
+    auto directory = getenv("TMPDIR");
+    auto base = std::string(directory ? directory : "/tmp") + "/notgml_aot_" + std::to_string(getpid());
+    if(!write_file(base + ".cpp", (const uint8_t *)code.data(), code.size()) or !compile_aot(base + ".cpp", base + ".so"))
+    {
+        remove((base + ".cpp").data());
+        puts("couldn't build the library; skipped");
+        return;
+    }
+    auto library = open_aot_library(base + ".so");
+    remove((base + ".cpp").data());
+    remove((base + ".so").data());
+    if(!library)
+    {
+        puts("couldn't load the library; skipped");
+        return;
+    }
+    
+    int matched = 0;
+    for(auto & source : sources)
+    {
+        globalstate contexts[2];
+        progstate runs[2];
+        bool results[2] = {false, false};
+        bool attached = true;
+        std::string outputs[2];
+        for(int aot = 0; aot < 2; aot++)
+        {
+            outputs[aot] = capture_output([&]
+            {
+                runs[aot].global = &contexts[aot];
+                if(!build_program(source, &runs[aot]))
+                    return;
+                if(aot)
+                    attached = attach_aot(*runs[aot].mod, library);
+                results[aot] = interpret(&runs[aot]);
+            });
+        }
+        bool same = attached and outputs[0] == outputs[1] and same_outcome(runs, results);
+        if(same)
+            matched++;
+        else
+            printf("aot MISMATCH: %s\n", source.data());
+    }
+    printf("aot matches the interpreter on %d of %d cases\n", matched, int(sources.size()));
+}
+#endif
+
+template<typename F>
+double time_seconds(F function)
+{
+    auto start = std::chrono::steady_clock::now();
+    function();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+std::vector<std::string> benchmark_programs = {
+"var y = 0, vspeed = 0, gravity = 0.001, i = 0;\n"
+"while(i < 1000000)\n"
+"{\n"
+"    vspeed += gravity/2;\n"
+"    y += vspeed;\n"
+"    vspeed += gravity/2;\n"
+"    if(y > 1000) y = 0;\n"
+"    i++;\n"
+"}\n",
+"var total = 0;\n"
+"for(var i = 0; i < 300000; i++)\n"
+"{\n"
+"    var a = i*2, b = a-i;\n"
+"    total += a/(b+1) + !(a == b);\n"
+"}\n",
+"var s = \"\";\n"
+"for(var i = 0; i < 200000; i++)\n"
+"{\n"
+"    if(s == \"abc\") s = \"\"; else s += \"a\";\n"
+"}\n",
+};
+
+// compares the checked interpreter against the unchecked one that verified programs run through
+void benchmark_verifier()
+{
+    puts("Checked vs. verified (unchecked) interpreter:");
+    global.tracing = false; // only verified code gets traced, which would hide what dropping the checks gains
+    for(size_t i = 0; i < benchmark_programs.size(); i++)
+    {
+        progstate program;
+        program.global = &global;
+        if(!build_program(benchmark_programs[i], &program))
+        {
+            printf("Benchmark program %zu failed to compile\n", i);
+            continue;
+        }
+        double checked = 1e30, unchecked = 1e30;
+        for(int run = 0; run < 3; run++)
+        {
+            program.reset();
+            checked = std::min(checked, time_seconds([&]{ interpret_impl<true>(&program); }));
+            program.reset();
+            unchecked = std::min(unchecked, time_seconds([&]{ interpret_impl<false>(&program); }));
+        }
+        printf("program %zu: checked %.4fs, unchecked %.4fs (%.1f%% faster)\n", i, checked, unchecked, (checked/unchecked-1)*100);
+    }
+    global.tracing = true;
+}
+
+// variable-heavy code: many live variables, nested scopes, and lookups that have to walk out through several of them
+std::string benchmark_variables_program =
+"var a = 1, b = 2, c = 3, d = 4, e = 5, f = 6, g = 7, h = 8, k = 9, m = 10, n = 11, p = 12;\n"
+"for(var i = 0; i < 300000; i++)\n"
+"{\n"
+"    var t = a + b * c;\n"
+"    d += t - e;\n"
+"    f = g + h + k;\n"
+"    {\n"
+"        var u = m * n, w = u - t;\n"
+"        p += w;\n"
+"        a = d - f + p - p;\n"
+"    }\n"
+"}\n";
+
+void benchmark_variables()
+{
+    puts("Variable access:");
+    progstate program;
+    program.global = &global;
+    if(!build_program(benchmark_variables_program, &program))
+    {
+        puts("Benchmark program failed to compile");
+        return;
+    }
+    double best = 1e30;
+    for(int run = 0; run < 3; run++)
+    {
+        program.reset();
+        best = std::min(best, time_seconds([&]{ interpret(&program); }));
+    }
+    printf("%.4fs\n", best);
+}
+
+// repeated field access on other instances, with enough live instances that the instance table isn't trivially small
+std::string benchmark_fields_program =
+"for(var i = 0; i < 1000; i++)\n"
+"{\n"
+"    instance_create(i, i, 0);\n"
+"}\n"
+"var a = instance_create(1, 2, 0), b = instance_create(3, 4, 0);\n"
+"var s = 0;\n"
+"for(var i = 0; i < 200000; i++)\n"
+"{\n"
+"    s += a.x * b.y - b.x + a.id.id.y;\n"
+"}\n";
+
+void benchmark_fields()
+{
+    puts("Instance field access:");
+    progstate program;
+    program.global = &global;
+    if(!build_program(benchmark_fields_program, &program))
+    {
+        puts("Benchmark program failed to compile");
+        return;
+    }
+    double best = 1e30;
+    for(int run = 0; run < 3; run++)
+    {
+        program.reset();
+        best = std::min(best, time_seconds([&]{ interpret(&program); }));
+    }
+    printf("%.4fs\n", best);
+}
+
+// instance table with 100k live instances: spawning, dereferencing ids in scattered order, updating every instance's
+// position once per frame, and churn
+void benchmark_instances()
+{
+    puts("Instance table, 100000 live instances:");
+    const uint64_t count = 100000;
+    std::vector<double> ids(count);
+    double spawn = time_seconds([&]
+    {
+        for(uint64_t i = 0; i < count; i++)
+        {
+            ids[i] = global.instance_spawn();
+            global.xs[global.find_position(ids[i])] = i;
+        }
+    });
+    
+    double sum = 0;
+    double lookup = time_seconds([&]
+    {
+        uint64_t j = 0;
+        for(uint64_t i = 0; i < count*10; i++)
+        {
+            j = (j + 7919) % count;
+            sum += global.xs[global.find_position(ids[j])];
+        }
+    });
+    double frames = time_seconds([&]
+    {
+        auto xs = global.xs.data();
+        auto ys = global.ys.data();
+        uint64_t live = global.live.size();
+        for(int frame = 0; frame < 100; frame++)
+        {
+            for(uint64_t i = 0; i < live; i++)
+            {
+                xs[i] += 1;
+                ys[i] += xs[i]*0.5;
+            }
+        }
+    });
+    
+    // destroy every other instance and replace it, then make sure the old ids went stale
+    std::vector<double> released;
+    double churn = time_seconds([&]
+    {
+        for(uint64_t i = 0; i < count; i += 2)
+        {
+            released.push_back(ids[i]);
+            global.instance_release(ids[i]);
+            ids[i] = global.instance_spawn();
+        }
+    });
+    for(auto id : released)
+    {
+        if(global.find_instance(id) != nullptr)
+        {
+            puts("Error: id of a destroyed instance still resolves");
+            break;
+        }
+    }
+    
+    for(auto id : ids)
+        global.instance_release(id);
+    printf("spawn %.4fs, %" PRIu64 " scattered lookups %.4fs, 100 frames of position updates %.4fs, %" PRIu64 " destroy+spawn %.4fs (checksum %.0f)\n",
+        spawn, count*10, lookup, frames, count/2, churn, sum);
+}
+
+// creating and destroying instances in a loop; the instance table and its recycled states shouldn't grow
+std::string benchmark_churn_program =
+"for(var i = 0; i < 100000; i++)\n"
+"{\n"
+"    var a = instance_create(i, i, 0), b = instance_create(i, i, 1);\n"
+"    instance_destroy(a);\n"
+"    instance_destroy(b);\n"
+"}\n";
+
+void benchmark_churn()
+{
+    puts("Instance churn:");
+    progstate program;
+    program.global = &global;
+    if(!build_program(benchmark_churn_program, &program))
+    {
+        puts("Benchmark program failed to compile");
+        return;
+    }
+    auto slots = global.slots.size();
+    double best = 1e30;
+    for(int run = 0; run < 3; run++)
+    {
+        program.reset();
+        best = std::min(best, time_seconds([&]{ interpret(&program); }));
+    }
+    printf("%.4fs, instance table grew by %zu slots\n", best, global.slots.size() - slots);
+}
+
+// one compiled script run by many instances, which all share a single copy of its module
+std::string benchmark_shared_program =
+"var a = 1, b = 2;\n"
+"for(var i = 0; i < 20; i++)\n"
+"{\n"
+"    a += b * i;\n"
+"}\n";
+
+void benchmark_shared_code()
+{
+    puts("Shared code, one script run by 10000 instances:");
+    progstate compiled;
+    if(!build_program(benchmark_shared_program, &compiled))
+    {
+        puts("Benchmark program failed to compile");
+        return;
+    }
+    std::vector<double> ids;
+    for(int i = 0; i < 10000; i++)
+    {
+        ids.push_back(global.instance_spawn());
+        global.find_instance(ids.back())->mod = compiled.mod;
+    }
+    long users = compiled.mod.use_count();
+    double run = time_seconds([&]
+    {
+        for(auto id : ids)
+            interpret(global.find_instance(id));
+    });
+    for(auto id : ids)
+        global.instance_release(id);
+    printf("%.4fs, %ld references to one %" PRIu64 " byte module\n", run, users, compiled.mod->imagesize);
+}
+
+// step events of two object types, with their instances created interleaved; compares dispatching type by type against
+// running each instance's step in creation order
+void benchmark_objects()
+{
+    puts("Step dispatch, 2 object types, 10000 instances, 100 steps:");
+    auto faller = register_object(&global, "faller", "var vy = 0;", "vy += 0.5; y += vy; if(y > 100) { y = 100; vy = -vy/2; }", "");
+    auto walker = register_object(&global, "walker", "var dir = 1;", "x += dir; if(x > 100) { dir = -1; } if(x < 0) { dir = 1; }", "");
+    if(faller == NO_TYPE or walker == NO_TYPE)
+        return;
+    std::vector<double> ids;
+    for(int i = 0; i < 5000; i++)
+    {
+        ids.push_back(global.instance_create(i % 100, 0, faller));
+        ids.push_back(global.instance_create(i % 100, 0, walker));
+    }
+    double sorted = time_seconds([&]
+    {
+        for(int step = 0; step < 100; step++)
+            global.dispatch(EVENT_STEP);
+    });
+    double unsorted = time_seconds([&]
+    {
+        for(int step = 0; step < 100; step++)
+        {
+            for(auto id : ids)
+            {
+                auto type = global.type_of(global.object_ids[global.find_position(id)]);
+                run_event(global.find_instance(id), global.objects[type].events[EVENT_STEP], false);
+            }
+        }
+    });
+    for(auto id : ids)
+        global.instance_destroy(id);
+    printf("by type %.4fs, in creation order %.4fs\n", sorted, unsorted);
+}
+
+// isolated step events on 1 to N threads; every instance steers towards an anchor instance and nudges it, so the pass
+// reads and writes across instances, and every thread count has to come out with the same positions
+void benchmark_parallel()
+{
+    puts("Parallel step dispatch, 10000 instances, 20 steps:");
+    double anchor = global.instance_create(500, 500, -1);
+    std::string target = "(" + std::to_string(uint64_t(anchor)) + ")";
+    auto swarm = register_object(&global, "swarm", "var vx = 0, vy = 0;",
+        "var ax = " + target + ".x - x, ay = " + target + ".y - y, drag = 0;"
+        "for(var i = 0; i < 10; i += 1) { drag += (vx*vx + vy*vy)*0.0001; }"
+        "vx += ax*0.001 - vx*drag; vy += ay*0.001 - vy*drag; x += vx; y += vy;"
+        + target + ".x += 0.001;", "");
+    if(swarm == NO_TYPE)
+        return;
+    
+    uint32_t cores = std::max<uint32_t>(std::thread::hardware_concurrency(), 1);
+    std::vector<uint32_t> counts = {0};
+    for(uint32_t threads = 1; threads < cores; threads *= 2)
+        counts.push_back(threads);
+    counts.push_back(cores);
+    
+    double reference = 0, single = 0;
+    for(auto threads : counts)
+    {
+        global.set_threads(threads);
+        global.xs[global.find_position(anchor)] = 500;
+        std::vector<double> ids;
+        for(int i = 0; i < 10000; i++)
+            ids.push_back(global.instance_create(i % 1000, i / 10, swarm));
+        double run = time_seconds([&]
+        {
+            for(int step = 0; step < 20; step++)
+                global.dispatch(EVENT_STEP);
+        });
+        double checksum = 0;
+        for(auto id : ids)
+            checksum += global.xs[global.find_position(id)] + global.ys[global.find_position(id)];
+        for(auto id : ids)
+            global.instance_destroy(id);
+        if(threads == 0)
+        {
+            reference = checksum;
+            printf("serial %.4fs\n", run);
+            continue;
+        }
+        if(threads == 1)
+            single = run;
+        printf("%d threads %.4fs (%.2fx)%s\n", threads, run, single/run, (checksum == reference) ? "" : ", RESULT DIFFERS");
+    }
+    global.set_threads(0);
+    global.instance_destroy(anchor);
+}
+
+// compares startup (source to runnable program) with a cold compile against a bytecode cache hit
+void benchmark_cache()
+{
+    puts("Startup, cold compile vs. bytecode cache hit:");
+    std::string source;
+    for(int i = 0; i < 200; i++)
+        source += "{\n" + benchmark_programs[i % benchmark_programs.size()] + "}\n";
+    std::string cachepath = "benchmark_cache.ngbc";
+    remove(cachepath.data());
+    
+    double cold = 1e30, warm = 1e30;
+    for(int run = 0; run < 5; run++)
+    {
+        remove(cachepath.data());
+        progstate program;
+        cold = std::min(cold, time_seconds([&]{ load_program(source, cachepath, &program); }));
+        progstate cached;
+        bool hit = false;
+        warm = std::min(warm, time_seconds([&]{ load_program(source, cachepath, &cached, &hit); }));
+        if(!hit)
+            puts("Error: bytecode cache missed");
+    }
+    remove(cachepath.data());
+    printf("%zu bytes of source: cold %.4fs, cached %.4fs (%.1fx faster)\n", source.size(), cold, warm, cold/warm);
+}
+
+// recursive calls dominate; fib(n) makes about 2*fib(n+1) calls and ackermann(2, n) about 2n^2
+std::string benchmark_fib_program =
+"function fib(n)\n"
+"{\n"
+"    if(n < 2) return n;\n"
+"    return fib(n-1) + fib(n-2);\n"
+"}\n"
+"var r = fib(22);\n";
+
+std::string benchmark_ackermann_program =
+"function ack(m, n)\n"
+"{\n"
+"    if(m == 0) return n + 1;\n"
+"    if(n == 0) return ack(m - 1, 1);\n"
+"    return ack(m - 1, ack(m, n - 1));\n"
+"}\n"
+"var r = ack(2, 300);\n";
+
+// every call is a tail call, so this runs in one frame
+std::string benchmark_tailcall_program =
+"function loop(n, acc)\n"
+"{\n"
+"    if(n == 0) return acc;\n"
+"    return loop(n - 1, acc + n);\n"
+"}\n"
+"var r = loop(200000, 0);\n";
+
+std::string benchmark_native_program =
+"for(var i = 0; i < 200000; i++)\n"
+"{\n"
+"    host_nop(i, i);\n"
+"}\n";
+
+void benchmark_calls()
+{
+    puts("Function calls:");
+    builtins.add("host_nop", 2, [](progstate * program, const value * args, value * result) { return true; });
+    struct { const char * name; std::string * source; double calls; } cases[] = {
+        {"fib(22)", &benchmark_fib_program, 57313},
+        {"ack(2, 300)", &benchmark_ackermann_program, 182105},
+        {"tail calls", &benchmark_tailcall_program, 200001},
+        {"native in a loop", &benchmark_native_program, 200000},
+    };
+    for(auto & c : cases)
+    {
+        progstate program;
+        program.global = &global;
+        if(!build_program(*c.source, &program))
+        {
+            puts("Benchmark program failed to compile");
+            return;
+        }
+        double best = 1e30;
+        for(int run = 0; run < 3; run++)
+        {
+            program.reset();
+            best = std::min(best, time_seconds([&]{ interpret(&program); }));
+        }
+        printf("%s: %.4fs (%.1fns per call)\n", c.name, best, best/c.calls*1e9);
+    }
+}
+
+// small helpers called from a hot loop
+std::string benchmark_inlining_program =
+"function mix(a, b, t) { return a + (b - a) * t; }\n"
+"function half(v) { return v / 2; }\n"
+"var s = 0;\n"
+"for(var i = 0; i < 100000; i++)\n"
+"{\n"
+"    s += mix(s, i, 0.25) - half(i);\n"
+"}\n";
+
+void benchmark_inlining()
+{
+    puts("Inlining:");
+    global.tracing = false; // the inlined loop would be traced, and this is about the interpreter
+    double times[2] = {0, 0};
+    for(int inlined = 0; inlined < 2; inlined++)
+    {
+        inline_functions = inlined;
+        progstate program;
+        program.global = &global;
+        bool built = build_program(benchmark_inlining_program, &program);
+        inline_functions = true;
+        if(!built)
+        {
+            puts("Benchmark program failed to compile");
+            return;
+        }
+        double best = 1e30;
+        for(int run = 0; run < 3; run++)
+        {
+            program.reset();
+            best = std::min(best, time_seconds([&]{ interpret(&program); }));
+        }
+        times[inlined] = best;
+    }
+    global.tracing = true;
+    printf("calls %.4fs, inlined %.4fs (%.1fx faster)\n", times[0], times[1], times[0]/times[1]);
+}
+
+void benchmark_jit()
+{
+    puts("Baseline jit:");
+    global.tracing = false;
+    struct { const char * name; std::string * source; } cases[] = {
+        {"variables", &benchmark_variables_program},
+        {"fib(22)", &benchmark_fib_program},
+        {"inlined helpers", &benchmark_inlining_program},
+    };
+    for(auto & c : cases)
+    {
+        double times[2] = {0, 0};
+        for(int jit = 0; jit < 2; jit++)
+        {
+            progstate program;
+            program.global = &global;
+            if(!build_program(*c.source, &program))
+            {
+                puts("Benchmark program failed to compile");
+                return;
+            }
+            global.jit = jit;
+            double best = 1e30;
+            for(int run = 0; run < 3; run++)
+            {
+                program.reset();
+                best = std::min(best, time_seconds([&]{ interpret(&program); }));
+            }
+            global.jit = false;
+            times[jit] = best;
+        }
+        printf("%s: interpreted %.4fs, jit %.4fs (%.2fx)\n", c.name, times[0], times[1], times[0]/times[1]);
+    }
+    global.tracing = true;
+}
+
+// a bouncing ball, integrated with half steps of gravity either side of the position update
+std::string benchmark_tracing_program =
+"var y = 0, vspeed = 0, gravity = 0.5, floor = 1000, bounces = 0;\n"
+"for(var i = 0; i < 1000000; i++)\n"
+"{\n"
+"    vspeed += gravity/2;\n"
+"    y += vspeed;\n"
+"    vspeed += gravity/2;\n"
+"    if(y > floor)\n"
+"    {\n"
+"        y = floor;\n"
+"        vspeed = -vspeed * 0.9;\n"
+"        bounces += 1;\n"
+"    }\n"
+"}\n";
+
+void benchmark_tracing()
+{
+    puts("Traced loops:");
+    double times[2] = {0, 0};
+    for(int tracing = 0; tracing < 2; tracing++)
+    {
+        progstate program;
+        program.global = &global;
+        if(!build_program(benchmark_tracing_program, &program))
+        {
+            puts("Benchmark program failed to compile");
+            return;
+        }
+        global.tracing = tracing;
+        double best = 1e30;
+        for(int run = 0; run < 3; run++)
+        {
+            program.reset();
+            best = std::min(best, time_seconds([&]{ interpret(&program); }));
+        }
+        global.tracing = true;
+        times[tracing] = best;
+    }
+    printf("physics loop: interpreted %.4fs, traced %.4fs (%.1fx)\n", times[0], times[1], times[0]/times[1]);
+}
+
+void benchmark_optimizer()
+{
+    puts("Optimizer:");
+    global.tracing = false; // traced loops would hide what the interpreter gains
+    struct { const char * name; std::string * source; } cases[] = {
+        {"variables", &benchmark_variables_program},
+        {"physics loop", &benchmark_tracing_program},
+        {"inlined helpers", &benchmark_inlining_program},
+    };
+    irpassstats before[IRPASS_COUNT];
+    std::copy(ir_stats, ir_stats+IRPASS_COUNT, before);
+    for(auto & c : cases)
+    {
+        double times[2] = {0, 0};
+        for(int optimized = 0; optimized < 2; optimized++)
+        {
+            optimize_bytecode = optimized;
+            progstate program;
+            program.global = &global;
+            bool built = build_program(*c.source, &program);
+            optimize_bytecode = true;
+            if(!built)
+            {
+                puts("Benchmark program failed to compile");
+                return;
+            }
+            double best = 1e30;
+            for(int run = 0; run < 3; run++)
+            {
+                program.reset();
+                best = std::min(best, time_seconds([&]{ interpret(&program); }));
+            }
+            times[optimized] = best;
+        }
+        printf("%s: unoptimized %.4fs, optimized %.4fs (%.2fx)\n", c.name, times[0], times[1], times[0]/times[1]);
+    }
+    global.tracing = true;
+    for(int pass = 0; pass < IRPASS_COUNT; pass++)
+    {
+        auto & stats = ir_stats[pass];
+        printf("  %-28s %8.1fus  %5d -> %5d instructions\n", irpass_names[pass], (stats.seconds - before[pass].seconds)*1e6,
+               int(stats.before - before[pass].before), int(stats.after - before[pass].after));
+    }
+}
+
+// the physics loop as a while loop, with a gravity that isn't a constant, and a sprite moving along a strip
+std::string benchmark_loops_program =
+"var y = 0, vspeed = 0, gravity = 0.5, floor = 1000, bounces = 0, heavy = 1;\n"
+"if(heavy) gravity = 0.75;\n"
+"var left = 0, right = 0, i = 0;\n"
+"while(i < 1000000)\n"
+"{\n"
+"    vspeed += gravity/2;\n"
+"    y += vspeed;\n"
+"    vspeed += gravity/2;\n"
+"    if(y > floor)\n"
+"    {\n"
+"        y = floor;\n"
+"        vspeed = -vspeed * 0.9;\n"
+"        bounces += 1;\n"
+"    }\n"
+"    left = i * 4;\n"
+"    right = i * 4 + 32;\n"
+"    i += 1;\n"
+"}\n";
+
+// loop-invariant code motion and strength reduction, on the physics loops, interpreted and traced
+void benchmark_loop_optimizations()
+{
+    puts("Loop optimizations:");
+    struct { const char * name; std::string * source; } cases[] = {
+        {"physics for loop", &benchmark_tracing_program},
+        {"physics while loop", &benchmark_loops_program},
+    };
+    for(auto & c : cases)
+    {
+        for(int tracing = 0; tracing < 2; tracing++)
+        {
+            double times[2] = {0, 0};
+            for(int optimized = 0; optimized < 2; optimized++)
+            {
+                optimize_bytecode = optimized;
+                progstate program;
+                program.global = &global;
+                bool built = build_program(*c.source, &program);
+                optimize_bytecode = true;
+                if(!built)
+                {
+                    puts("Benchmark program failed to compile");
+                    return;
+                }
+                global.tracing = tracing;
+                double best = 1e30;
+                for(int run = 0; run < 3; run++)
+                {
+                    program.reset();
+                    best = std::min(best, time_seconds([&]{ interpret(&program); }));
+                }
+                global.tracing = true;
+                times[optimized] = best;
+            }
+            printf("%s, %s: unoptimized %.4fs, optimized %.4fs (%.2fx)\n", c.name, tracing ? "traced" : "interpreted",
+                   times[0], times[1], times[0]/times[1]);
+        }
+    }
+}
+
+void benchmark()
+{
+    benchmark_verifier();
+    benchmark_cache();
+    benchmark_variables();
+    benchmark_fields();
+    benchmark_calls();
+    benchmark_inlining();
+    benchmark_jit();
+    benchmark_tracing();
+    benchmark_optimizer();
+    benchmark_loop_optimizations();
+    benchmark_instances();
+    benchmark_churn();
+    benchmark_shared_code();
+    benchmark_objects();
+    benchmark_parallel();
+}
+
+int main(int argc, char ** argv)
+{
+    // for lexer
+    {
+        ops.push_back("&&");
+        ops.push_back("||");
+        
+        //ops.push_back("and");
+        //ops.push_back("or");
+        
+        ops.push_back("++");
+        ops.push_back("--");
+        
+        ops.push_back("+=");
+        ops.push_back("-=");
+        ops.push_back("*=");
+        ops.push_back("/=");
+        
+        ops.push_back("==");
+        ops.push_back("!=");
+        ops.push_back(">=");
+        ops.push_back("<=");
+        
+        ops.push_back(">");
+        ops.push_back("<");
+        
+        ops.push_back("+");
+        ops.push_back("-");
+        ops.push_back("*");
+        ops.push_back("/");
+        
+        ops.push_back("!");
+        
+        ops.push_back("=");
+        ops.push_back(",");
+        
+        ops.push_back(";");
+        ops.push_back("{");
+        ops.push_back("}");
+        ops.push_back("(");
+        ops.push_back(")");
+        
+        ops.push_back(".");
+    }
+    
+    if(argc > 1 and strcmp(argv[1], "bench") == 0)
+    {
+        benchmark();
+        return 0;
+    }
+    if(argc > 2 and strcmp(argv[1], "aot") == 0)
+        return build_aot(argv[2]);
+    if(argc > 1)
+        return run_file(argv[1]);
+    
+    test("var x = 2*4+1==9;");
+    test("var x = 1+2*4==3||1;");
+    test("var x = 3==2*4+1||0;");
+    test("var x = 3==1+2*4;");
+    test("var x = 1*2==3+4;");
+    test("var x = 1+2==3*4;");
+    test("var x = 1+2+3*4*5;");
+    test("var x = 1*2*3+4+5;");
+    test("var x = 1*2+3*4+5;");
+    test("var x = 1+2*3+4*5;");
+    test("var x = 1*2+3+4*5;");
+    test("var x = 1+2*3*4+5;");
+    test("var x = 1+2-3+4-5;");
+    test("var x = 1+(2-3)+4-5;");
+    test("var x = 1+2-(3+4)-5;");
+    test("var x = 1+2-3+(4-5);");
+    test("var x = 100-8+7-6-5;");
+    test("var x = 100-8+7-(6-5);");
+    test("var x = 100-(8+7)-6-5;");
+    test("var x = 100-(8+7)-(6-5);");
+    test("var x = 100-(8+(7-6)-5);");
+    test("var x = +5;");
+    test("var x = -5;");
+    test("var x = 5-;");
+    test("var x = *5;");
+    test("var x = 5*;");
+    test("var x = !5;");
+    test("var x = !!5;");
+    test("var x = !0;");
+    test("var x = !!0;");
+    test("var x = or 5;");
     test("var x = 5 $ r;");
     test("var x = 0 || 3==2*4+1;");
 //     
@@ -2986,6 +4754,9 @@ int main()
     
     test("print(\"Hello, world!\");");
     test("var x = \"Hello, \" + \"world!\"; print(x);");
+    test("var x; x = \"hello\"; print(x);");
+    test("var s = \"\"; s = 5; print(s + 1);");
+    test("var s = \"\"; s += 5;");
     
     test("for(var i = 0; i < 10; i++) print(i);");
     test("for(var i = 0; i < 10; {i++;}) print(i);");
@@ -3021,8 +4792,43 @@ int main()
     test("print(3.1);");
     test("print((1));");
     test("var t = instance_create(3.1, 0, 0); print(t); print(t.x); print(t.id.id.x);");
+    test("var a = instance_create(1, 2, 0); instance_destroy(a); var b = instance_create(3, 4, 0); print(b.x); print(a == b); print(a.x);");
     test("print(1); while (1");
     
+    test("var a = instance_create(1, 2, 0); a.x = 5; a.y += a.x; a.x++; print(a.x); print(a.y);");
+    
+    test("function add(a, b) { return a + b; } print(add(2, 3));");
+    test("function fib(n) { if(n < 2) return n; return fib(n-1) + fib(n-2); } print(fib(15));");
+    test("var scale = 3; function f(x) { var scale = 10; return x*scale; } print(f(2)); print(scale);");
+    test("var base = 4; function g(x) { return x + base; } print(g(1));");
+    test("function noop() { } print(noop());");
+    test("function loop(n) { var t = 0; for(var i = 0; i < n; i++) { if(i == 3) return t; t += i; } return t; } print(loop(10)); print(loop(2));");
+    test("function f(a) { return a; } print(f(1, 2));");
+    test("function f(a) { return a; } function f(b) { return b; }");
+    test("return 5;");
+    test("function even(n) { if(n == 0) return 1; return odd(n - 1); } function odd(n) { if(n == 0) return 0; return even(n - 1); } print(even(2000001));");
+    test("function count(n, acc) { while(1) { if(n == 0) return acc; { var k = n; return count(k - 1, acc + k); } } } print(count(100, 0));");
+    test("function show(x) { return print(x); } print(show(7));");
+    test("function one() { return 1; } return one();");
+    test("function mix(a, b, t) { return a + (b - a) * t; } function mid(a, b) { return mix(a, b, 0.5); } var a = 3; print(mid(a, a + 4)); print(mix(a, 10, 1));");
+    test("function sq(v) { return v * v; } function twice(v) { return sq(v); } var i = 3; print(sq(i + 1)); print(sq(sq(2))); print(twice(i + 1));");
+    test("var k = 5; function leak(v) { return v + k; } function f() { var k = 100; return leak(1); } print(f());");
+    test("function first(a, b) { return a; } print(first(1, nothing));");
+    test("function fact(n) { return n * fact(n - 1); } function posx(o) { return o.x; } var t = instance_create(7, 8, 0); print(posx(t));");
+    test_loader();
+    test_objects();
+    test_nested_events();
+    test_parallel();
+    test_natives();
+    test_jit();
+    test_tracing();
+#ifndef _WIN32
+    test_optimizer();
+    test_specialization();
+    test_aot();
+#endif
+    test_contexts();
+    
     /*
     test("2*3/4");
     test("2/3*4");